@@ -1,601 +1,7778 @@
-#include <stdio.h>
-#include <wchar.h>
-#include <locale.h>
-#include <stdlib.h>
-#include <wctype.h>
-#include <string.h>
-
-#define MAX_LEN 100
-#define BLOCK_WIDTH 6   // larghezza fissa di ciascun blocco
-#define ROWS 9          // numero di righe della griglia
-#define COLS 100        // numero massimo di blocchi (colonne)
-#define MAIN_ROW 4      // riga “centrale” per il circuito
-
-// Blocchi grafici per rappresentare il circuito
-const wchar_t *RES_BLOCK     = L"\\/\\/\\";
-const wchar_t *RX_BLOCK      = L"\\/Rx\\/";  // blocco grafico per resistenza incognita
-const wchar_t *CONN_BLOCK    = L"------";
-const wchar_t *BEND_BLOCK    = L"|-----";
-const wchar_t *NODE_START     = L"----*|";
-const wchar_t *NODE_END       = L"|*----";
-const wchar_t *NODE_BEND      = L"|*---|";
-const wchar_t *PAR_START      = L"|-----";
-const wchar_t *PAR_END        = L"------|";
-const wchar_t *UP_PIPE        = L"|";
-const wchar_t *EMPTY_BLOCK    = L"      ";
-const wchar_t *GEN_BLOCK      = L"---| '---";
-
-// Tipologia dei blocchi (per disegno e calcolo)
-typedef enum {
-    BLOCK_RES,         // Resistenza nota
-    BLOCK_CONN,        // Connessione in serie
-    BLOCK_BEND,        // Bender/curva
-    BLOCK_NODE_START,  // Apertura gruppo parallelo
-    BLOCK_NODE_END,    // Chiusura gruppo parallelo
-    BLOCK_NODE_BEND,   // Simbolo '-' che chiude il circuito
-    BLOCK_PAR_START,   // Inizio ramo parallelo (usa depth=-1)
-    BLOCK_PAR_END,     // Fine ramo parallelo
-    BLOCK_UP_PIPE,     // Collegamento verticale dal generatore
-    BLOCK_UP_RES_PIPE  // Primo elemento dopo il generatore
-} BlockType;
-
-typedef struct Block {
-    BlockType type;
-    int depth;       // 0 per circuito principale, valori negativi per rami paralleli
-    int col;         // posizione orizzontale (sequenziale)
-    int is_unknown;  // 1 se il blocco rappresenta una resistenza incognita (token 'x')
-    double value;    // valore della resistenza (se noto); per "x" viene memorizzato -1
-    struct Block *next;
-} Block;
-
-wchar_t grid[ROWS][COLS * BLOCK_WIDTH];
-Block *head = NULL, *tail = NULL;
-int nodeOpen = 0; // Per alternare apertura/chiusura del gruppo parallelo
-
-/* Prototipi di valutazione */
-double evaluateSeries(Block **p);
-double evaluateParallelGroup(Block **p);
-
-/* --- FUNZIONI DI UTILITÀ PER IL DISPOSITIVO A GRIGLIA --- */
-// Aggiunge un blocco alla lista collegata
-void add_block(BlockType type, int col, int depth, int is_unknown, double value) {
-    Block *b = malloc(sizeof(Block));
-    if(!b) {
-        wprintf(L"Errore di allocazione!\n");
-        exit(1);
-    }
-    b->type = type;
-    b->col = col;
-    b->depth = depth;
-    b->is_unknown = is_unknown;
-    b->value = value;
-    b->next = NULL;
-    if (!head)
-        head = tail = b;
-    else {
-        tail->next = b;
-        tail = b;
-    }
-}
-
-// Inizializza la griglia (riempie tutto di spazi)
-void init_grid() {
-    for (int r = 0; r < ROWS; r++)
-        for (int c = 0; c < COLS * BLOCK_WIDTH; c++)
-            grid[r][c] = L' ';
-}
-
-// Inserisce un blocco grafico nella griglia alla data riga e colonna
-void draw_block(const wchar_t *block, int row, int col) {
-    int offset = col * BLOCK_WIDTH;
-    for (int i = 0; block[i] != L'\0'; i++) {
-        if (offset + i < COLS * BLOCK_WIDTH)
-            grid[row][offset + i] = block[i];
-    }
-}
-
-// Stampa la griglia fino a "max_col" blocchi
-void print_grid(int max_col) {
-    for (int r = 0; r < ROWS; r++) {
-        grid[r][max_col * BLOCK_WIDTH] = L'\0';
-        wprintf(L"%ls\n", grid[r]);
-    }
-}
-
-// Disegna la chiusura del circuito: due conduttori verticali e una linea orizzontale in fondo
-void close_circuit(int max_col) {
-    int start_x = BLOCK_WIDTH / 2;
-    int end_x   = (max_col - 1) * BLOCK_WIDTH + BLOCK_WIDTH / 2;
-    for (int r = MAIN_ROW; r < ROWS; r++)
-        grid[r][start_x] = L'|';
-    for (int r = MAIN_ROW; r < ROWS; r++)
-        grid[r][end_x] = L'|';
-    for (int x = start_x; x <= end_x; x++)
-        grid[ROWS - 1][x] = L'-';
-}
-
-/* --- FUNZIONE DI PARSING --- */
-void parse_circuit(const wchar_t *circuit) {
-    int depth = 0;
-    int col = 0;
-    size_t len = wcslen(circuit);
-    nodeOpen = 0;
-    int first = 1;
-
-    for (size_t i = 0; i < len; i++) {
-        wchar_t token = circuit[i];
-        if(token == L'+')
-            continue;  // il "+" indica il generatore, non genera blocchi
-
-        if(iswdigit(token) || token == L'x') {
-            int is_unknown = 0;
-            double val = 0;
-            if(token == L'x') {
-                is_unknown = 1;
-                val = -1;
-                i++; // consuma 'x'
-            } else {
-                wchar_t number[20] = {0};
-                int k = 0;
-                int has_decimal = 0;
-                while(i < len && (iswdigit(circuit[i]) || circuit[i] == L'.' || circuit[i] == L',')) {
-                    if(circuit[i] == L'.' || circuit[i] == L',') {
-                        if(!has_decimal) {
-                            number[k++] = L'.'; // forza il punto come separatore
-                            has_decimal = 1;
-                        }
-                        i++;
-                        continue;
-                    }
-                    number[k++] = circuit[i++];
-                }
-                i--; // aggiusta l'indice
-                val = wcstod(number, NULL);
-            }
-            if(first) {
-                add_block(BLOCK_UP_RES_PIPE, col++, depth, is_unknown, val);
-                first = 0;
-            } else {
-                add_block(BLOCK_RES, col++, depth, is_unknown, val);
-            }
-            continue;
-        }
-        switch(token) {
-            case L'_':
-                add_block(BLOCK_CONN, col++, depth, 0, 0);
-                break;
-            case L'-':
-                // Il "-" chiude il circuito
-                add_block(BLOCK_NODE_BEND, col++, depth, 0, 0);
-                break;
-            case L'*':
-                // Alterna apertura/chiusura gruppo parallelo
-                if(nodeOpen == 0) {
-                    add_block(BLOCK_NODE_START, col++, depth, 0, 0);
-                    nodeOpen = 1;
-                    first = 1; // resetta per il gruppo parallelo
-                } else {
-                    add_block(BLOCK_NODE_END, col++, depth, 0, 0);
-                    nodeOpen = 0;
-                }
-                break;
-            case L'|':
-                if(i+1 < len && circuit[i+1] == L'|') {
-                    depth = -1;
-                    i++;
-                    add_block(BLOCK_PAR_START, col++, depth, 0, 0);
-                    first = 1; // resetta per il ramo parallelo
-                } else {
-                    add_block(BLOCK_BEND, col++, depth, 0, 0);
-                }
-                break;
-            case L'=':
-                add_block(BLOCK_PAR_END, col++, depth, 0, 0);
-                depth = 0;
-                break;
-            default:
-                break;
-        }
-    }
-    // Se il primo blocco non è il collegamento al generatore, lo inseriamo in testa
-    if(head && head->type != BLOCK_UP_RES_PIPE) {
-        Block *pipe = malloc(sizeof(Block));
-        pipe->type = BLOCK_UP_RES_PIPE;
-        pipe->col = 0;
-        pipe->depth = 0;
-        pipe->is_unknown = 0;
-        pipe->value = 0;
-        pipe->next = head;
-        head = pipe;
-    }
-}
-
-/* --- FUNZIONI DI RENDERING --- */
-// Se un blocco di tipo resistenza ha is_unknown true, usa RX_BLOCK
-void render_blocks() {
-    Block *curr = head;
-    while(curr) {
-        int row = MAIN_ROW + curr->depth;
-        switch(curr->type) {
-            case BLOCK_RES:
-            case BLOCK_UP_RES_PIPE:
-                if(curr->is_unknown)
-                    draw_block(RX_BLOCK, row, curr->col);
-                else
-                    draw_block(RES_BLOCK, row, curr->col);
-                break;
-            case BLOCK_CONN:
-                draw_block(CONN_BLOCK, row, curr->col);
-                break;
-            case BLOCK_BEND:
-                draw_block(BEND_BLOCK, row, curr->col);
-                break;
-            case BLOCK_NODE_START:
-                draw_block(NODE_START, row, curr->col);
-                break;
-            case BLOCK_NODE_END:
-                draw_block(NODE_END, row, curr->col);
-                break;
-            case BLOCK_NODE_BEND:
-                draw_block(NODE_BEND, row, curr->col);
-                break;
-            case BLOCK_PAR_START:
-                draw_block(PAR_START, row, curr->col);
-                break;
-            case BLOCK_PAR_END:
-                draw_block(PAR_END, row, curr->col);
-                break;
-            case BLOCK_UP_PIPE:
-                draw_block(UP_PIPE, MAIN_ROW - 1, curr->col);
-                break;
-        }
-        curr = curr->next;
-    }
-}
-
-// Disegna il generatore centrato sotto il circuito
-void draw_generator(int max_col) {
-    int gen_len = wcslen(GEN_BLOCK);
-    int total_width = max_col * BLOCK_WIDTH;
-    int pad = (total_width - gen_len) / 2;
-    for (int i = 0; i < pad; i++)
-        wprintf(L" ");
-    wprintf(L"%ls\n", GEN_BLOCK);
-}
-
-/* --- FUNZIONI DI CALCOLO DELLA RESISTENZA EQUVALENTE --- */
-// Le funzioni di calcolo ignorano le resistenze incognite (is_unknown == 1)
-double evaluateSeries(Block **p) {
-    double total = 0.0;
-    while(*p) {
-        Block *curr = *p;
-        if ((curr->type == BLOCK_RES || curr->type == BLOCK_UP_RES_PIPE) && !curr->is_unknown) {
-            total += curr->value;
-            *p = curr->next;
-        }
-        else if (curr->type == BLOCK_NODE_START) {
-            *p = curr->next;
-            total += evaluateParallelGroup(p);
-        }
-        else if (curr->type == BLOCK_NODE_END ||
-                 curr->type == BLOCK_PAR_START ||
-                 curr->type == BLOCK_PAR_END) {
-            break;
-        }
-        else {
-            *p = curr->next;
-        }
-    }
-    return total;
-}
-
-double evaluateParallelGroup(Block **p) {
-    double branches[10] = {0};
-    int count = 0;
-    
-    // Primo ramo
-    branches[count++] = evaluateSeries(p);
-    
-    // Eventuali rami separati da BLOCK_PAR_START ... BLOCK_PAR_END
-    while(*p && (*p)->type == BLOCK_PAR_START) {
-        *p = (*p)->next; // consuma separatore
-        branches[count++] = evaluateSeries(p);
-        if(*p && (*p)->type == BLOCK_PAR_END)
-            *p = (*p)->next;
-        else
-            break;
-    }
-    if(*p && (*p)->type == BLOCK_NODE_END)
-        *p = (*p)->next;
-    
-    double invSum = 0.0;
-    for(int i = 0; i < count; i++){
-        if(branches[i] > 0)
-            invSum += 1.0 / branches[i];
-    }
-    double parallelValue = (invSum > 0) ? (1.0 / invSum) : 0.0;
-    return parallelValue;
-}
-
-double calculate_total_resistance_new() {
-    Block *p = head;
-    return evaluateSeries(&p);
-}
-
-/* --- FUNZIONI PER LA GESTIONE DELLE INCOGNITE --- */
-// Conta il numero di resistenze incognite
-int count_unknowns() {
-    int count = 0;
-    for(Block *cur = head; cur; cur = cur->next) {
-        if ((cur->type == BLOCK_RES || cur->type == BLOCK_UP_RES_PIPE) && cur->is_unknown)
-            count++;
-    }
-    return count;
-}
-
-// --- FUNZIONI DI CALCOLO SIMBOLICO (per incognite in gruppi paralleli) ---
-// Questa parte applica il flowchart per circuiti series-parallel dove l'incognita appare in un gruppo parallelo.
-// La struttura attesa è:
-//   + S0 _ [ parallel group: BLOCK_NODE_START, branch1: (S_u + X) ; eventualmente separato da BLOCK_PAR_START,
-//             branch2: S_k (completa, nota), e poi BLOCK_PAR_END, BLOCK_NODE_END ] _ S3 -
-// Dove:
-//   S0: somma dei resistori in serie prima del gruppo parallelo,
-//   S3: somma dei resistori in serie dopo il gruppo parallelo,
-//   S_u: somma dei resistori noti nella branch contenente l'incognita,
-//   S_k: somma (o valore univoco) nella branch completamente nota.
-//
-// L'equazione è:
-//   Req_measured = S0 + ( (S_u + X)*S_k/(S_u + X + S_k) ) + S3
-// Da cui risolvendo per X si ottiene:
-//   X = (R_par * S_k)/(S_k - R_par) - S_u,    dove R_par = Req_measured - (S0 + S3)
-// Se la struttura non viene rilevata, la funzione restituisce 0.
-int extract_parallel_structure(double *pS0, double *pS3, double *pSu, double *pSk) {
-    Block *cur = head;
-    double S0 = 0, S3 = 0;
-    // S0: somma dei resistori in serie prima del primo BLOCK_NODE_START
-    while(cur && cur->type != BLOCK_NODE_START) {
-        if ((cur->type == BLOCK_RES || cur->type == BLOCK_UP_RES_PIPE) && !cur->is_unknown)
-            S0 += cur->value;
-        cur = cur->next;
-    }
-    if(!cur) return 0; // nessun gruppo parallelo trovato
-
-    // Il gruppo parallelo inizia con BLOCK_NODE_START
-    Block *group_start = cur; // BLOCK_NODE_START
-    cur = cur->next;
-    // Consideriamo l'ipotesi con due branche
-    double branch1 = 0;
-    int branch1_unknown = 0;
-    while(cur && cur->type != BLOCK_PAR_START && cur->type != BLOCK_NODE_END) {
-        if(cur->type == BLOCK_RES || cur->type == BLOCK_UP_RES_PIPE) {
-            if(cur->is_unknown)
-                branch1_unknown = 1;
-            else
-                branch1 += cur->value;
-        }
-        cur = cur->next;
-    }
-    double branch2 = 0;
-    int branch2_unknown = 0;
-    if(cur && cur->type == BLOCK_PAR_START) {
-        cur = cur->next;
-        while(cur && cur->type != BLOCK_NODE_END && cur->type != BLOCK_PAR_END) {
-            if(cur->type == BLOCK_RES || cur->type == BLOCK_UP_RES_PIPE) {
-                if(cur->is_unknown)
-                    branch2_unknown = 1;
-                else
-                    branch2 += cur->value;
-            }
-            cur = cur->next;
-        }
-        if(cur && cur->type == BLOCK_PAR_END)
-            cur = cur->next;
-    }
-    if(cur && cur->type == BLOCK_NODE_END)
-        cur = cur->next;
-    while(cur) {
-        if ((cur->type == BLOCK_RES || cur->type == BLOCK_UP_RES_PIPE) && !cur->is_unknown)
-            S3 += cur->value;
-        cur = cur->next;
-    }
-
-    if(branch1_unknown && !branch2_unknown) {
-        *pSu = branch1;
-        *pSk = branch2;
-    } else if(branch2_unknown && !branch1_unknown) {
-        *pSu = branch2;
-        *pSk = branch1;
-    } else {
-        return 0;
-    }
-    *pS0 = S0;
-    *pS3 = S3;
-    return 1;
-}
-// Fine area funzioni simboliche
-
-/* --- FUNZIONI DI DISEGNO "CUSTOM" PER CIRCUITI SEMPLICI --- */
-// Se il circuito non contiene gruppi paralleli né incognite, lo consideriamo semplice.
-int isSimpleCircuit() {
-    Block *cur = head;
-    while(cur) {
-         if(cur->type == BLOCK_NODE_START || cur->type == BLOCK_NODE_END ||
-            cur->type == BLOCK_PAR_START || cur->type == BLOCK_PAR_END ||
-            ((cur->type == BLOCK_RES || cur->type == BLOCK_UP_RES_PIPE) && cur->is_unknown))
-              return 0;
-         cur = cur->next;
-    }
-    return 1;
-}
-
-void customDrawSimpleCircuit() {
-    wprintf(L"\n=== Disegno del circuito ===\n\n");
-    wprintf(L"|-----%ls-----|\n", RES_BLOCK);
-    wprintf(L"|               |\n");
-    wprintf(L"|------| '------|\n");
-}
-
-/* --- ISTRUZIONI --- */
-void print_instructions() {
-    wprintf(L"\n=== Istruzioni ===\n"
-            L"+       -> Generatore (inizio circuito)\n"
-            L"Numero  -> Resistenza (es: 10, 47, ecc.)\n"
-            L"x       -> Resistenza incognita da trovare\n"
-            L"_       -> Connessione in serie\n"
-            L"*       -> Nodo (inizio/fine gruppo parallelo)\n"
-            L"||      -> Inizio ramo parallelo (separa i rami)\n"
-            L"=       -> Fine ramo parallelo\n"
-            L"-       -> Chiusura circuito\n"
-            L"\nEsempio valido: +10_20*x||30=*-\n");
-}
-
-int main() {
-    setlocale(LC_ALL, "");
-    wchar_t circuit[MAX_LEN];
-    double I = -1, V = -1;
-    int resolved = 0; // Visibile in tutto main
-
-    head = NULL;
-    tail = NULL;
-
-    wprintf(L"+++ Circuit Resolver con gestione delle incognite (flowchart) +++\n");
-    print_instructions();
-    wprintf(L"Inserisci circuito: ");
-
-    if (!fgetws(circuit, MAX_LEN, stdin)) {
-        wprintf(L"Errore di lettura del circuito.\n");
-        return 1;
-    }
-    circuit[wcslen(circuit) - 1] = (circuit[wcslen(circuit) - 1] == L'\n') ? L'\0' : circuit[wcslen(circuit) - 1];
-
-    size_t len = wcslen(circuit);
-    if(len < 2 || circuit[0] != L'+' || circuit[len - 1] != L'-') {
-        wprintf(L"Errore: il circuito deve iniziare con '+' e terminare con '-'.\n");
-        return 1;
-    }
-
-    parse_circuit(circuit);
-
-    if(isSimpleCircuit()) {
-        customDrawSimpleCircuit();
-    } else {
-        init_grid();
-        render_blocks();
-
-        int max_col = 0;
-        for(Block *b = head; b; b = b->next)
-            if(b->col > max_col)
-                max_col = b->col;
-        max_col++;
-
-        close_circuit(max_col);
-
-        wprintf(L"\n=== Disegno del circuito ===\n\n");
-        print_grid(max_col);
-        draw_generator(max_col);
-    }
-
-    double Req_known = calculate_total_resistance_new();
-    wprintf(L"\n--- Calcoli ---\n");
-    wprintf(L"Somma delle resistenze note (Req_known): %.2f Ohm\n", Req_known);
-
-    int unknown_count = count_unknowns();
-    double Req_measured = 0; // Per resistenza equivalente misurata o sum note
-
-    if (unknown_count == 1) {
-        double S0, S3, S_u, S_k;
-        resolved = extract_parallel_structure(&S0, &S3, &S_u, &S_k);
-        if (resolved) {
-            wprintf(L"\nIl circuito contiene una resistenza incognita in un gruppo parallelo.\n");
-        } else {
-            wprintf(L"\nIl circuito contiene una resistenza incognita in serie.\n");
-            S0 = S3 = S_u = S_k = 0;
-        }
-
-        int valid = 0;
-        wchar_t buffer[64];
-
-        for (int attempt = 0; attempt < 3 && !valid; attempt++) {
-            wprintf(L"Inserisci il valore complessivo misurato (Req): ");
-            fflush(stdout);
-            if (fgetws(buffer, sizeof(buffer) / sizeof(wchar_t), stdin) != NULL) {
-                buffer[wcscspn(buffer, L"\n")] = L'\0';
-                Req_measured = wcstod(buffer, NULL);
-
-                if (Req_measured <= 0) {
-                    wprintf(L"Errore: il valore misurato deve essere positivo.\n");
-                    continue;
-                }
-
-                if (resolved) {
-                    double R_par_actual = Req_measured - (S0 + S3);
-                    if (S_k <= R_par_actual || R_par_actual <= 0) {
-                        wprintf(L"Errore: dati non validi (S_k=%.2f, R_par=%.2f).\n", S_k, R_par_actual);
-                        continue;
-                    }
-                    double Rx = (R_par_actual * S_k) / (S_k - R_par_actual) - S_u;
-                    if (Rx <= 0) {
-                        wprintf(L"Errore: il calcolo di Rx risulta zero o negativo (%.2f Ohm).\n", Rx);
-                        continue;
-                    }
-                    wprintf(L"Resistenza incognita Rx calcolata: %.2f Ohm\n", Rx);
-                    valid = 1;
-                } else {
-                    double Rx = Req_measured - Req_known;
-                    if (Rx <= 0) {
-                        wprintf(L"Errore: il calcolo di Rx risulta zero o negativo (%.2f Ohm). Controlla i dati!\n", Rx);
-                    } else {
-                        wprintf(L"Resistenza incognita Rx calcolata: %.2f Ohm\n", Rx);
-                        valid = 1;
-                    }
-                }
-            }
-        }
-
-        if (!valid) {
-            wprintf(L"\nValore non valido dopo 3 tentativi. Impossibile calcolare Rx.\n");
-            return 1;
-        }
-    } else if (unknown_count > 1) {
-        wprintf(L"\nIl circuito contiene più di una resistenza incognita. Calcolo non supportato.\n");
-        return 1;
-    } else {
-        // Nessuna incognita, usa la somma nota come valore equivalente
-        Req_measured = Req_known;
-    }
-
-    // Variabile per resistenza da usare nel calcolo di corrente e tensione
-    double Req_for_current = Req_measured;
-
-    wchar_t input[50];
-    wprintf(L"\nInserisci corrente I (A), se nota (-1 se non nota): ");
-    if(fgetws(input, sizeof(input) / sizeof(wchar_t), stdin)) {
-        input[wcscspn(input, L"\n")] = L'\0';
-        I = wcstod(input, NULL);
-    }
-    wprintf(L"Inserisci tensione V (V), se nota (-1 se non nota): ");
-    if(fgetws(input, sizeof(input) / sizeof(wchar_t), stdin)) {
-        input[wcscspn(input, L"\n")] = L'\0';
-        V = wcstod(input, NULL);
-    }
-
-    if (Req_for_current <= 0) {
-        wprintf(L"Errore: resistenza per calcolo corrente/tensione non valida (<= 0).\n");
-        return 1;
-    }
-
-    if (I > 0 && V <= 0)
-        V = I * Req_for_current;
-    else if (V > 0 && I <= 0)
-        I = V / Req_for_current;
-
-    wprintf(L"Tensione: %s%.2f V\n", V > 0 ? L"" : L"(non disponibile) ", V > 0 ? V : 0);
-    wprintf(L"Corrente: %s%.2f A\n", I > 0 ? L"" : L"(non disponibile) ", I > 0 ? I : 0);
-
-    if (I > 0 && V > 0)
-        wprintf(L"\nCalcoli completati con successo.\n");
-    else
-        wprintf(L"\nNon tutti i dati sono disponibili per completare l'analisi.\n");
-
-    return 0;
-}
\ No newline at end of file
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <wchar.h>
+#include <locale.h>
+#include <stdlib.h>
+#include <wctype.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <math.h>
+#include <float.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
+#include <errno.h>
+
+#define BLOCK_WIDTH 6   // larghezza fissa di ciascun blocco
+#define ROWS 9          // numero minimo di righe della griglia
+#define MAIN_ROW 4      // riga “centrale” minima per il circuito
+#define DRAW_MAX_CELLS (1 << 25) // oltre questa dimensione il disegno non è leggibile
+
+// Blocchi grafici per rappresentare il circuito
+const wchar_t *RES_BLOCK     = L"\\/\\/\\";
+const wchar_t *RX_BLOCK      = L"\\/Rx\\/";  // blocco grafico per resistenza incognita
+const wchar_t *CONN_BLOCK    = L"------";
+const wchar_t *BEND_BLOCK    = L"|-----";
+const wchar_t *NODE_START     = L"----*|";
+const wchar_t *NODE_END       = L"|*----";
+const wchar_t *NODE_BEND      = L"|*---|";
+const wchar_t *PAR_START      = L"|-----";
+const wchar_t *PAR_END        = L"------|";
+const wchar_t *UP_PIPE        = L"|";
+const wchar_t *EMPTY_BLOCK    = L"      ";
+const wchar_t *GEN_BLOCK      = L"---| '---";
+
+// Tipologia dei blocchi (per disegno e calcolo)
+typedef enum {
+    BLOCK_RES,         // Resistenza nota
+    BLOCK_CONN,        // Connessione in serie
+    BLOCK_BEND,        // Bender/curva
+    BLOCK_NODE_START,  // Apertura gruppo parallelo
+    BLOCK_NODE_END,    // Chiusura gruppo parallelo
+    BLOCK_NODE_BEND,   // Simbolo '-' che chiude il circuito
+    BLOCK_PAR_START,   // Inizio ramo parallelo (usa depth=-1)
+    BLOCK_PAR_END,     // Fine ramo parallelo
+    BLOCK_UP_PIPE,     // Collegamento verticale dal generatore
+    BLOCK_UP_RES_PIPE  // Primo elemento dopo il generatore
+} BlockType;
+
+// Natura di un elemento: le analisi in continua conoscono solo le resistenze,
+// condensatori e induttori servono all'analisi in alternata (--sweep)
+typedef enum {
+    ELEM_R,            // resistenza (Ohm)
+    ELEM_C,            // condensatore (F), token 'C'
+    ELEM_L             // induttore (H), token 'L'
+} ElemKind;
+
+typedef struct Block {
+    BlockType type;
+    int depth;       // 0 per circuito principale, valori negativi per rami paralleli
+    int col;         // posizione orizzontale (sequenziale)
+    int is_unknown;  // 1 se il blocco rappresenta una resistenza incognita (token 'x')
+    int elem;        // ElemKind dell'elemento
+    double value;    // valore dell'elemento (se noto); per "x" viene memorizzato -1
+    struct Block *next;
+} Block;
+
+// realloc che termina il programma se la memoria è esaurita
+static void *xrealloc(void *p, size_t size) {
+    void *np = realloc(p, size ? size : 1);
+    if(!np) {
+        fprintf(stderr, "Errore di allocazione!\n");
+        exit(1);
+    }
+    return np;
+}
+
+// Secondi trascorsi da t0 (orologio monotono)
+static double elapsed_since(const struct timespec *t0) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) * 1e-9;
+}
+
+/* --- ARENA PER I BLOCCHI --- */
+// Tutti i Block di un circuito vivono in un'arena a blocchi concatenati: l'allocazione
+// è un semplice incremento di puntatore e reset_circuit() la svuota in O(1).
+// I chunk non vengono mai restituiti al sistema, quindi dopo il primo circuito
+// di dimensione massima non ci sono più chiamate a malloc.
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t size;            // byte disponibili in data
+    size_t used;            // byte già assegnati
+    _Alignas(ARENA_ALIGN) unsigned char data[];
+} ArenaChunk;
+
+typedef struct {
+    ArenaChunk *first;      // primo chunk (punto di ripartenza del reset)
+    ArenaChunk *current;    // chunk da cui si sta allocando
+    size_t in_use;          // byte occupati dal circuito corrente
+    size_t peak;            // massimo di in_use dall'avvio
+    size_t chunks;          // chunk allocati con malloc
+} Arena;
+
+static ArenaChunk *arena_new_chunk(Arena *a, size_t n) {
+    size_t size = n > ARENA_CHUNK_SIZE ? n : ARENA_CHUNK_SIZE;
+    ArenaChunk *c = malloc(sizeof(ArenaChunk) + size);
+    if(!c) {
+        fprintf(stderr, "Errore di allocazione!\n");
+        exit(1);
+    }
+    c->size = size;
+    c->used = 0;
+    c->next = NULL;
+    a->chunks++;
+    return c;
+}
+
+void *arena_alloc(Arena *a, size_t n) {
+    n = (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    ArenaChunk *c = a->current;
+    if(!c || c->used + n > c->size) {
+        ArenaChunk *next = c ? c->next : a->first;
+        if(c)
+            a->in_use += c->size - c->used; // la coda inutilizzata conta come occupata
+        if(next && n <= next->size) {
+            // riusa il chunk successivo già allocato
+            next->used = 0;
+            c = next;
+        } else {
+            ArenaChunk *fresh = arena_new_chunk(a, n);
+            fresh->next = next;
+            if(c)
+                c->next = fresh;
+            else
+                a->first = fresh;
+            c = fresh;
+        }
+        a->current = c;
+    }
+    void *p = c->data + c->used;
+    c->used += n;
+    a->in_use += n;
+    if(a->in_use > a->peak)
+        a->peak = a->in_use;
+    return p;
+}
+
+// Svuota l'arena in O(1): i chunk restano disponibili per il prossimo circuito
+void arena_reset(Arena *a) {
+    a->current = a->first;
+    if(a->first)
+        a->first->used = 0;
+    a->in_use = 0;
+}
+
+void arena_free(Arena *a) {
+    ArenaChunk *c = a->first;
+    while(c) {
+        ArenaChunk *next = c->next;
+        free(c);
+        c = next;
+    }
+    memset(a, 0, sizeof(*a));
+}
+
+/* --- STATISTICHE DI ESECUZIONE --- */
+// Con --stats ogni contesto registra la durata di ogni fase (orologio monotono) e alcuni
+// contatori; alla distruzione del contesto i dati confluiscono nel totale della corsa,
+// scritto in JSON all'uscita. Senza --stats il puntatore del contesto è NULL e ogni
+// punto di misura costa un solo confronto. Le durate finiscono in un istogramma
+// logaritmico (STATS_SUB intervalli per ottava, circa il 4.4%) che dà il p99 con
+// memoria costante anche su batch di milioni di circuiti.
+enum { PHASE_PARSE, PHASE_EVALUATE, PHASE_COMPILE, PHASE_BYTECODE, PHASE_SOLVE, PHASE_RENDER, PHASE_FIT,
+       PHASE_NETLIST, PHASE_COUNT };
+static const char *const PHASE_NAMES[PHASE_COUNT] = { "parse", "evaluate", "compile", "bytecode", "solve", "render",
+                                                      "fit", "netlist" };
+
+#define STATS_SUB 16                    // intervalli dell'istogramma per ottava
+#define STATS_OCTAVES 48                // da 1 ns a circa 3 giorni
+#define STATS_BUCKETS (STATS_SUB * STATS_OCTAVES)
+
+typedef struct {
+    long count;
+    double total, min, max;             // secondi
+    long hist[STATS_BUCKETS];
+} PhaseStats;
+
+typedef struct Stats {
+    PhaseStats phase[PHASE_COUNT];
+    long blocks;                        // blocchi creati dal parsing
+    long allocations;                   // chunk dell'arena e crescite di array dei contesti
+    long grid_cells;                    // caratteri scritti nella griglia di disegno
+    long solver_iterations;             // iterazioni di fit e analisi nodale
+    long cache_hits, cache_misses;      // ricerche nella cache (sottocircuiti e circuiti)
+    struct Stats *total;                // totale della corsa (NULL per il totale stesso)
+    pthread_mutex_t lock;               // protegge il totale
+} Stats;
+
+Stats *stats_create(Stats *total) {
+    Stats *st = calloc(1, sizeof(Stats));
+    if(!st) {
+        fprintf(stderr, "Errore di allocazione!\n");
+        exit(1);
+    }
+    st->total = total;
+    pthread_mutex_init(&st->lock, NULL);
+    return st;
+}
+
+static void phase_add(PhaseStats *p, double seconds) {
+    if(p->count == 0 || seconds < p->min)
+        p->min = seconds;
+    if(seconds > p->max)
+        p->max = seconds;
+    p->count++;
+    p->total += seconds;
+    int b = 0;
+    if(seconds > 1e-9) {
+        b = (int)(log2(seconds * 1e9) * STATS_SUB);
+        if(b >= STATS_BUCKETS)
+            b = STATS_BUCKETS - 1;
+    }
+    p->hist[b]++;
+}
+
+// Limite superiore dell'intervallo che contiene il quantile q, ristretto a [min, max]
+static double phase_quantile(const PhaseStats *p, double q) {
+    long rank = (long)ceil(q * p->count), seen = 0;
+    for(int b = 0; b < STATS_BUCKETS; b++) {
+        seen += p->hist[b];
+        if(seen >= rank) {
+            double upper = exp2((double)(b + 1) / STATS_SUB) * 1e-9;
+            return upper < p->min ? p->min : upper > p->max ? p->max : upper;
+        }
+    }
+    return p->max;
+}
+
+// Somma "src" in "dst" (il chiamante garantisce l'accesso esclusivo a dst)
+static void stats_merge(Stats *dst, const Stats *src) {
+    for(int i = 0; i < PHASE_COUNT; i++) {
+        PhaseStats *d = &dst->phase[i];
+        const PhaseStats *s = &src->phase[i];
+        if(s->count == 0)
+            continue;
+        if(d->count == 0 || s->min < d->min)
+            d->min = s->min;
+        if(s->max > d->max)
+            d->max = s->max;
+        d->count += s->count;
+        d->total += s->total;
+        for(int b = 0; b < STATS_BUCKETS; b++)
+            d->hist[b] += s->hist[b];
+    }
+    dst->blocks += src->blocks;
+    dst->allocations += src->allocations;
+    dst->grid_cells += src->grid_cells;
+    dst->solver_iterations += src->solver_iterations;
+    dst->cache_hits += src->cache_hits;
+    dst->cache_misses += src->cache_misses;
+}
+
+// Confluisce nel totale della corsa (se non è il totale stesso) e libera le statistiche
+void stats_release(Stats *st) {
+    if(!st)
+        return;
+    if(st->total) {
+        pthread_mutex_lock(&st->total->lock);
+        stats_merge(st->total, st);
+        pthread_mutex_unlock(&st->total->lock);
+    }
+    pthread_mutex_destroy(&st->lock);
+    free(st);
+}
+
+// Registra una misura direttamente nel totale (fasi fuori da un contesto)
+void stats_record(Stats *total, int phase, double seconds, long iterations) {
+    if(!total)
+        return;
+    pthread_mutex_lock(&total->lock);
+    phase_add(&total->phase[phase], seconds);
+    total->solver_iterations += iterations;
+    pthread_mutex_unlock(&total->lock);
+}
+
+void write_stats(FILE *out, const Stats *st, double wall) {
+    fprintf(out, "{\"wall_seconds\":%.6g,\"phases\":{", wall);
+    int first = 1;
+    for(int i = 0; i < PHASE_COUNT; i++) {
+        const PhaseStats *p = &st->phase[i];
+        if(p->count == 0)
+            continue;
+        fprintf(out, "%s\"%s\":{\"count\":%ld,\"total_seconds\":%.6g,\"min_seconds\":%.6g,"
+                     "\"avg_seconds\":%.6g,\"p99_seconds\":%.6g,\"max_seconds\":%.6g}",
+                first ? "" : ",", PHASE_NAMES[i], p->count, p->total, p->min,
+                p->total / p->count, phase_quantile(p, 0.99), p->max);
+        first = 0;
+    }
+    fprintf(out, "},\"counters\":{\"blocks\":%ld,\"allocations\":%ld,\"grid_cells\":%ld,\"solver_iterations\":%ld,"
+                 "\"cache_hits\":%ld,\"cache_misses\":%ld}}\n",
+            st->blocks, st->allocations, st->grid_cells, st->solver_iterations, st->cache_hits, st->cache_misses);
+}
+
+// Punti di misura: non fanno nulla se st è NULL
+static inline void stats_start(const Stats *st, struct timespec *t0) {
+    if(st)
+        clock_gettime(CLOCK_MONOTONIC, t0);
+}
+
+static inline void stats_stop(Stats *st, int phase, const struct timespec *t0) {
+    if(st)
+        phase_add(&st->phase[phase], elapsed_since(t0));
+}
+
+#define STATS_COUNT(st, field, n) do { if(st) (st)->field += (n); } while(0)
+
+/* --- TOPOLOGIA COMPATTA (STRUCTURE OF ARRAYS) --- */
+// Dopo il parsing la lista dei blocchi viene appiattita una sola volta in un albero
+// serie-parallelo memorizzato in ordine postfisso (i figli precedono il padre).
+// Il sottoalbero del nodo i occupa l'intervallo contiguo [start[i], i], per cui ogni
+// gruppo e ogni ramo è uno span di indici. Tutte le passate di calcolo e di analisi
+// lavorano su questi array e non toccano i campi di solo disegno (col, depth).
+typedef enum {
+    TOPO_RES,      // foglia: resistenza nota o incognita
+    TOPO_SERIES,   // serie dei figli (circuito principale o ramo)
+    TOPO_PAR       // gruppo parallelo: ogni figlio è un ramo TOPO_SERIES
+} TopoKind;
+
+// Gruppo ancora aperto durante la costruzione della topologia
+typedef struct {
+    int kind;               // TOPO_SERIES o TOPO_PAR
+    int first;              // primo nodo del sottoalbero
+    int count;              // figli emessi finora
+} TopoFrame;
+
+typedef struct {
+    int n;                  // numero di nodi
+    int cap;                // capacità degli array
+    unsigned char *kind;    // TopoKind di ogni nodo
+    double *value;          // valore delle foglie note (0 per incognite e gruppi)
+    unsigned char *elem;    // ElemKind delle foglie (ELEM_R per i gruppi)
+    int *nchild;            // numero di figli diretti (0 per le foglie)
+    int *start;             // primo nodo del sottoalbero
+    uint64_t *unknown;      // bitmask delle foglie incognite, un bit per nodo
+    int n_unknown;          // foglie incognite
+    int n_reactive;         // condensatori e induttori
+    int n_groups;           // gruppi paralleli
+    int max_stack;          // profondità massima dello stack di valutazione
+    int malformed;          // 1 se sono stati ignorati separatori fuori posto
+    double *stack;          // stack di lavoro per la valutazione
+    TopoFrame *frames;      // stack esplicito dei gruppi aperti durante la costruzione
+    int frames_n, frames_cap;
+    struct StreamFold *fold;  // valutazione in streaming: i nodi non vengono memorizzati
+    long allocs;            // crescite degli array (per --stats)
+} Topology;
+
+#define TOPO_IS_UNKNOWN(t, i) (((t)->unknown[(i) >> 6] >> ((i) & 63)) & 1)
+
+/* --- CONTESTO DI UN CIRCUITO --- */
+// Tutto lo stato di parsing, disegno e calcolo di un circuito: nessuna variabile globale,
+// così più circuiti possono essere analizzati in parallelo con un contesto per thread.
+typedef struct {
+    Arena arena;                            // memoria dei blocchi
+    Block *head, *tail;                     // lista dei blocchi
+    unsigned char *nest;                    // gruppi e rami aperti durante il parsing
+    int nest_n, nest_cap;
+    Topology topo;                          // topologia compatta per i calcoli
+    wchar_t *grid;                          // griglia di disegno, riga per riga con '\n' finale
+    size_t grid_cap;
+    int grid_rows, grid_width;              // righe e caratteri per riga (senza '\n')
+    int main_row;                           // riga del circuito principale
+    size_t grid_len;                        // caratteri del disegno completo
+    int topology_only;                      // 1 = il parser costruisce solo la topologia, senza blocchi
+    char *narrow;                           // testo ristretto a byte per parse_circuit
+    size_t narrow_cap;
+    long allocs;                            // crescite di nest, narrow e grid (per --stats)
+    Stats *stats;                           // statistiche, NULL se --stats è disattivato
+    struct SubCache *cache;                 // cache condivisa dei sottocircuiti (NULL = spenta)
+    uint64_t *hash;                         // due hash canonici per nodo della topologia
+    int *jump;                              // valutazione con cache: radice in cache per inizio
+    double *cached;                         // valore delle radici trovate in cache
+    int cache_nodes;                        // capacità di hash, jump e cached
+    struct CachePair *pairs;                // rami di un parallelo in ordine canonico
+    int pairs_cap;
+    long cache_hits, cache_misses;          // ricerche di sottocircuiti
+    long record_hits, record_misses;        // ricerche di circuiti interi (batch)
+    struct WorkPool *pool;                  // valutazione fork-join dei circuiti grandi (NULL = sequenziale)
+    struct ForkJoin *fork;                  // piano e buffer della valutazione fork-join
+} CircuitContext;
+
+#define GRID(ctx, r, c) ((ctx)->grid[(size_t)(r) * ((ctx)->grid_width + 1) + (c)])
+
+// "total" è il totale della corsa per --stats (NULL per non misurare)
+CircuitContext *context_create(Stats *total) {
+    CircuitContext *ctx = calloc(1, sizeof(CircuitContext));
+    if(!ctx) {
+        fprintf(stderr, "Errore di allocazione!\n");
+        exit(1);
+    }
+    if(total)
+        ctx->stats = stats_create(total);
+    return ctx;
+}
+
+/* Prototipi di costruzione della topologia */
+void build_topology(CircuitContext *ctx);
+void topo_begin(Topology *t);
+void topo_feed(Topology *t, BlockType type, int is_unknown, int elem, double value);
+void topo_end(Topology *t);
+void topo_free(Topology *t);
+static void fold_open(Topology *t, int frame, int kind);
+static void fold_leaf(Topology *t, int frame, double value, int is_unknown, int elem);
+static void fold_close(Topology *t, int frame);
+
+/* Prototipi della valutazione fork-join */
+int fork_applies(const CircuitContext *ctx);
+double evaluate_forkjoin(CircuitContext *ctx);
+void fork_free(struct ForkJoin *fj);
+
+void context_destroy(CircuitContext *ctx) {
+    if(ctx->stats) {
+        ctx->stats->allocations += ctx->arena.chunks + ctx->topo.allocs + ctx->allocs;
+        ctx->stats->cache_hits += ctx->cache_hits + ctx->record_hits;
+        ctx->stats->cache_misses += ctx->cache_misses + ctx->record_misses;
+        stats_release(ctx->stats);
+    }
+    free(ctx->nest);
+    free(ctx->narrow);
+    free(ctx->hash);
+    free(ctx->jump);
+    free(ctx->cached);
+    free(ctx->pairs);
+    fork_free(ctx->fork);
+    arena_free(&ctx->arena);
+    topo_free(&ctx->topo);
+    free(ctx->grid);
+    free(ctx);
+}
+
+/* --- FUNZIONI DI UTILITÀ PER IL DISPOSITIVO A GRIGLIA --- */
+// Aggiunge un blocco alla lista collegata
+void add_block(CircuitContext *ctx, BlockType type, int col, int depth, int is_unknown, int elem, double value) {
+    Block *b = arena_alloc(&ctx->arena, sizeof(Block));
+    b->type = type;
+    b->col = col;
+    b->depth = depth;
+    b->is_unknown = is_unknown;
+    b->elem = elem;
+    b->value = value;
+    b->next = NULL;
+    STATS_COUNT(ctx->stats, blocks, 1);
+    if (!ctx->head)
+        ctx->head = ctx->tail = b;
+    else {
+        ctx->tail->next = b;
+        ctx->tail = b;
+    }
+}
+
+// Rilascia tutti i blocchi (in O(1)) per poter analizzare un nuovo circuito
+void reset_circuit(CircuitContext *ctx) {
+    arena_reset(&ctx->arena);
+    ctx->head = ctx->tail = NULL;
+    ctx->nest_n = 0;
+}
+
+// Numero di colonne di blocchi occupate dal disegno
+int grid_columns(CircuitContext *ctx) {
+    int max_col = 0;
+    for(Block *b = ctx->head; b; b = b->next)
+        if(b->col > max_col)
+            max_col = b->col;
+    return max_col + 1;
+}
+
+// Dimensiona la griglia sul circuito e la riempie di spazi: la larghezza segue il numero
+// di blocchi, l'altezza la profondità dei rami paralleli (una riga in più per livello).
+// Restituisce 0 se il disegno supererebbe DRAW_MAX_CELLS caratteri.
+int init_grid(CircuitContext *ctx, int max_col) {
+    int min_depth = 0, max_depth = 0;
+    for(Block *b = ctx->head; b; b = b->next) {
+        if(b->depth < min_depth)
+            min_depth = b->depth;
+        if(b->depth > max_depth)
+            max_depth = b->depth;
+    }
+    ctx->main_row = -min_depth > MAIN_ROW ? -min_depth : MAIN_ROW;
+    int below = max_depth + 2 > ROWS - MAIN_ROW ? max_depth + 2 : ROWS - MAIN_ROW;
+    ctx->grid_rows = ctx->main_row + below;
+    ctx->grid_width = max_col * BLOCK_WIDTH;
+    if((double)ctx->grid_rows * (ctx->grid_width + 1) > DRAW_MAX_CELLS)
+        return 0;
+    // Spazio anche per la riga del generatore
+    size_t need = (size_t)(ctx->grid_rows + 1) * (ctx->grid_width + 1) + wcslen(GEN_BLOCK) + 2;
+    if(need > ctx->grid_cap) {
+        ctx->grid = xrealloc(ctx->grid, need * sizeof(wchar_t));
+        ctx->grid_cap = need;
+        ctx->allocs++;
+    }
+    for(int r = 0; r < ctx->grid_rows; r++) {
+        wmemset(&GRID(ctx, r, 0), L' ', ctx->grid_width);
+        GRID(ctx, r, ctx->grid_width) = L'\n';
+    }
+    ctx->grid_len = (size_t)ctx->grid_rows * (ctx->grid_width + 1);
+    STATS_COUNT(ctx->stats, grid_cells, (long)ctx->grid_len);
+    return 1;
+}
+
+// Inserisce un blocco grafico nella griglia alla data riga e colonna
+void draw_block(CircuitContext *ctx, const wchar_t *block, int row, int col) {
+    int offset = col * BLOCK_WIDTH;
+    if (row < 0 || row >= ctx->grid_rows)
+        return;
+    int i;
+    for (i = 0; block[i] != L'\0' && offset + i < ctx->grid_width; i++)
+        GRID(ctx, row, offset + i) = block[i];
+    STATS_COUNT(ctx->stats, grid_cells, i);
+}
+
+// Converte l'intero disegno nella codifica del terminale. Restituisce i byte prodotti
+// in *out, o (size_t)-1 se un carattere non è rappresentabile.
+size_t grid_encode(CircuitContext *ctx, char **out, size_t *cap) {
+    size_t need = ctx->grid_len * MB_CUR_MAX + 1;
+    if(need > *cap) {
+        *out = xrealloc(*out, need);
+        *cap = need;
+    }
+    const wchar_t *src = ctx->grid;
+    mbstate_t st;
+    memset(&st, 0, sizeof(st));
+    return wcsnrtombs(*out, &src, ctx->grid_len, *cap, &st);
+}
+
+// Scrive il disegno con una sola write
+void print_grid(CircuitContext *ctx) {
+    char *out = NULL;
+    size_t cap = 0;
+    size_t n = grid_encode(ctx, &out, &cap);
+    if(n == (size_t)-1) {
+        free(out);
+        wprintf(L"Errore: impossibile convertire il disegno nella codifica del terminale.\n");
+        return;
+    }
+    fflush(stdout);
+    for(size_t off = 0; off < n; ) {
+        ssize_t w = write(STDOUT_FILENO, out + off, n - off);
+        if(w <= 0)
+            break;
+        off += w;
+    }
+    free(out);
+}
+
+// Disegna la chiusura del circuito: due conduttori verticali e una linea orizzontale in fondo
+void close_circuit(CircuitContext *ctx) {
+    int start_x = BLOCK_WIDTH / 2;
+    int end_x   = ctx->grid_width - BLOCK_WIDTH + BLOCK_WIDTH / 2;
+    int last = ctx->grid_rows - 1;
+    for (int r = ctx->main_row; r < ctx->grid_rows; r++)
+        GRID(ctx, r, start_x) = L'|';
+    for (int r = ctx->main_row; r < ctx->grid_rows; r++)
+        GRID(ctx, r, end_x) = L'|';
+    for (int x = start_x; x <= end_x; x++)
+        GRID(ctx, last, x) = L'-';
+    STATS_COUNT(ctx->stats, grid_cells, 2L * (ctx->grid_rows - ctx->main_row) + end_x - start_x + 1);
+}
+
+/* --- FUNZIONE DI PARSING --- */
+// I gruppi possono essere annidati a qualsiasi profondità. Lo stack "nest" ricorda cosa
+// è aperto: un '*' chiude il gruppo più interno solo se questo ha già almeno un ramo
+// "||...=" completo, altrimenti apre un nuovo gruppo (dentro un ramo o nel primo ramo).
+// Ogni livello di rami "||" sposta il disegno di una riga più in alto (depth negativo).
+enum {
+    NEST_GROUP,            // gruppo aperto senza rami "||...=" completi
+    NEST_GROUP_CLOSABLE,   // gruppo con almeno un ramo completo: il prossimo '*' lo chiude
+    NEST_BRANCH            // ramo "||" in attesa di '='
+};
+
+static void nest_push(CircuitContext *ctx, unsigned char what) {
+    if(ctx->nest_n == ctx->nest_cap) {
+        ctx->nest_cap = ctx->nest_cap ? ctx->nest_cap * 2 : 16;
+        ctx->nest = xrealloc(ctx->nest, ctx->nest_cap);
+        ctx->allocs++;
+    }
+    ctx->nest[ctx->nest_n++] = what;
+}
+
+// Tutti i token sono ASCII, quindi il parser lavora direttamente sui byte del testo
+// (UTF-8 o ASCII) senza conversioni né funzioni dipendenti dalla locale; i byte non
+// ASCII, come ogni altro carattere sconosciuto, non generano blocchi.
+//
+// Numeri: una cifra seguita da cifre, '.' o ','; il primo separatore è la virgola
+// decimale, gli altri sono ignorati. Solo i primi NUMBER_MAX_CHARS caratteri (cifre e
+// separatore) contano, il resto del numero viene saltato. La conversione è arrotondata
+// correttamente: con al più 15 cifre (mantissa < 2^53) mantissa e potenza di 10 sono
+// esatte e basta una divisione; oltre si passa a strtod sulla forma esponenziale, che
+// non dipende dal separatore decimale della locale.
+#define NUMBER_MAX_CHARS 19
+
+static const double POW10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                                1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18 };
+
+static double decimal_value(uint64_t mantissa, int frac) {
+    if(mantissa < ((uint64_t)1 << 53) || frac == 0)
+        return frac ? (double)mantissa / POW10[frac] : (double)mantissa;
+    char buf[40];
+    snprintf(buf, sizeof(buf), "%llue-%d", (unsigned long long)mantissa, frac);
+    return strtod(buf, NULL);
+}
+
+static inline int is_digit(unsigned char c) {
+    return (unsigned)(c - '0') < 10;
+}
+
+// Legge il numero che inizia in s[i] (una cifra); restituisce l'indice successivo
+static size_t scan_number(const char *s, size_t i, size_t len, double *val) {
+    uint64_t mantissa = 0;
+    int k = 0, frac = 0, has_decimal = 0;
+    for(; i < len; i++) {
+        unsigned char c = s[i];
+        if(is_digit(c)) {
+            if(k < NUMBER_MAX_CHARS) {
+                mantissa = mantissa * 10 + (c - '0');
+                frac += has_decimal;
+                k++;
+            }
+        } else if(c == '.' || c == ',') {
+            if(k < NUMBER_MAX_CHARS && !has_decimal) {
+                has_decimal = 1;
+                k++;
+            }
+        } else {
+            break;
+        }
+    }
+    *val = decimal_value(mantissa, frac);
+    return i;
+}
+
+// Condensatori e induttori: 'C' o 'L' seguito dal valore in F o H e da un prefisso SI
+// facoltativo (p, n, u, m), es. "C100n" o "L4,7m". Legge da s[i] (una cifra).
+static size_t scan_reactive(const char *s, size_t i, size_t len, double *val) {
+    i = scan_number(s, i, len, val);
+    if(i < len) {
+        // si divide per la potenza di 10, esatta, invece di moltiplicare per 1e-9 e simili
+        static const char prefixes[] = "pnum";
+        static const double scale[] = { 1e12, 1e9, 1e6, 1e3 };
+        const char *p = memchr(prefixes, s[i], 4);
+        if(p) {
+            *val /= scale[p - prefixes];
+            i++;
+        }
+    }
+    return i;
+}
+
+// Blocco prodotto dal parser: in coda alla lista o, con topology_only, passato subito
+// alla costruzione della topologia. In quel caso il collegamento al generatore che la
+// lista riceverebbe in testa a fine parsing va aggiunto prima del primo blocco.
+static inline void emit_block(CircuitContext *ctx, long *emitted, BlockType type, int col, int depth,
+                              int is_unknown, int elem, double value) {
+    if(!ctx->topology_only) {
+        add_block(ctx, type, col, depth, is_unknown, elem, value);
+        return;
+    }
+    if((*emitted)++ == 0 && type != BLOCK_UP_RES_PIPE) {
+        topo_feed(&ctx->topo, BLOCK_UP_RES_PIPE, 0, ELEM_R, 0);
+        STATS_COUNT(ctx->stats, blocks, 1);
+    }
+    STATS_COUNT(ctx->stats, blocks, 1);
+    // gli elementi solo grafici non cambiano la topologia
+    if(type == BLOCK_CONN || type == BLOCK_BEND || type == BLOCK_NODE_BEND)
+        return;
+    topo_feed(&ctx->topo, type, is_unknown, elem, value);
+}
+
+// Stato del parser fra un pezzo di testo e il successivo. Un pezzo non deve spezzare
+// un token: la modalità streaming taglia il testo solo dopo '+', '_', '-', '*' o '='.
+// Colonna e profondità crescono con i token letti: in streaming un circuito di molti GB
+// supera 2^31, quindi sono long (servono solo al disegno, che lì non c'è).
+typedef struct {
+    long depth;
+    long col;
+    int first;
+    long emitted;
+} ParseCursor;
+
+static void parse_begin(CircuitContext *ctx, ParseCursor *pc) {
+    *pc = (ParseCursor){ 0, 0, 1, 0 };
+    ctx->nest_n = 0;
+    if(ctx->topology_only)
+        topo_begin(&ctx->topo);
+}
+
+static inline void parse_chunk(CircuitContext *ctx, ParseCursor *pc, const char *circuit, size_t len) {
+    long depth = pc->depth;
+    long col = pc->col;
+    int first = pc->first;
+    long emitted = pc->emitted;
+
+    for (size_t i = 0; i < len; i++) {
+        unsigned char token = circuit[i];
+        if(token == '+')
+            continue;  // il "+" indica il generatore, non genera blocchi
+
+        if(is_digit(token) || token == 'x' ||
+           ((token == 'C' || token == 'L') && i + 1 < len && is_digit(circuit[i + 1]))) {
+            int is_unknown = 0, elem = ELEM_R;
+            double val = 0;
+            if(token == 'x') {
+                is_unknown = 1;
+                val = -1;
+            } else if(is_digit(token)) {
+                i = scan_number(circuit, i, len, &val) - 1;
+            } else {
+                elem = token == 'C' ? ELEM_C : ELEM_L;
+                i = scan_reactive(circuit, i + 1, len, &val) - 1;
+            }
+            if(first) {
+                emit_block(ctx, &emitted, BLOCK_UP_RES_PIPE, col++, depth, is_unknown, elem, val);
+                first = 0;
+            } else {
+                emit_block(ctx, &emitted, BLOCK_RES, col++, depth, is_unknown, elem, val);
+            }
+            continue;
+        }
+        switch(token) {
+            case '_':
+                emit_block(ctx, &emitted, BLOCK_CONN, col++, depth, 0, ELEM_R, 0);
+                break;
+            case '-':
+                // Il "-" chiude il circuito
+                emit_block(ctx, &emitted, BLOCK_NODE_BEND, col++, depth, 0, ELEM_R, 0);
+                break;
+            case '*':
+                // Chiude il gruppo più interno se ha già un ramo completo, altrimenti ne apre uno
+                if(ctx->nest_n > 0 && ctx->nest[ctx->nest_n - 1] == NEST_GROUP_CLOSABLE) {
+                    emit_block(ctx, &emitted, BLOCK_NODE_END, col++, depth, 0, ELEM_R, 0);
+                    ctx->nest_n--;
+                } else {
+                    emit_block(ctx, &emitted, BLOCK_NODE_START, col++, depth, 0, ELEM_R, 0);
+                    nest_push(ctx, NEST_GROUP);
+                    first = 1; // resetta per il gruppo parallelo
+                }
+                break;
+            case '|':
+                if(i+1 < len && circuit[i+1] == '|') {
+                    depth--;
+                    i++;
+                    emit_block(ctx, &emitted, BLOCK_PAR_START, col++, depth, 0, ELEM_R, 0);
+                    nest_push(ctx, NEST_BRANCH);
+                    first = 1; // resetta per il ramo parallelo
+                } else {
+                    emit_block(ctx, &emitted, BLOCK_BEND, col++, depth, 0, ELEM_R, 0);
+                }
+                break;
+            case '=':
+                emit_block(ctx, &emitted, BLOCK_PAR_END, col++, depth, 0, ELEM_R, 0);
+                if(ctx->nest_n > 0 && ctx->nest[ctx->nest_n - 1] == NEST_BRANCH) {
+                    ctx->nest_n--;
+                    depth++;
+                    if(ctx->nest_n > 0)
+                        ctx->nest[ctx->nest_n - 1] = NEST_GROUP_CLOSABLE;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    *pc = (ParseCursor){ depth, col, first, emitted };
+}
+
+void parse_circuit_utf8(CircuitContext *ctx, const char *circuit, size_t len) {
+    struct timespec t0;
+    stats_start(ctx->stats, &t0);
+    ParseCursor pc;
+    parse_begin(ctx, &pc);
+    parse_chunk(ctx, &pc, circuit, len);
+    if(ctx->topology_only) {
+        topo_end(&ctx->topo);
+        stats_stop(ctx->stats, PHASE_PARSE, &t0);
+        return;
+    }
+    // Se il primo blocco non è il collegamento al generatore, lo inseriamo in testa
+    if(ctx->head && ctx->head->type != BLOCK_UP_RES_PIPE) {
+        Block *pipe = arena_alloc(&ctx->arena, sizeof(Block));
+        pipe->type = BLOCK_UP_RES_PIPE;
+        pipe->col = 0;
+        pipe->depth = 0;
+        pipe->is_unknown = 0;
+        pipe->elem = ELEM_R;
+        pipe->value = 0;
+        pipe->next = ctx->head;
+        ctx->head = pipe;
+        STATS_COUNT(ctx->stats, blocks, 1);
+    }
+    build_topology(ctx);
+    stats_stop(ctx->stats, PHASE_PARSE, &t0);
+}
+
+// Testo a caratteri estesi (modalità interattiva): ristretto a byte, i caratteri non
+// ASCII diventano '?' e sono ignorati come prima
+void parse_circuit(CircuitContext *ctx, const wchar_t *circuit) {
+    size_t len = wcslen(circuit);
+    if(len + 1 > ctx->narrow_cap) {
+        ctx->narrow_cap = (len + 1) * 2;
+        ctx->narrow = xrealloc(ctx->narrow, ctx->narrow_cap);
+        ctx->allocs++;
+    }
+    for(size_t i = 0; i < len; i++)
+        ctx->narrow[i] = ((unsigned)circuit[i] < 0x80) ? (char)circuit[i] : '?';
+    parse_circuit_utf8(ctx, ctx->narrow, len);
+}
+
+// Un circuito deve iniziare con '+' e terminare con '-'
+static int circuit_framed(const char *s, size_t len) {
+    return len >= 2 && s[0] == '+' && s[len - 1] == '-';
+}
+
+/* --- FUNZIONI DI RENDERING --- */
+// Se un blocco di tipo resistenza ha is_unknown true, usa RX_BLOCK
+void render_blocks(CircuitContext *ctx) {
+    Block *curr = ctx->head;
+    while(curr) {
+        int row = ctx->main_row + curr->depth;
+        switch(curr->type) {
+            case BLOCK_RES:
+            case BLOCK_UP_RES_PIPE:
+                if(curr->is_unknown)
+                    draw_block(ctx, RX_BLOCK, row, curr->col);
+                else
+                    draw_block(ctx, RES_BLOCK, row, curr->col);
+                break;
+            case BLOCK_CONN:
+                draw_block(ctx, CONN_BLOCK, row, curr->col);
+                break;
+            case BLOCK_BEND:
+                draw_block(ctx, BEND_BLOCK, row, curr->col);
+                break;
+            case BLOCK_NODE_START:
+                draw_block(ctx, NODE_START, row, curr->col);
+                break;
+            case BLOCK_NODE_END:
+                draw_block(ctx, NODE_END, row, curr->col);
+                break;
+            case BLOCK_NODE_BEND:
+                draw_block(ctx, NODE_BEND, row, curr->col);
+                break;
+            case BLOCK_PAR_START:
+                draw_block(ctx, PAR_START, row, curr->col);
+                break;
+            case BLOCK_PAR_END:
+                draw_block(ctx, PAR_END, row, curr->col);
+                break;
+            case BLOCK_UP_PIPE:
+                draw_block(ctx, UP_PIPE, ctx->main_row - 1, curr->col);
+                break;
+        }
+        curr = curr->next;
+    }
+}
+
+// Accoda al disegno il generatore centrato sotto il circuito
+void draw_generator(CircuitContext *ctx) {
+    int gen_len = wcslen(GEN_BLOCK);
+    int pad = (ctx->grid_width - gen_len) / 2;
+    wchar_t *p = ctx->grid + ctx->grid_len;
+    if(pad > 0) {
+        wmemset(p, L' ', pad);
+        p += pad;
+    }
+    wmemcpy(p, GEN_BLOCK, gen_len);
+    p += gen_len;
+    *p++ = L'\n';
+    STATS_COUNT(ctx->stats, grid_cells, p - (ctx->grid + ctx->grid_len));
+    ctx->grid_len = p - ctx->grid;
+}
+
+/* --- COSTRUZIONE DELLA TOPOLOGIA --- */
+static void topo_reserve(Topology *t, int need) {
+    if(need <= t->cap)
+        return;
+    int cap = t->cap ? t->cap : 64;
+    while(cap < need)
+        cap *= 2;
+    int words = (cap + 63) / 64;
+    t->kind = realloc(t->kind, cap * sizeof(*t->kind));
+    t->value = realloc(t->value, cap * sizeof(*t->value));
+    t->elem = realloc(t->elem, cap * sizeof(*t->elem));
+    t->nchild = realloc(t->nchild, cap * sizeof(*t->nchild));
+    t->start = realloc(t->start, cap * sizeof(*t->start));
+    t->unknown = realloc(t->unknown, words * sizeof(*t->unknown));
+    t->stack = realloc(t->stack, cap * sizeof(*t->stack));
+    t->allocs++;
+    if(!t->kind || !t->value || !t->elem || !t->nchild || !t->start || !t->unknown || !t->stack) {
+        fprintf(stderr, "Errore di allocazione!\n");
+        exit(1);
+    }
+    t->cap = cap;
+}
+
+// Memoria degli array della topologia: la capacità non cala mai, quindi è il picco
+static size_t topo_bytes(const Topology *t) {
+    size_t per_node = sizeof(*t->kind) + sizeof(*t->value) + sizeof(*t->elem) + sizeof(*t->nchild) +
+                      sizeof(*t->start) + sizeof(*t->stack);
+    return (size_t)t->cap * per_node + (size_t)((t->cap + 63) / 64) * sizeof(*t->unknown);
+}
+
+// Aggiunge un nodo; per i gruppi i figli sono già stati emessi a partire da "first"
+static void topo_push(Topology *t, TopoKind kind, double value, int is_unknown, int elem, int nchild, int first) {
+    topo_reserve(t, t->n + 1);
+    int i = t->n++;
+    if((i & 63) == 0)
+        t->unknown[i >> 6] = 0;
+    t->kind[i] = kind;
+    t->value[i] = value;
+    t->elem[i] = elem;
+    if(elem != ELEM_R)
+        t->n_reactive++;
+    t->nchild[i] = nchild;
+    t->start[i] = first;
+    if(is_unknown) {
+        t->unknown[i >> 6] |= (uint64_t)1 << (i & 63);
+        t->n_unknown++;
+    }
+}
+
+void topo_free(Topology *t) {
+    free(t->kind);
+    free(t->value);
+    free(t->elem);
+    free(t->nchild);
+    free(t->start);
+    free(t->unknown);
+    free(t->stack);
+    free(t->frames);
+    memset(t, 0, sizeof(*t));
+}
+
+// Apre un gruppo della topologia: i suoi figli saranno emessi a partire da t->n
+static void frame_push(Topology *t, int *sp, TopoKind kind) {
+    if(*sp == t->frames_cap) {
+        t->frames_cap = t->frames_cap ? t->frames_cap * 2 : 16;
+        t->frames = xrealloc(t->frames, t->frames_cap * sizeof(TopoFrame));
+        t->allocs++;
+    }
+    TopoFrame *f = &t->frames[(*sp)++];
+    f->kind = kind;
+    f->first = t->n;
+    f->count = 0;
+    if(t->fold)
+        fold_open(t, *sp - 1, kind);
+}
+
+// Chiude il gruppo in cima allo stack e lo conta come figlio del gruppo sottostante
+static void frame_pop(Topology *t, int *sp) {
+    TopoFrame *f = &t->frames[--(*sp)];
+    if(t->fold) {
+        // in streaming nessuno legge i conteggi, che su file enormi supererebbero 2^31
+        fold_close(t, *sp);
+        return;
+    }
+    topo_push(t, (TopoKind)f->kind, 0, 0, ELEM_R, f->count, f->first);
+    if(f->kind == TOPO_PAR)
+        t->n_groups++;
+    if(*sp > 0)
+        t->frames[*sp - 1].count++;
+}
+
+// Tipo del gruppo aperto d livelli sotto la cima dello stack (-1 se non esiste)
+#define FRAME_KIND(t, sp, d) ((sp) > (d) ? (t)->frames[(sp) - 1 - (d)].kind : -1)
+
+// Appiattisce la sequenza dei blocchi con uno stack esplicito di gruppi aperti, senza
+// ricorsione: la profondità di annidamento è limitata solo dalla memoria.
+// Le incognite diventano foglie con valore 0: il calcolo le ignora come prima.
+// La radice è l'ultimo nodo (serie principale). I blocchi arrivano uno alla volta da
+// topo_feed: dalla lista già costruita (build_topology) o direttamente dal parser
+// quando il circuito non va disegnato. Con t->fold (--stream) i nodi non vengono
+// memorizzati: ogni gruppo aperto accumula i valori dei figli e alla chiusura passa il
+// proprio al gruppo sottostante (fold_open, fold_leaf, fold_close).
+void topo_begin(Topology *t) {
+    t->n = 0;
+    t->n_unknown = 0;
+    t->n_reactive = 0;
+    t->n_groups = 0;
+    t->malformed = 0;
+    t->frames_n = 0;
+    frame_push(t, &t->frames_n, TOPO_SERIES);
+}
+
+void topo_feed(Topology *t, BlockType type, int is_unknown, int elem, double value) {
+    int sp = t->frames_n;
+    int top = FRAME_KIND(t, sp, 0);
+    // un ramo è una serie il cui padre è un gruppo parallelo
+    int in_branch = (top == TOPO_SERIES && FRAME_KIND(t, sp, 1) == TOPO_PAR);
+    switch(type) {
+        case BLOCK_RES:
+        case BLOCK_UP_RES_PIPE:
+            if(top == TOPO_PAR) // elemento fra '=' e '*': apre un ramo implicito
+                frame_push(t, &sp, TOPO_SERIES);
+            if(t->fold) {
+                fold_leaf(t, sp - 1, is_unknown ? 0.0 : value, is_unknown, elem);
+            } else {
+                topo_push(t, TOPO_RES, is_unknown ? 0.0 : value, is_unknown, elem, 0, t->n);
+                t->frames[sp - 1].count++;
+            }
+            break;
+        case BLOCK_NODE_START:
+            if(top == TOPO_PAR)
+                frame_push(t, &sp, TOPO_SERIES);
+            frame_push(t, &sp, TOPO_PAR);
+            frame_push(t, &sp, TOPO_SERIES); // primo ramo
+            break;
+        case BLOCK_PAR_START:
+            if(in_branch)
+                frame_pop(t, &sp);
+            if(FRAME_KIND(t, sp, 0) == TOPO_PAR)
+                frame_push(t, &sp, TOPO_SERIES);
+            else
+                t->malformed = 1;
+            break;
+        case BLOCK_PAR_END:
+            if(in_branch)
+                frame_pop(t, &sp);
+            else
+                t->malformed = 1;
+            break;
+        case BLOCK_NODE_END:
+            if(in_branch)
+                frame_pop(t, &sp);
+            if(FRAME_KIND(t, sp, 0) == TOPO_PAR)
+                frame_pop(t, &sp);
+            else
+                t->malformed = 1;
+            break;
+        default:
+            break; // elementi solo grafici
+    }
+    t->frames_n = sp;
+}
+
+void topo_end(Topology *t) {
+    // Gruppi rimasti aperti a fine circuito: vengono chiusi
+    if(t->frames_n > 1)
+        t->malformed = 1;
+    while(t->frames_n > 0)
+        frame_pop(t, &t->frames_n);
+
+    int depth = 0;
+    t->max_stack = 0;
+    for(int i = 0; i < t->n; i++) {
+        depth += 1 - t->nchild[i];
+        if(depth > t->max_stack)
+            t->max_stack = depth;
+    }
+}
+
+void build_topology(CircuitContext *ctx) {
+    Topology *t = &ctx->topo;
+    topo_begin(t);
+    for(Block *b = ctx->head; b; b = b->next)
+        topo_feed(t, b->type, b->is_unknown, b->elem, b->value);
+    topo_end(t);
+}
+
+/* --- FUNZIONI DI CALCOLO DELLA RESISTENZA EQUVALENTE --- */
+// Ordine canonico delle riduzioni sui figli di un gruppo: somme sequenziali a blocchi di
+// REDUCE_BLOCK figli, poi somma a coppie dei blocchi sull'albero binario bilanciato
+// ((b0+b1)+(b2+b3))+... I segment tree della valutazione incrementale hanno la stessa
+// forma, quindi danno gli stessi bit di una valutazione completa.
+#define REDUCE_BLOCK 8
+
+static inline double block_sum(const double *a, int k) {
+    double s = a[0];
+    for(int j = 1; j < k; j++)
+        s += a[j];
+    return s;
+}
+
+static inline double pairwise_sum(double *a, int k) {
+    if(k <= REDUCE_BLOCK)
+        return k ? block_sum(a, k) : 0.0;
+    int nb = 0;
+    for(int j = 0; j < k; j += REDUCE_BLOCK, nb++)
+        a[nb] = block_sum(a + j, (k - j < REDUCE_BLOCK) ? k - j : REDUCE_BLOCK);
+    for(int w = 1; w < nb; w *= 2)
+        for(int j = 0; j + w < nb; j += 2 * w)
+            a[j] += a[j + w];
+    return a[0];
+}
+
+// Conduttanza di un ramo: i rami con valore non positivo (solo incognite) sono ignorati
+static inline double recip_pos(double x) {
+    return (x > 0) ? (1.0 / x) : 0.0;
+}
+
+// Valuta i nodi [from, to) sopra gli sp valori già sullo stack e restituisce il nuovo sp.
+// Un intervallo fatto di sottoalberi completi lascia sullo stack i loro valori, in ordine.
+static inline int evaluate_span(const Topology *t, int from, int to, double *stack, int sp) {
+    for(int i = from; i < to; i++) {
+        int k = t->nchild[i];
+        switch(t->kind[i]) {
+            case TOPO_RES:
+                stack[sp++] = t->value[i];
+                break;
+            case TOPO_SERIES: {
+                double total = pairwise_sum(stack + sp - k, k);
+                sp -= k;
+                stack[sp++] = total;
+                break;
+            }
+            case TOPO_PAR: {
+                for(int j = sp - k; j < sp; j++)
+                    stack[j] = recip_pos(stack[j]);
+                double invSum = pairwise_sum(stack + sp - k, k);
+                sp -= k;
+                stack[sp++] = recip_pos(invSum);
+                break;
+            }
+        }
+    }
+    return sp;
+}
+
+// Un'unica passata sugli array in ordine postfisso con uno stack di valori
+double evaluate_topology(const Topology *t, double *stack) {
+    int sp = evaluate_span(t, 0, t->n, stack, 0);
+    return sp ? stack[0] : 0.0;
+}
+
+/* --- BYTECODE DI VALUTAZIONE --- */
+// Per valutare molte volte lo stesso circuito con valori diversi la topologia viene
+// compilata in un programma per una macchina a stack. Le istruzioni sono parole a 32
+// bit con il codice nei 3 bit bassi e l'operando negli altri:
+//   LOAD s        impila il valore dell'elemento s
+//   SUM n         sostituisce gli n valori in cima con la loro somma (serie)
+//   PAR n         sostituisce gli n valori in cima con il loro parallelo
+//   SUMV s, n     impila la serie degli elementi s..s+n-1 (due parole)
+//   PARV s, n     impila il parallelo degli elementi s..s+n-1 (due parole)
+// Gli elementi sono numerati in ordine di testo, come in --tune; i valori stanno in un
+// array separato, quindi il programma resta valido quando cambiano. Le serie con un solo
+// figlio (i rami di una sola resistenza) non producono istruzioni e le foglie figlie
+// dirette di un gruppo sono lette dall'array dei valori senza passare dallo stack.
+// Le riduzioni sono le stesse di evaluate_topology, quindi il risultato coincide bit per
+// bit.
+enum {
+    OP_LOAD,
+    OP_SUM,
+    OP_PAR,
+    OP_SUMV,
+    OP_PARV
+};
+#define OP_BITS 3
+#define OP_MASK ((1u << OP_BITS) - 1)
+
+typedef struct {
+    uint32_t *code;
+    int n_code, code_cap;
+    double *value;          // valore di ogni elemento (0 per le incognite)
+    int n_values;
+    int max_stack;          // double di stack richiesti da program_eval
+} Program;
+
+static void program_put(Program *p, uint32_t word) {
+    if(p->n_code == p->code_cap) {
+        p->code_cap = p->code_cap ? p->code_cap * 2 : 64;
+        p->code = xrealloc(p->code, p->code_cap * sizeof(uint32_t));
+    }
+    p->code[p->n_code++] = word;
+}
+
+static void program_emit(Program *p, uint32_t op, uint32_t arg) {
+    program_put(p, op | arg << OP_BITS);
+}
+
+// Compila la topologia. Durante la compilazione ogni posizione dello stack è una foglia
+// non ancora caricata (numero dell'elemento) o un valore già calcolato (-1): le foglie
+// sono caricate solo quando servono sullo stack, in ordine.
+void program_compile(Program *p, const Topology *t) {
+    int *slot = malloc((t->max_stack + 1) * sizeof(int));
+    p->value = xrealloc(p->value, (t->n + 1) * sizeof(double));
+    if(!slot) {
+        fprintf(stderr, "Errore di allocazione!\n");
+        exit(1);
+    }
+    p->n_code = 0;
+    p->n_values = 0;
+    p->max_stack = 1;
+    int csp = 0, loaded = 0;    // posizioni sotto "loaded" sono già sullo stack reale
+
+    for(int i = 0; i < t->n; i++) {
+        int k = t->nchild[i];
+        if(t->kind[i] == TOPO_RES) {
+            p->value[p->n_values] = t->value[i];
+            slot[csp++] = p->n_values++;
+            continue;
+        }
+        if(t->kind[i] == TOPO_SERIES && k == 1)
+            continue; // la serie di un solo figlio è il figlio stesso
+        int base = csp - k;
+        int run = k > 0;
+        for(int j = base; j < csp && run; j++)
+            run = slot[j] >= 0 && slot[j] == slot[base] + (j - base);
+        int flush_to = run ? base : csp;
+        for(; loaded < flush_to; loaded++)
+            if(slot[loaded] >= 0)
+                program_emit(p, OP_LOAD, slot[loaded]);
+        if(run) {
+            program_emit(p, t->kind[i] == TOPO_PAR ? OP_PARV : OP_SUMV, slot[base]);
+            program_put(p, k);
+        } else {
+            program_emit(p, t->kind[i] == TOPO_PAR ? OP_PAR : OP_SUM, k);
+        }
+        // le riduzioni lavorano in place sopra la cima: servono fino a base + k posizioni
+        if(base + k + 1 > p->max_stack)
+            p->max_stack = base + k + 1;
+        slot[base] = -1;
+        csp = base + 1;
+        loaded = csp;
+    }
+    for(; loaded < csp; loaded++)
+        if(slot[loaded] >= 0)
+            program_emit(p, OP_LOAD, slot[loaded]);
+    if(csp + 1 > p->max_stack)
+        p->max_stack = csp + 1;
+    free(slot);
+}
+
+void program_free(Program *p) {
+    free(p->code);
+    free(p->value);
+    memset(p, 0, sizeof(*p));
+}
+
+// pairwise_sum di src (o dei reciproci, con recip = 1) senza copiarlo: le somme dei
+// blocchi vanno in tmp, poi l'albero a coppie. I blocchi sono indipendenti, quindi il
+// processore li sovrappone; il risultato è quello di pairwise_sum sulla copia.
+static inline double pairwise_sum_of(const double *src, int k, int recip, double *tmp) {
+    int nb = 0;
+    for(int j = 0; j < k; j += REDUCE_BLOCK, nb++) {
+        int end = (k - j < REDUCE_BLOCK) ? k : j + REDUCE_BLOCK;
+        double s = recip ? recip_pos(src[j]) : src[j];
+        for(int i = j + 1; i < end; i++)
+            s += recip ? recip_pos(src[i]) : src[i];
+        tmp[nb] = s;
+    }
+    for(int w = 1; w < nb; w *= 2)
+        for(int j = 0; j + w < nb; j += 2 * w)
+            tmp[j] += tmp[j + w];
+    return nb ? tmp[0] : 0.0;
+}
+
+// Ciclo dell'interprete; stack deve contenere max_stack double
+double program_eval(const Program *p, const double *value, double *stack) {
+    const uint32_t *pc = p->code, *end = p->code + p->n_code;
+    double *sp = stack;
+    while(pc < end) {
+        uint32_t w = *pc++;
+        uint32_t a = w >> OP_BITS;
+        switch(w & OP_MASK) {
+            case OP_LOAD:
+                *sp++ = value[a];
+                break;
+            case OP_SUM:
+                sp -= a;
+                *sp = pairwise_sum(sp, a);
+                sp++;
+                break;
+            case OP_PAR:
+                sp -= a;
+                for(uint32_t j = 0; j < a; j++)
+                    sp[j] = recip_pos(sp[j]);
+                *sp = recip_pos(pairwise_sum(sp, a));
+                sp++;
+                break;
+            case OP_SUMV: {
+                uint32_t n = *pc++;
+                *sp = n <= REDUCE_BLOCK ? block_sum(value + a, n) : pairwise_sum_of(value + a, n, 0, sp);
+                sp++;
+                break;
+            }
+            case OP_PARV: {
+                uint32_t n = *pc++;
+                double G;
+                if(n <= REDUCE_BLOCK) {
+                    G = recip_pos(value[a]);
+                    for(uint32_t j = 1; j < n; j++)
+                        G += recip_pos(value[a + j]);
+                } else {
+                    G = pairwise_sum_of(value + a, n, 1, sp);
+                }
+                *sp++ = recip_pos(G);
+                break;
+            }
+        }
+    }
+    return sp > stack ? stack[0] : 0.0;
+}
+
+/* --- CACHE DEI SOTTOCIRCUITI --- */
+// Con --cache ogni nodo della topologia riceve un hash canonico di 128 bit (due corsie
+// da 64): le foglie dipendono dal valore, le serie dalla sequenza ordinata dei figli, i
+// paralleli dal multinsieme dei rami (somma degli hash mescolati, quindi l'ordine dei
+// rami non conta). Una tabella limitata, associativa a CACHE_WAYS vie e condivisa fra i
+// worker, associa l'hash alla resistenza equivalente del sottocircuito.
+// La valutazione scende dalla radice e si ferma sul primo sottoalbero trovato in cache;
+// il resto è la solita passata postfissa, che inserisce in cache i gruppi calcolati.
+// Perché il valore dipenda solo dalla chiave, con la cache i rami di ogni parallelo sono
+// sommati nell'ordine canonico degli hash: il risultato può differire da quello senza
+// cache nell'ultima cifra, ma non dipende dall'ordine dei circuiti né dal numero di thread.
+#define CACHE_WAYS 4
+#define CACHE_STRIPES 64        // mutex per gruppi di set
+#define CACHE_MIN_NODES 4       // sottoalberi più piccoli costano meno da ricalcolare
+
+typedef struct {
+    uint64_t h1, h2;            // chiave (h1 == 0: vuoto)
+    int unknowns;               // solo circuiti interi
+    double v[5];                // Req, oppure Req_known e la trasformazione di Rx
+} CacheEntry;
+
+typedef struct SubCache {
+    CacheEntry *entries;
+    size_t set_mask;
+    unsigned char *victim;      // prossima via da rimpiazzare in ogni set
+    pthread_mutex_t lock[CACHE_STRIPES];
+} SubCache;
+
+typedef struct CachePair {
+    uint64_t h1, h2;
+    double value;
+} CachePair;
+
+SubCache *cache_create(long entries) {
+    SubCache *c = calloc(1, sizeof(SubCache));
+    size_t sets = 1;
+    while(sets * CACHE_WAYS < (size_t)entries)
+        sets *= 2;
+    if(c) {
+        c->entries = calloc(sets * CACHE_WAYS, sizeof(CacheEntry));
+        c->victim = calloc(sets, 1);
+    }
+    if(!c || !c->entries || !c->victim) {
+        fprintf(stderr, "Errore di allocazione!\n");
+        exit(1);
+    }
+    c->set_mask = sets - 1;
+    for(int i = 0; i < CACHE_STRIPES; i++)
+        pthread_mutex_init(&c->lock[i], NULL);
+    return c;
+}
+
+void cache_destroy(SubCache *c) {
+    if(!c)
+        return;
+    for(int i = 0; i < CACHE_STRIPES; i++)
+        pthread_mutex_destroy(&c->lock[i]);
+    free(c->entries);
+    free(c->victim);
+    free(c);
+}
+
+// Copia l'elemento con chiave (h1, h2) in *out; restituisce 0 se manca
+static int cache_get(SubCache *c, uint64_t h1, uint64_t h2, CacheEntry *out) {
+    size_t set = h2 & c->set_mask;
+    CacheEntry *e = c->entries + set * CACHE_WAYS;
+    int found = 0;
+    pthread_mutex_lock(&c->lock[set % CACHE_STRIPES]);
+    for(int w = 0; w < CACHE_WAYS; w++)
+        if(e[w].h1 == h1 && e[w].h2 == h2) {
+            *out = e[w];
+            found = 1;
+            break;
+        }
+    pthread_mutex_unlock(&c->lock[set % CACHE_STRIPES]);
+    return found;
+}
+
+// Inserisce un elemento, rimpiazzando a rotazione le vie di un set pieno
+static void cache_put(SubCache *c, const CacheEntry *in) {
+    size_t set = in->h2 & c->set_mask;
+    CacheEntry *e = c->entries + set * CACHE_WAYS;
+    pthread_mutex_lock(&c->lock[set % CACHE_STRIPES]);
+    int w;
+    for(w = 0; w < CACHE_WAYS; w++)
+        if(e[w].h1 == 0 || (e[w].h1 == in->h1 && e[w].h2 == in->h2))
+            break;
+    if(w == CACHE_WAYS)
+        w = c->victim[set]++ % CACHE_WAYS;
+    e[w] = *in;
+    pthread_mutex_unlock(&c->lock[set % CACHE_STRIPES]);
+}
+
+static inline uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+#define HASH_RES     0x243f6a8885a308d3ULL
+#define HASH_X       0x13198a2e03707344ULL
+#define HASH_SERIES  0xa4093822299f31d0ULL
+#define HASH_PAR     0x082efa98ec4e6c89ULL
+#define HASH_LANE2   0x452821e638d01377ULL
+
+// Hash canonici di tutti i nodi in ctx->hash (h1 in 2*i, h2 in 2*i + 1). I gruppi
+// combinano gli hash dei figli con una moltiplicazione per figlio (sequenza per la serie,
+// somma per il parallelo) e mescolano una volta per nodo. Le foglie sono figlie solo di
+// serie, dove la moltiplicazione basta: il loro hash è il valore stesso, senza mescolare.
+static void topo_hash(CircuitContext *ctx) {
+    const Topology *t = &ctx->topo;
+    uint64_t *h = ctx->hash;
+    for(int i = 0; i < t->n; i++) {
+        uint64_t a, b;
+        if(t->kind[i] == TOPO_RES) {
+            uint64_t bits;
+            memcpy(&bits, &t->value[i], sizeof(bits));
+            h[2 * i] = h[2 * i + 1] = TOPO_IS_UNKNOWN(t, i) ? HASH_X : HASH_RES ^ bits;
+            continue;
+        } else if(t->kind[i] == TOPO_SERIES) {
+            // i figli sono visitati dall'ultimo al primo, sempre nello stesso ordine
+            a = b = HASH_SERIES;
+            for(int c = i - 1; c >= t->start[i]; c = t->start[c] - 1) {
+                a = (a + h[2 * c]) * 0x9e3779b97f4a7c15ULL;
+                b = (b + h[2 * c + 1]) * 0xc2b2ae3d27d4eb4fULL;
+            }
+        } else {
+            // la somma non dipende dall'ordine dei rami
+            a = b = HASH_PAR + (uint64_t)t->nchild[i];
+            for(int c = i - 1; c >= t->start[i]; c = t->start[c] - 1) {
+                a += h[2 * c];
+                b += h[2 * c + 1];
+            }
+        }
+        a = mix64(a);
+        b = mix64(b ^ HASH_LANE2);
+        h[2 * i] = a ? a : 1;   // 0 indica un elemento vuoto della cache
+        h[2 * i + 1] = b;
+    }
+}
+
+static int pair_hash_cmp(const void *pa, const void *pb) {
+    const CachePair *x = pa, *y = pb;
+    if(x->h1 != y->h1)
+        return x->h1 < y->h1 ? -1 : 1;
+    return (x->h2 > y->h2) - (x->h2 < y->h2);
+}
+
+static void cache_reserve(CircuitContext *ctx, int n) {
+    if(n <= ctx->cache_nodes)
+        return;
+    int cap = ctx->cache_nodes ? ctx->cache_nodes : 64;
+    while(cap < n)
+        cap *= 2;
+    ctx->hash = xrealloc(ctx->hash, 2 * (size_t)cap * sizeof(uint64_t));
+    ctx->jump = xrealloc(ctx->jump, cap * sizeof(int));
+    ctx->cached = xrealloc(ctx->cached, cap * sizeof(double));
+    ctx->cache_nodes = cap;
+    ctx->allocs++;
+}
+
+// Come evaluate_topology, ma riusa e alimenta la cache condivisa
+double evaluate_cached(CircuitContext *ctx) {
+    const Topology *t = &ctx->topo;
+    SubCache *cache = ctx->cache;
+    double *stack = t->stack;
+    cache_reserve(ctx, t->n);
+    topo_hash(ctx);
+    const uint64_t *h = ctx->hash;
+
+    // Discesa: il primo sottoalbero trovato copre tutto il suo intervallo [start, i]
+    for(int i = 0; i < t->n; i++)
+        ctx->jump[i] = -1;
+    for(int i = t->n - 1; i >= 0; ) {
+        if(t->kind[i] != TOPO_RES && i - t->start[i] + 1 >= CACHE_MIN_NODES) {
+            CacheEntry e;
+            if(cache_get(cache, h[2 * i], h[2 * i + 1], &e)) {
+                ctx->cache_hits++;
+                ctx->jump[t->start[i]] = i;
+                ctx->cached[i] = e.v[0];
+                i = t->start[i] - 1;
+                continue;
+            }
+            ctx->cache_misses++;
+        }
+        i--;
+    }
+
+    int sp = 0;
+    for(int i = 0; i < t->n; i++) {
+        if(ctx->jump[i] >= 0) {
+            i = ctx->jump[i];
+            stack[sp++] = ctx->cached[i];
+            continue;
+        }
+        int k = t->nchild[i];
+        switch(t->kind[i]) {
+            case TOPO_RES:
+                stack[sp++] = t->value[i];
+                continue;
+            case TOPO_SERIES: {
+                double total = pairwise_sum(stack + sp - k, k);
+                sp -= k;
+                stack[sp++] = total;
+                break;
+            }
+            case TOPO_PAR: {
+                // con due rami la somma è già simmetrica; con più rami serve l'ordine canonico
+                if(k > 2) {
+                    if(k > ctx->pairs_cap) {
+                        ctx->pairs_cap = k * 2;
+                        ctx->pairs = xrealloc(ctx->pairs, ctx->pairs_cap * sizeof(CachePair));
+                    }
+                    // i figli sono visitati dall'ultimo al primo, come i valori sullo stack
+                    int j = sp - 1;
+                    for(int c = i - 1; c >= t->start[i]; c = t->start[c] - 1, j--)
+                        ctx->pairs[j - (sp - k)] = (CachePair){ h[2 * c], h[2 * c + 1], stack[j] };
+                    if(k > 16) {
+                        qsort(ctx->pairs, k, sizeof(CachePair), pair_hash_cmp);
+                    } else {
+                        for(int a = 1; a < k; a++) {
+                            CachePair p = ctx->pairs[a];
+                            int b = a;
+                            for(; b > 0 && pair_hash_cmp(&ctx->pairs[b - 1], &p) > 0; b--)
+                                ctx->pairs[b] = ctx->pairs[b - 1];
+                            ctx->pairs[b] = p;
+                        }
+                    }
+                    for(j = 0; j < k; j++)
+                        stack[sp - k + j] = ctx->pairs[j].value;
+                }
+                for(int j = sp - k; j < sp; j++)
+                    stack[j] = recip_pos(stack[j]);
+                double invSum = pairwise_sum(stack + sp - k, k);
+                sp -= k;
+                stack[sp++] = recip_pos(invSum);
+                break;
+            }
+        }
+        if(i - t->start[i] + 1 >= CACHE_MIN_NODES) {
+            CacheEntry e = { h[2 * i], h[2 * i + 1], 0, { stack[sp - 1] } };
+            cache_put(cache, &e);
+        }
+    }
+    return sp ? stack[0] : 0.0;
+}
+
+// Chiave di un circuito intero: il testo stesso (8 byte per passo), in un dominio
+// separato dai sottocircuiti
+static void hash_circuit_text(const char *s, size_t bytes, uint64_t *h1, uint64_t *h2) {
+    const unsigned char *p = (const unsigned char *)s;
+    size_t i;
+    uint64_t a = HASH_X, b = HASH_LANE2, w;
+    for(i = 0; i + 8 <= bytes; i += 8) {
+        memcpy(&w, p + i, 8);
+        a = (a ^ w) * 0x9e3779b97f4a7c15ULL;
+        b = (b + w) * 0xc2b2ae3d27d4eb4fULL;
+        a ^= a >> 29;
+        b ^= b >> 31;
+    }
+    w = 0;
+    memcpy(&w, p + i, bytes - i);
+    *h1 = mix64(a ^ w ^ bytes) | 1;
+    *h2 = mix64(b + w + bytes);
+}
+
+double calculate_total_resistance_new(CircuitContext *ctx) {
+    struct timespec t0;
+    stats_start(ctx->stats, &t0);
+    double Req = ctx->cache           ? evaluate_cached(ctx)
+                 : fork_applies(ctx) ? evaluate_forkjoin(ctx)
+                                     : evaluate_topology(&ctx->topo, ctx->topo.stack);
+    stats_stop(ctx->stats, PHASE_EVALUATE, &t0);
+    return Req;
+}
+
+/* --- FUNZIONI PER LA GESTIONE DELLE INCOGNITE --- */
+// Conta il numero di resistenze incognite (popcount della bitmask)
+int count_unknowns(CircuitContext *ctx) {
+    const Topology *t = &ctx->topo;
+    int count = 0;
+    for(int w = 0; w < (t->n + 63) / 64; w++)
+        count += __builtin_popcountll(t->unknown[w]);
+    return count;
+}
+
+// --- FUNZIONI DI CALCOLO SIMBOLICO (una incognita in qualunque posizione) ---
+// Con tutte le altre resistenze fissate, Req è una funzione lineare fratta della
+// resistenza incognita X:
+//   Req(X) = (a*X + b) / (c*X + d)
+// Una foglia incognita vale (1, 0, 0, 1). Risalendo verso la radice, solo il figlio
+// che contiene l'incognita dipende da X; gli altri figli sono costanti:
+//   serie con somma costante C:          (a + C*c, b + C*d, c, d)
+//   parallelo con conduttanza costante G: (a, b, c + G*a, d + G*b)
+// Componendo le trasformazioni in un'unica passata postfissa si ottengono i quattro
+// coefficienti in O(n), e la misura si inverte in forma chiusa:
+//   X = (Req*d - b) / (a - Req*c)
+// Per l'incognita in serie (c = 0) si ritrova Rx = Req - Req_known; per il caso
+// del flowchart (gruppo con due rami) si ritrova X = R_par*S_k/(S_k - R_par) - S_u.
+typedef struct {
+    double a, b, c, d;
+} Mobius;
+
+// Riporta i coefficienti vicino a 1 con una potenza di due (esatta) quando
+// l'annidamento profondo li porterebbe verso overflow o underflow
+static inline void mobius_normalize(Mobius *m) {
+    double s = fmax(fmax(fabs(m->a), fabs(m->b)), fmax(fabs(m->c), fabs(m->d)));
+    int e;
+    frexp(s, &e);
+    if(e > 512 || e < -512) {
+        m->a = ldexp(m->a, -e);
+        m->b = ldexp(m->b, -e);
+        m->c = ldexp(m->c, -e);
+        m->d = ldexp(m->d, -e);
+    }
+}
+
+static inline double mobius_eval(const Mobius *m, double x) {
+    return (m->a * x + m->b) / (m->c * x + m->d);
+}
+
+// Derivata dReq/dX nel punto x
+static inline double mobius_slope(const Mobius *m, double x) {
+    double den = m->c * x + m->d;
+    return (m->a * m->d - m->b * m->c) / (den * den);
+}
+
+// Coefficienti di Req in funzione dell'incognita numero "var" (in ordine di testo).
+// Le altre incognite valgono xs[i] (0 se xs è NULL, come in evaluate_topology).
+// Se l'incognita non esiste, *m è la costante Req = b/d. Restituisce 1 se trovata.
+int topo_mobius(const Topology *t, const double *xs, int var, double *stack, Mobius *m) {
+    int sp = 0, path = -1, u = 0;
+    *m = (Mobius){ 1, 0, 0, 1 };
+    for(int i = 0; i < t->n; i++) {
+        int k = t->nchild[i];
+        int base = sp - k;
+        int on_path = path >= base;
+        switch(t->kind[i]) {
+            case TOPO_RES:
+                if(TOPO_IS_UNKNOWN(t, i)) {
+                    if(u == var)
+                        path = sp;
+                    stack[sp++] = (xs && u != var) ? xs[u] : 0.0;
+                    u++;
+                } else {
+                    stack[sp++] = t->value[i];
+                }
+                break;
+            case TOPO_SERIES: {
+                if(on_path)
+                    stack[path] = 0;
+                double C = pairwise_sum(stack + base, k);
+                sp = base;
+                stack[sp++] = C;
+                if(on_path) {
+                    m->a += C * m->c;
+                    m->b += C * m->d;
+                    mobius_normalize(m);
+                    path = base;
+                }
+                break;
+            }
+            case TOPO_PAR: {
+                for(int j = base; j < sp; j++)
+                    stack[j] = recip_pos(stack[j]);
+                if(on_path)
+                    stack[path] = 0;
+                double G = pairwise_sum(stack + base, k);
+                sp = base;
+                stack[sp++] = on_path ? 0.0 : recip_pos(G);
+                if(on_path) {
+                    m->c += G * m->a;
+                    m->d += G * m->b;
+                    mobius_normalize(m);
+                    path = base;
+                }
+                break;
+            }
+        }
+    }
+    if(path < 0) {
+        *m = (Mobius){ 0, sp ? stack[0] : 0.0, 0, 1 };
+        return 0;
+    }
+    return 1;
+}
+
+// Esito del calcolo di Rx (condiviso fra modalità interattiva e batch)
+typedef enum {
+    RX_OK,            // Rx calcolata
+    RX_BAD_MEASURE,   // Req misurata non positiva
+    RX_BAD_DATA,      // Req misurata non raggiungibile con nessuna Rx (>= Req_max)
+    RX_NON_POSITIVE   // Rx risulta zero o negativa
+} RxStatus;
+
+// Dati per Rx ricavati una volta sola dal circuito
+typedef struct {
+    int parallel;     // 1 se Req dipende da Rx in modo non lineare (incognita in un parallelo)
+    Mobius m;         // Req(Rx) = (a*Rx + b) / (c*Rx + d)
+    double Req_min;   // Req per Rx -> 0
+    double Req_max;   // Req per Rx -> infinito (INFINITY se l'incognita è in serie)
+    double Req_known;
+} RxFlowchart;
+
+// Completa il flowchart dalla trasformazione Req(Rx)
+void rx_from_mobius(RxFlowchart *f, const Mobius *m, double Req_known) {
+    f->Req_known = Req_known;
+    f->m = *m;
+    f->parallel = m->c > 0;
+    f->Req_min = m->b / m->d;
+    f->Req_max = f->parallel ? m->a / m->c : INFINITY;
+}
+
+void prepare_rx(CircuitContext *ctx, RxFlowchart *f, double Req_known) {
+    struct timespec t0;
+    stats_start(ctx->stats, &t0);
+    Mobius m;
+    topo_mobius(&ctx->topo, NULL, 0, ctx->topo.stack, &m);
+    rx_from_mobius(f, &m, Req_known);
+    stats_stop(ctx->stats, PHASE_SOLVE, &t0);
+}
+
+// Inverte Req(Rx) nel valore misurato; il risultato è lasciato in *Rx
+RxStatus solve_rx(const RxFlowchart *f, double Req_measured, double *Rx) {
+    *Rx = 0;
+    if(Req_measured <= 0)
+        return RX_BAD_MEASURE;
+    const Mobius *m = &f->m;
+    double den = m->a - Req_measured * m->c;
+    if(den <= 0)
+        return RX_BAD_DATA;
+    *Rx = (Req_measured * m->d - m->b) / den;
+    return (*Rx <= 0) ? RX_NON_POSITIVE : RX_OK;
+}
+// Fine area funzioni simboliche
+
+/* --- FUNZIONI DI DISEGNO "CUSTOM" PER CIRCUITI SEMPLICI --- */
+// Se il circuito non contiene gruppi paralleli né incognite, lo consideriamo semplice.
+int isSimpleCircuit(CircuitContext *ctx) {
+    return ctx->topo.n_groups == 0 && !ctx->topo.malformed && count_unknowns(ctx) == 0;
+}
+
+void customDrawSimpleCircuit() {
+    wprintf(L"\n=== Disegno del circuito ===\n\n");
+    wprintf(L"|-----%ls-----|\n", RES_BLOCK);
+    wprintf(L"|               |\n");
+    wprintf(L"|------| '------|\n");
+}
+
+/* --- ISTRUZIONI --- */
+void print_instructions() {
+    wprintf(L"\n=== Istruzioni ===\n"
+            L"+       -> Generatore (inizio circuito)\n"
+            L"Numero  -> Resistenza (es: 10, 47, ecc.)\n"
+            L"x       -> Resistenza incognita da trovare\n"
+            L"_       -> Connessione in serie\n"
+            L"*       -> Nodo (inizio/fine gruppo parallelo)\n"
+            L"||      -> Inizio ramo parallelo (separa i rami)\n"
+            L"=       -> Fine ramo parallelo\n"
+            L"-       -> Chiusura circuito\n"
+            L"\nEsempio valido: +10_20*x||30=*-\n"
+            L"I gruppi si possono annidare: +10_*x||*20||30=*=*-\n");
+}
+
+
+/* --- POOL DI THREAD CON WORK STEALING --- */
+// I thread restano vivi fra un round e l'altro. Ogni round esegue i task [0, ntasks):
+// ciascun worker parte da un intervallo contiguo e, quando lo esaurisce, ruba la metà
+// finale dell'intervallo di un altro worker. Così i task lunghi (circuiti grandi) non
+// lasciano fermi gli altri core. Il thread chiamante lavora come worker 0.
+typedef void (*PoolTask)(void *arg, int worker, long index);
+
+typedef struct {
+    pthread_mutex_t lock;
+    long lo, hi;             // task ancora da eseguire: [lo, hi)
+} PoolQueue;
+
+typedef struct WorkPool WorkPool;
+
+typedef struct {
+    WorkPool *pool;
+    int id;
+} PoolSlot;
+
+struct WorkPool {
+    int nthreads;            // worker totali, incluso il chiamante
+    pthread_t *threads;
+    PoolSlot *slots;
+    PoolQueue *queues;
+    PoolTask task;
+    void *arg;
+    pthread_mutex_t mtx;
+    pthread_cond_t wake;     // nuovo round o chiusura
+    pthread_cond_t done;     // tutti i worker hanno finito il round
+    long generation;         // numero del round corrente
+    int running;             // worker ancora attivi nel round
+    int quit;
+};
+
+// Prende il prossimo task: prima dalla propria coda, altrimenti rubando
+static int pool_take(WorkPool *p, int self, long *index) {
+    PoolQueue *q = &p->queues[self];
+    pthread_mutex_lock(&q->lock);
+    if(q->lo < q->hi) {
+        *index = q->lo++;
+        pthread_mutex_unlock(&q->lock);
+        return 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    for(int k = 1; k < p->nthreads; k++) {
+        PoolQueue *v = &p->queues[(self + k) % p->nthreads];
+        pthread_mutex_lock(&v->lock);
+        long avail = v->hi - v->lo;
+        if(avail > 0) {
+            long lo = v->hi - (avail + 1) / 2;
+            long hi = v->hi;
+            v->hi = lo;
+            pthread_mutex_unlock(&v->lock);
+            *index = lo;
+            if(lo + 1 < hi) {
+                pthread_mutex_lock(&q->lock);
+                q->lo = lo + 1;
+                q->hi = hi;
+                pthread_mutex_unlock(&q->lock);
+            }
+            return 1;
+        }
+        pthread_mutex_unlock(&v->lock);
+    }
+    return 0;
+}
+
+static void pool_work(WorkPool *p, int self) {
+    long index;
+    while(pool_take(p, self, &index))
+        p->task(p->arg, self, index);
+}
+
+static void *pool_thread(void *arg) {
+    PoolSlot *slot = arg;
+    WorkPool *p = slot->pool;
+    long seen = 0;
+    for(;;) {
+        pthread_mutex_lock(&p->mtx);
+        while(!p->quit && p->generation == seen)
+            pthread_cond_wait(&p->wake, &p->mtx);
+        if(p->quit) {
+            pthread_mutex_unlock(&p->mtx);
+            return NULL;
+        }
+        seen = p->generation;
+        pthread_mutex_unlock(&p->mtx);
+
+        pool_work(p, slot->id);
+
+        pthread_mutex_lock(&p->mtx);
+        if(--p->running == 0)
+            pthread_cond_signal(&p->done);
+        pthread_mutex_unlock(&p->mtx);
+    }
+}
+
+// Numero di core disponibili
+int online_cpus() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+void pool_init(WorkPool *p, int nthreads) {
+    memset(p, 0, sizeof(*p));
+    p->nthreads = nthreads > 0 ? nthreads : 1;
+    p->threads = calloc(p->nthreads, sizeof(pthread_t));
+    p->slots = calloc(p->nthreads, sizeof(PoolSlot));
+    p->queues = calloc(p->nthreads, sizeof(PoolQueue));
+    if(!p->threads || !p->slots || !p->queues) {
+        fprintf(stderr, "Errore di allocazione!\n");
+        exit(1);
+    }
+    pthread_mutex_init(&p->mtx, NULL);
+    pthread_cond_init(&p->wake, NULL);
+    pthread_cond_init(&p->done, NULL);
+    for(int w = 0; w < p->nthreads; w++) {
+        pthread_mutex_init(&p->queues[w].lock, NULL);
+        p->slots[w].pool = p;
+        p->slots[w].id = w;
+    }
+    for(int w = 1; w < p->nthreads; w++) {
+        if(pthread_create(&p->threads[w], NULL, pool_thread, &p->slots[w]) != 0) {
+            fprintf(stderr, "Errore: impossibile creare i thread di lavoro.\n");
+            exit(1);
+        }
+    }
+}
+
+// Esegue task(arg, worker, i) per ogni i in [0, ntasks) e ritorna quando tutti hanno finito
+void pool_run(WorkPool *p, long ntasks, PoolTask task, void *arg) {
+    for(int w = 0; w < p->nthreads; w++) {
+        p->queues[w].lo = ntasks * w / p->nthreads;
+        p->queues[w].hi = ntasks * (w + 1) / p->nthreads;
+    }
+    p->task = task;
+    p->arg = arg;
+    pthread_mutex_lock(&p->mtx);
+    p->running = p->nthreads - 1;
+    p->generation++;
+    pthread_cond_broadcast(&p->wake);
+    pthread_mutex_unlock(&p->mtx);
+
+    pool_work(p, 0);
+
+    pthread_mutex_lock(&p->mtx);
+    while(p->running > 0)
+        pthread_cond_wait(&p->done, &p->mtx);
+    pthread_mutex_unlock(&p->mtx);
+}
+
+void pool_destroy(WorkPool *p) {
+    pthread_mutex_lock(&p->mtx);
+    p->quit = 1;
+    pthread_cond_broadcast(&p->wake);
+    pthread_mutex_unlock(&p->mtx);
+    for(int w = 1; w < p->nthreads; w++)
+        pthread_join(p->threads[w], NULL);
+    for(int w = 0; w < p->nthreads; w++)
+        pthread_mutex_destroy(&p->queues[w].lock);
+    pthread_mutex_destroy(&p->mtx);
+    pthread_cond_destroy(&p->wake);
+    pthread_cond_destroy(&p->done);
+    free(p->threads);
+    free(p->slots);
+    free(p->queues);
+}
+
+/* --- VALUTAZIONE FORK-JOIN DI UN CIRCUITO GRANDE --- */
+// Il pool del batch lavora fra circuiti diversi: un solo circuito enorme (per esempio un
+// parallelo con migliaia di rami larghi) resterebbe su un core. Una passata preliminare
+// scende dalla radice e separa i sottoalberi grandi (più di "grain" nodi) dai sottoalberi
+// piccoli massimali. I piccoli adiacenti nell'ordine postfisso formano dei run: intervalli
+// di sottoalberi completi, valutati in parallelo ognuno con il proprio stack. La passata
+// finale è la solita valutazione postfissa che al posto di ogni run impila i valori già
+// pronti, e che riduce con tutto il pool i gruppi con moltissimi figli.
+// Nessuna riduzione cambia ordine: un sottoalbero vale lo stesso ovunque sia valutato, e
+// un gruppo largo è diviso in pezzi di 2^k blocchi allineati, che sono proprio i
+// sottoalberi dell'albero a coppie di pairwise_sum. Il risultato coincide bit per bit con
+// evaluate_topology, con qualunque numero di thread.
+#define FORK_MIN_NODES (1 << 16)     // circuiti più piccoli: valutazione sequenziale
+#define FORK_MIN_BYTES (1 << 18)     // record del batch che valgono il fork-join
+#define FORK_TASKS 8                 // task per worker, per bilanciare il carico
+#define FORK_GRAIN_MIN 4096          // nodi (o figli) minimi di un task
+#define FORK_RUN_MIN 256             // run più corti restano nella passata finale
+#define FORK_WIDE_MIN (1 << 15)      // figli minimi per ridurre un gruppo in parallelo
+
+typedef struct {
+    int from, to;                    // nodi [from, to): sottoalberi completi consecutivi
+    int out, count;                  // i loro valori, in vals[out, out + count)
+} ForkRun;
+
+typedef struct ForkJoin {
+    ForkRun *runs;
+    int n_runs, runs_cap;
+    int *wide;                       // gruppi da ridurre in parallelo, in ordine postfisso
+    int n_wide, wide_cap;
+    double *vals;                    // valori prodotti dai run
+    int vals_cap;
+    double *partial;                 // un valore per pezzo del gruppo largo in riduzione
+    int partial_cap;
+    double **stacks;                 // uno stack per worker
+    int n_stacks, stack_cap;
+} ForkJoin;
+
+typedef struct {
+    const Topology *t;
+    ForkJoin *fj;
+    double *base;                    // figli del gruppo largo (già sullo stack)
+    int k, span, par;                // figli, figli per pezzo, 1 per un parallelo
+} ForkJob;
+
+int fork_applies(const CircuitContext *ctx) {
+    return ctx->pool && ctx->pool->nthreads > 1 && ctx->topo.n >= FORK_MIN_NODES;
+}
+
+static void fork_close_run(ForkJoin *fj, int from, int to, int count) {
+    if(to - from < FORK_RUN_MIN)
+        return;
+    if(fj->n_runs == fj->runs_cap) {
+        fj->runs_cap = fj->runs_cap ? fj->runs_cap * 2 : 64;
+        fj->runs = xrealloc(fj->runs, fj->runs_cap * sizeof(ForkRun));
+    }
+    fj->runs[fj->n_runs++] = (ForkRun){ from, to, 0, count };
+}
+
+// Passata preliminare. Scorre i nodi all'indietro saltando ogni sottoalbero piccolo
+// in un colpo solo, quindi visita soltanto i nodi grandi e le radici dei piccoli
+// massimali: costa poco rispetto alla valutazione. Restituisce i valori dei run.
+static int fork_plan(ForkJoin *fj, const Topology *t, int nthreads) {
+    int grain = t->n / (nthreads * FORK_TASKS);
+    if(grain < FORK_GRAIN_MIN)
+        grain = FORK_GRAIN_MIN;
+    fj->n_runs = fj->n_wide = 0;
+    int from = 0, to = 0, count = 0; // run in costruzione
+    for(int i = t->n - 1; i >= 0;) {
+        int first = t->start[i];
+        if(i - first + 1 > grain) {
+            fork_close_run(fj, from, to, count);
+            from = to = count = 0;
+            if(t->nchild[i] >= FORK_WIDE_MIN) {
+                if(fj->n_wide == fj->wide_cap) {
+                    fj->wide_cap = fj->wide_cap ? fj->wide_cap * 2 : 16;
+                    fj->wide = xrealloc(fj->wide, fj->wide_cap * sizeof(int));
+                }
+                fj->wide[fj->n_wide++] = i;
+            }
+            i--;
+            continue;
+        }
+        if(count && from == i + 1 && to - first <= grain) {
+            from = first;
+            count++;
+        } else {
+            fork_close_run(fj, from, to, count);
+            from = first;
+            to = i + 1;
+            count = 1;
+        }
+        i = first - 1;
+    }
+    fork_close_run(fj, from, to, count);
+
+    // la visita era all'indietro: riporta run e gruppi larghi in ordine postfisso
+    for(int a = 0, b = fj->n_runs - 1; a < b; a++, b--) {
+        ForkRun r = fj->runs[a];
+        fj->runs[a] = fj->runs[b];
+        fj->runs[b] = r;
+    }
+    for(int a = 0, b = fj->n_wide - 1; a < b; a++, b--) {
+        int w = fj->wide[a];
+        fj->wide[a] = fj->wide[b];
+        fj->wide[b] = w;
+    }
+    int out = 0;
+    for(int r = 0; r < fj->n_runs; r++) {
+        fj->runs[r].out = out;
+        out += fj->runs[r].count;
+    }
+    return out;
+}
+
+static void fork_run_task(void *arg, int worker, long r) {
+    ForkJob *job = arg;
+    const ForkRun *run = &job->fj->runs[r];
+    double *stack = job->fj->stacks[worker];
+    evaluate_span(job->t, run->from, run->to, stack, 0);
+    memcpy(job->fj->vals + run->out, stack, run->count * sizeof(double));
+}
+
+// Un pezzo di un gruppo largo: pairwise_sum del pezzo è il nodo dell'albero a coppie
+// del gruppo intero che copre gli stessi blocchi
+static void fork_wide_task(void *arg, int worker, long c) {
+    ForkJob *job = arg;
+    (void)worker;
+    double *a = job->base + c * job->span;
+    int len = job->k - (int)c * job->span;
+    if(len > job->span)
+        len = job->span;
+    if(job->par)
+        for(int j = 0; j < len; j++)
+            a[j] = recip_pos(a[j]);
+    job->fj->partial[c] = pairwise_sum(a, len);
+}
+
+// pairwise_sum (dei reciproci, per un parallelo) dei k figli in base, con tutto il pool
+static double fork_reduce(WorkPool *pool, ForkJob *job, double *base, int k, int par) {
+    int nb = (k + REDUCE_BLOCK - 1) / REDUCE_BLOCK;
+    int w = 1;
+    while(w * REDUCE_BLOCK < FORK_GRAIN_MIN || (nb + w - 1) / w > pool->nthreads * FORK_TASKS)
+        w *= 2;
+    int pieces = (nb + w - 1) / w;
+    job->base = base;
+    job->k = k;
+    job->span = w * REDUCE_BLOCK;
+    job->par = par;
+    pool_run(pool, pieces, fork_wide_task, job);
+    // livelli dell'albero a coppie sopra i pezzi, come in pairwise_sum
+    double *p = job->fj->partial;
+    for(int s = 1; s < pieces; s *= 2)
+        for(int j = 0; j + s < pieces; j += 2 * s)
+            p[j] += p[j + s];
+    return p[0];
+}
+
+double evaluate_forkjoin(CircuitContext *ctx) {
+    const Topology *t = &ctx->topo;
+    WorkPool *pool = ctx->pool;
+    if(!ctx->fork) {
+        ctx->fork = calloc(1, sizeof(ForkJoin));
+        if(!ctx->fork) {
+            fprintf(stderr, "Errore di allocazione!\n");
+            exit(1);
+        }
+    }
+    ForkJoin *fj = ctx->fork;
+    int n_vals = fork_plan(fj, t, pool->nthreads);
+    if(n_vals > fj->vals_cap) {
+        fj->vals_cap = n_vals;
+        fj->vals = xrealloc(fj->vals, n_vals * sizeof(double));
+    }
+    if(pool->nthreads * FORK_TASKS > fj->partial_cap) {
+        fj->partial_cap = pool->nthreads * FORK_TASKS;
+        fj->partial = xrealloc(fj->partial, fj->partial_cap * sizeof(double));
+    }
+    if(pool->nthreads > fj->n_stacks || t->max_stack + 1 > fj->stack_cap) {
+        if(pool->nthreads > fj->n_stacks) {
+            fj->stacks = xrealloc(fj->stacks, pool->nthreads * sizeof(double *));
+            for(int w = fj->n_stacks; w < pool->nthreads; w++)
+                fj->stacks[w] = NULL;
+            fj->n_stacks = pool->nthreads;
+        }
+        if(t->max_stack + 1 > fj->stack_cap)
+            fj->stack_cap = t->max_stack + 1;
+        for(int w = 0; w < fj->n_stacks; w++)
+            fj->stacks[w] = xrealloc(fj->stacks[w], fj->stack_cap * sizeof(double));
+    }
+
+    ForkJob job = { t, fj, NULL, 0, 0, 0 };
+    pool_run(pool, fj->n_runs, fork_run_task, &job);
+
+    // passata finale: i nodi fuori dai run, in ordine
+    double *stack = t->stack;
+    int sp = 0, i = 0, r = 0, w = 0;
+    while(i < t->n) {
+        int stop = r < fj->n_runs ? fj->runs[r].from : t->n;
+        if(w < fj->n_wide && fj->wide[w] < stop)
+            stop = fj->wide[w];
+        sp = evaluate_span(t, i, stop, stack, sp);
+        i = stop;
+        if(r < fj->n_runs && i == fj->runs[r].from) {
+            memcpy(stack + sp, fj->vals + fj->runs[r].out, fj->runs[r].count * sizeof(double));
+            sp += fj->runs[r].count;
+            i = fj->runs[r++].to;
+        } else if(w < fj->n_wide && i == fj->wide[w]) {
+            int k = t->nchild[i], par = t->kind[i] == TOPO_PAR;
+            sp -= k;
+            double v = fork_reduce(pool, &job, stack + sp, k, par);
+            stack[sp++] = par ? recip_pos(v) : v;
+            i++;
+            w++;
+        }
+    }
+    return sp ? stack[0] : 0.0;
+}
+
+void fork_free(ForkJoin *fj) {
+    if(!fj)
+        return;
+    for(int w = 0; w < fj->n_stacks; w++)
+        free(fj->stacks[w]);
+    free(fj->stacks);
+    free(fj->runs);
+    free(fj->wide);
+    free(fj->vals);
+    free(fj->partial);
+    free(fj);
+}
+
+/* --- MODALITÀ BATCH (NON INTERATTIVA) --- */
+// Un record per riga: "circuito [Req] [I] [V]", campi separati da spazi, tab o ';'.
+// I campi mancanti, vuoti o "-" valgono -1 (non noto). Righe vuote e commenti '#' sono ignorati.
+// Per ogni record viene scritta una riga CSV (o JSON) senza disegnare il circuito.
+// I record sono letti a blocchi, valutati in parallelo dal pool (un contesto per worker)
+// e scritti nello stesso ordine dell'input.
+
+typedef struct {
+    int batch;            // 1 = modalità batch
+    const char *input;    // file dei record (NULL = stdin)
+    int json;             // 1 = output JSON lines invece di CSV
+    int threads;          // worker del batch (0 = tutti i core)
+    long montecarlo;      // campioni per circuito (0 = modalità disattivata)
+    double tolerance;     // tolleranza relativa delle resistenze
+    int interval;         // 1 = limiti garantiti con l'aritmetica degli intervalli
+    int sensitivity;      // 1 = derivate di Req rispetto a ogni elemento
+    int elements;         // 1 = corrente, tensione e potenza di ogni elemento
+    int stream;           // 1 = record letti a blocchi, memoria proporzionale all'annidamento
+    const char *sweep;    // circuito per la risposta in frequenza (NULL = modalità disattivata)
+    double fmin, fmax;    // estremi della sweep (Hz)
+    long points;          // frequenze della sweep, spaziate logaritmicamente
+    int gaussian;         // 1 = distribuzione normale (sigma = tolleranza/3)
+    uint64_t seed;        // seme del generatore casuale
+    const char *tune;     // circuito per la modalità di taratura incrementale
+    int fit;              // 1 = stima di più incognite ai minimi quadrati
+    const char *netlist;  // netlist per l'analisi nodale
+    const char *terminal_a, *terminal_b; // terminali della netlist
+    const char *voltages; // file dei potenziali dei nodi
+    const char *to_netlist; // circuito da convertire in netlist
+    int no_draw;            // 1 per saltare il disegno in modalità interattiva
+    int bench;              // 1 = benchmark su circuiti generati
+    long bench_count;       // circuiti generati
+    int bench_size;         // resistenze per circuito
+    int bench_depth;        // profondità massima dei gruppi paralleli
+    int bench_fanout;       // rami massimi per gruppo
+    int bench_unknown;      // posizione dell'incognita (BenchUnknown)
+    int self_test;          // 1 = confronta fra loro i valutatori sui circuiti generati
+    const char *baseline;   // risultati di riferimento per il confronto
+    double threshold;       // calo relativo tollerato rispetto al riferimento
+    long cache_entries;     // capacità della cache dei sottocircuiti (0 = spenta)
+    const char *compile;    // file binario da scrivere con i circuiti compilati
+    const char *run_compiled; // file binario da valutare
+    const char *serve;      // socket Unix su cui restare in ascolto
+    const char *client;     // socket Unix del server a cui inviare i record
+    double synth;           // Req obiettivo della sintesi (0 = modalità disattivata)
+    int synth_series;       // indice in E_SERIES
+    int synth_parts;        // resistenze massime per rete
+    int synth_top;          // candidati stampati per numero di parti
+    int collect_stats;      // 1 = --stats
+    const char *stats_file; // destinazione del JSON delle statistiche (NULL = stderr)
+    Stats *stats;           // totale della corsa, NULL se --stats è disattivato
+} Options;
+
+typedef struct {
+    long line;            // riga del record nel file di input
+    const char *status;   // esito: "ok" o codice di errore
+    int unknowns;         // numero di resistenze incognite
+    double req_known;     // somma delle resistenze note
+    double req;           // Req usata per I e V (-1 se non disponibile)
+    double rx;            // Rx calcolata (-1 se non disponibile)
+    double I, V;          // corrente e tensione (-1 se non disponibili)
+} BatchResult;
+
+// Valuta un record: parsing, Req nota, flowchart per Rx e legge di Ohm
+// Stati e grandezze di un record a partire da Req_known, dal numero di incognite e (con
+// una sola incognita) dal flowchart di Rx
+void finish_record(BatchResult *r, double Req_known, int unknowns, const RxFlowchart *f,
+                   double Req_measured, double I, double V) {
+    r->req_known = Req_known;
+    r->unknowns = unknowns;
+
+    double Req = Req_known;
+    if(r->unknowns > 1) {
+        r->status = "multi_unknown";
+        return;
+    }
+    if(r->unknowns == 1) {
+        if(Req_measured <= 0) {
+            r->status = "no_req";
+            return;
+        }
+        double Rx;
+        switch(solve_rx(f, Req_measured, &Rx)) {
+            case RX_OK:
+                r->rx = Rx;
+                break;
+            case RX_BAD_MEASURE:
+                r->status = "no_req";
+                return;
+            case RX_BAD_DATA:
+                r->status = "bad_data";
+                return;
+            case RX_NON_POSITIVE:
+                r->status = "rx_nonpositive";
+                return;
+        }
+        Req = Req_measured;
+    }
+
+    if(Req <= 0) {
+        r->status = "zero_req";
+        return;
+    }
+    r->req = Req;
+    if (I > 0 && V <= 0)
+        V = I * Req;
+    else if (V > 0 && I <= 0)
+        I = V / Req;
+    r->I = I > 0 ? I : -1;
+    r->V = V > 0 ? V : -1;
+}
+
+void evaluate_record(CircuitContext *ctx, const char *circuit, size_t len, double Req_measured, double I, double V,
+                     BatchResult *r) {
+    r->status = "ok";
+    r->unknowns = 0;
+    r->req_known = 0;
+    r->req = r->rx = r->I = r->V = -1;
+
+    if(!circuit_framed(circuit, len)) {
+        r->status = "bad_format";
+        return;
+    }
+
+    // Con --cache un circuito già visto non viene nemmeno analizzato: la cache conserva
+    // Req_known, il numero di incognite e la trasformazione Req(Rx)
+    uint64_t h1 = 0, h2 = 0;
+    CacheEntry e;
+    RxFlowchart f;
+    if(ctx->cache) {
+        hash_circuit_text(circuit, len, &h1, &h2);
+        if(cache_get(ctx->cache, h1, h2, &e)) {
+            ctx->record_hits++;
+        } else {
+            ctx->record_misses++;
+            e.h1 = 0;
+        }
+    }
+    if(!ctx->cache || e.h1 == 0) {
+        reset_circuit(ctx);
+        parse_circuit_utf8(ctx, circuit, len);
+        if(ctx->topo.n_reactive) {
+            r->status = "reactive";
+            return;
+        }
+        e = (CacheEntry){ h1, h2, count_unknowns(ctx), { calculate_total_resistance_new(ctx) } };
+        if(e.unknowns == 1) {
+            prepare_rx(ctx, &f, e.v[0]);
+            e.v[1] = f.m.a;
+            e.v[2] = f.m.b;
+            e.v[3] = f.m.c;
+            e.v[4] = f.m.d;
+        }
+        if(ctx->cache)
+            cache_put(ctx->cache, &e);
+    } else if(e.unknowns == 1) {
+        Mobius m = { e.v[1], e.v[2], e.v[3], e.v[4] };
+        rx_from_mobius(&f, &m, e.v[0]);
+    }
+
+    finish_record(r, e.v[0], e.unknowns, &f, Req_measured, I, V);
+}
+
+// Scrive un campo numerico: vuoto (CSV) o null (JSON) se non disponibile
+static void put_number(FILE *out, double v, int available, int json) {
+    if(available)
+        fprintf(out, "%.10g", v);
+    else if(json)
+        fputs("null", out);
+}
+
+void write_result(FILE *out, const BatchResult *r, int json) {
+    if(json) {
+        fprintf(out, "{\"line\":%ld,\"status\":\"%s\",\"unknowns\":%d,\"req_known\":",
+                r->line, r->status, r->unknowns);
+        put_number(out, r->req_known, 1, 1);
+        fputs(",\"req\":", out);
+        put_number(out, r->req, r->req > 0, 1);
+        fputs(",\"rx\":", out);
+        put_number(out, r->rx, r->rx > 0, 1);
+        fputs(",\"i\":", out);
+        put_number(out, r->I, r->I > 0, 1);
+        fputs(",\"v\":", out);
+        put_number(out, r->V, r->V > 0, 1);
+        fputs("}\n", out);
+    } else {
+        fprintf(out, "%ld,%s,%d,", r->line, r->status, r->unknowns);
+        put_number(out, r->req_known, 1, 0);
+        fputc(',', out);
+        put_number(out, r->req, r->req > 0, 0);
+        fputc(',', out);
+        put_number(out, r->rx, r->rx > 0, 0);
+        fputc(',', out);
+        put_number(out, r->I, r->I > 0, 0);
+        fputc(',', out);
+        put_number(out, r->V, r->V > 0, 0);
+        fputc('\n', out);
+    }
+}
+
+static int is_field_sep(char ch) {
+    return ch == ' ' || ch == '\t' || ch == ';';
+}
+
+// Legge il prossimo campo numerico a partire da *s; -1 se mancante o "-"
+static double next_field(char **s) {
+    char *p = *s;
+    while(*p && is_field_sep(*p))
+        p++;
+    char *start = p;
+    while(*p && !is_field_sep(*p)) {
+        if(*p == ',')
+            *p = '.'; // accetta la virgola come separatore decimale
+        p++;
+    }
+    *s = p;
+    if(p == start || (p - start == 1 && *start == '-'))
+        return -1;
+    char saved = *p;
+    *p = '\0';
+    char *end;
+    double v = strtod(start, &end);
+    *p = saved;
+    return (end == start) ? -1 : v;
+}
+
+// Divide una riga in circuito e campi numerici; 0 se la riga è vuota o un commento
+int split_record(char *line, ssize_t n, char **circ, size_t *circ_len, double *Req, double *I, double *V) {
+    while(n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r'))
+        line[--n] = '\0';
+    char *p = line;
+    while(*p && is_field_sep(*p))
+        p++;
+    if(*p == '\0' || *p == '#')
+        return 0;
+
+    *circ = p;
+    while(*p && !is_field_sep(*p))
+        p++;
+    *circ_len = p - *circ;
+    char *rest = p;
+    if(*p) {
+        *p = '\0';
+        rest = p + 1;
+    }
+    *Req = next_field(&rest);
+    *I = next_field(&rest);
+    *V = next_field(&rest);
+    return 1;
+}
+
+// Apre il file dei record ("-" o NULL = stdin)
+FILE *open_input(const char *path) {
+    if(!path || strcmp(path, "-") == 0)
+        return stdin;
+    FILE *in = fopen(path, "r");
+    if(!in)
+        fprintf(stderr, "Errore: impossibile aprire il file '%s'.\n", path);
+    return in;
+}
+
+#define BATCH_CHUNK 16384              // record per blocco
+#define BATCH_CHUNK_TEXT (64 << 20)      // byte di circuiti per blocco
+
+// Un blocco di record letti dall'input, in attesa di valutazione
+typedef struct {
+    char *text;              // circuiti terminati da '\0', uno dopo l'altro
+    size_t text_len, text_cap;
+    size_t offset[BATCH_CHUNK];
+    size_t length[BATCH_CHUNK];
+    double req[BATCH_CHUNK], I[BATCH_CHUNK], V[BATCH_CHUNK];
+    BatchResult result[BATCH_CHUNK];
+    int count;
+} BatchChunk;
+
+// Stato privato di ogni worker
+typedef struct {
+    CircuitContext *ctx;
+} BatchWorker;
+
+typedef struct {
+    BatchChunk *chunk;
+    BatchWorker *workers;
+    int defer;               // 1 = i circuiti enormi aspettano il fork-join
+} BatchJob;
+
+static void batch_task(void *arg, int worker, long i) {
+    BatchJob *job = arg;
+    BatchChunk *ch = job->chunk;
+    BatchWorker *w = &job->workers[worker];
+    if(job->defer && ch->length[i] >= FORK_MIN_BYTES) {
+        ch->result[i].status = NULL;
+        return;
+    }
+    long line = ch->result[i].line;
+    evaluate_record(w->ctx, ch->text + ch->offset[i], ch->length[i], ch->req[i], ch->I[i], ch->V[i], &ch->result[i]);
+    ch->result[i].line = line;
+}
+
+static void chunk_append(BatchChunk *ch, const char *circ, size_t len) {
+    if(ch->text_len + len + 1 > ch->text_cap) {
+        size_t cap = ch->text_cap ? ch->text_cap : 1 << 16;
+        while(cap < ch->text_len + len + 1)
+            cap *= 2;
+        char *nt = realloc(ch->text, cap);
+        if(!nt) {
+            fprintf(stderr, "Errore di allocazione!\n");
+            exit(1);
+        }
+        ch->text = nt;
+        ch->text_cap = cap;
+    }
+    ch->offset[ch->count] = ch->text_len;
+    ch->length[ch->count] = len;
+    memcpy(ch->text + ch->text_len, circ, len);
+    ch->text[ch->text_len + len] = '\0';
+    ch->text_len += len + 1;
+}
+
+int run_batch(const Options *opt) {
+    FILE *in = open_input(opt->input);
+    if(!in)
+        return 1;
+    // L'output è leggibile da macchina: sempre il punto come separatore decimale
+    setlocale(LC_NUMERIC, "C");
+    static char out_buf[1 << 16];
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+
+    if(!opt->json)
+        fputs("line,status,unknowns,req_known,req,rx,i,v\n", stdout);
+
+    WorkPool pool;
+    pool_init(&pool, opt->threads > 0 ? opt->threads : online_cpus());
+    BatchWorker *workers = calloc(pool.nthreads, sizeof(BatchWorker));
+    BatchChunk *chunk = calloc(1, sizeof(BatchChunk));
+    if(!workers || !chunk) {
+        fprintf(stderr, "Errore di allocazione!\n");
+        exit(1);
+    }
+    SubCache *cache = opt->cache_entries ? cache_create(opt->cache_entries) : NULL;
+    for(int w = 0; w < pool.nthreads; w++) {
+        workers[w].ctx = context_create(opt->stats);
+        workers[w].ctx->topology_only = 1;
+        workers[w].ctx->cache = cache;
+    }
+    BatchJob job = { chunk, workers, 0 };
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    long line_no = 0, records = 0, errors = 0;
+    ssize_t n;
+    int eof = 0;
+
+    while(!eof) {
+        chunk->count = 0;
+        chunk->text_len = 0;
+        int huge = 0;
+        while(chunk->count < BATCH_CHUNK && chunk->text_len < BATCH_CHUNK_TEXT) {
+            if((n = getline(&line, &line_cap, in)) == -1) {
+                eof = 1;
+                break;
+            }
+            line_no++;
+            char *circ;
+            size_t circ_len;
+            int k = chunk->count;
+            if(!split_record(line, n, &circ, &circ_len, &chunk->req[k], &chunk->I[k], &chunk->V[k]))
+                continue;
+            chunk_append(chunk, circ, circ_len);
+            chunk->result[k].line = line_no;
+            chunk->count++;
+            huge += circ_len >= FORK_MIN_BYTES;
+        }
+        if(chunk->count == 0)
+            continue;
+
+        // Se i circuiti enormi sono meno dei worker, un worker per circuito lascerebbe
+        // fermi gli altri: vengono valutati dopo, uno alla volta, con tutto il pool
+        job.defer = huge > 0 && huge < pool.nthreads;
+        pool_run(&pool, chunk->count, batch_task, &job);
+        if(job.defer) {
+            job.defer = 0;
+            workers[0].ctx->pool = &pool;
+            for(int k = 0; k < chunk->count; k++)
+                if(!chunk->result[k].status)
+                    batch_task(&job, 0, k);
+            workers[0].ctx->pool = NULL;
+        }
+
+        for(int k = 0; k < chunk->count; k++) {
+            write_result(stdout, &chunk->result[k], opt->json);
+            if(strcmp(chunk->result[k].status, "ok") != 0)
+                errors++;
+        }
+        records += chunk->count;
+    }
+
+    fflush(stdout);
+    size_t peak = 0;
+    int peak_nodes = 0;
+    long hits = 0, misses = 0, record_hits = 0, record_misses = 0;
+    for(int w = 0; w < pool.nthreads; w++) {
+        CircuitContext *ctx = workers[w].ctx;
+        // i worker costruiscono solo la topologia: l'arena dei blocchi resta vuota
+        if(topo_bytes(&ctx->topo) > peak) {
+            peak = topo_bytes(&ctx->topo);
+            peak_nodes = ctx->topo.cap;
+        }
+        hits += ctx->cache_hits;
+        misses += ctx->cache_misses;
+        record_hits += ctx->record_hits;
+        record_misses += ctx->record_misses;
+        context_destroy(ctx);
+    }
+    fprintf(stderr, "Batch completato: %ld circuiti, %ld con errori, %d thread.\n",
+            records, errors, pool.nthreads);
+    fprintf(stderr, "Topologia: picco %zu byte per contesto (%d nodi).\n", peak, peak_nodes);
+    if(cache) {
+        fprintf(stderr, "Cache: circuiti %ld riusati su %ld (%.1f%%), sottocircuiti %ld riusati su %ld ricerche (%.1f%%).\n",
+                record_hits, record_hits + record_misses,
+                record_hits + record_misses ? 100.0 * record_hits / (record_hits + record_misses) : 0.0,
+                hits, hits + misses, hits + misses ? 100.0 * hits / (hits + misses) : 0.0);
+        cache_destroy(cache);
+    }
+    pool_destroy(&pool);
+    free(workers);
+    free(chunk->text);
+    free(chunk);
+    free(line);
+    if(in != stdin)
+        fclose(in);
+    return 0;
+}
+
+/* --- VALUTAZIONE IN STREAMING DI CIRCUITI ENORMI --- */
+// Per file di circuiti più grandi della memoria: il testo è letto a blocchi di
+// STREAM_CHUNK byte e passato al parser un pezzo alla volta, e la topologia non viene
+// memorizzata. Ogni gruppo aperto accumula la somma dei figli (valori per la serie,
+// conduttanze per il parallelo) e alla chiusura consegna il proprio valore al gruppo
+// sottostante: la memoria dipende solo dalla profondità di annidamento.
+// I risultati sono identici bit per bit a quelli del batch. Le somme seguono l'ordine
+// di pairwise_sum: somme sequenziali a blocchi di REDUCE_BLOCK addendi, poi i blocchi
+// completati si combinano come le cifre di un contatore binario (level[j] copre 2^j
+// blocchi); alla chiusura i livelli si sommano dal più piccolo, che è proprio l'albero
+// ((b0+b1)+(b2+b3))+... Per Rx i gruppi che contengono la prima incognita tengono una
+// seconda somma in cui quel figlio vale 0, come in topo_mobius, e alla loro chiusura
+// compongono la trasformazione lineare fratta.
+#define STREAM_CHUNK (1 << 20)     // byte letti per volta
+#define STREAM_FIELDS 256          // caratteri conservati dei campi dopo il circuito
+#define FOLD_LEVELS 40             // 2^40 blocchi di figli bastano per qualunque file
+
+typedef struct {
+    double block;                  // somma sequenziale del blocco in corso
+    int in_block;                  // addendi del blocco in corso
+    uint64_t blocks;               // blocchi completati
+    double level[FOLD_LEVELS];
+} FoldSum;
+
+typedef struct {
+    int kind;                      // TOPO_SERIES o TOPO_PAR
+    FoldSum full;                  // come evaluate_topology (incognite a 0)
+    FoldSum off;                   // come topo_mobius: il figlio con l'incognita vale 0
+} FoldFrame;
+
+typedef struct StreamFold {
+    FoldFrame *frames;             // un accumulatore per gruppo aperto
+    int cap;
+    int path;                      // i gruppi [0, path) contengono la prima incognita
+    int max_depth;                 // gruppi aperti al massimo (per il riepilogo)
+    Mobius m;                      // Req(Rx) accumulata lungo il cammino dell'incognita
+    double req;                    // Req_known del circuito, alla chiusura della radice
+} StreamFold;
+
+static void fold_carry(FoldSum *s) {
+    double v = s->block;
+    int j = 0;
+    for(; (s->blocks >> j) & 1; j++)
+        v = s->level[j] + v;
+    s->level[j] = v;
+    s->blocks++;
+    s->in_block = 0;
+}
+
+static inline void fold_add(FoldSum *s, double x) {
+    s->block = s->in_block ? s->block + x : x;
+    if(++s->in_block == REDUCE_BLOCK)
+        fold_carry(s);
+}
+
+static double fold_total(FoldSum *s) {
+    if(s->in_block)
+        fold_carry(s);
+    if(s->blocks == 0)
+        return 0.0;
+    int j = __builtin_ctzll(s->blocks);
+    double v = s->level[j];
+    for(j++; j < FOLD_LEVELS; j++)
+        if((s->blocks >> j) & 1)
+            v = s->level[j] + v;
+    return v;
+}
+
+static void fold_open(Topology *t, int frame, int kind) {
+    StreamFold *s = t->fold;
+    if(frame == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 16;
+        s->frames = xrealloc(s->frames, s->cap * sizeof(FoldFrame));
+    }
+    if(frame == 0) {
+        s->path = 0;
+        s->m = (Mobius){ 1, 0, 0, 1 };
+        s->req = 0;
+    }
+    if(frame + 1 > s->max_depth)
+        s->max_depth = frame + 1;
+    FoldFrame *f = &s->frames[frame];
+    f->kind = kind;
+    f->full.in_block = f->off.in_block = 0;
+    f->full.blocks = f->off.blocks = 0;
+}
+
+static void fold_leaf(Topology *t, int frame, double value, int is_unknown, int elem) {
+    StreamFold *s = t->fold;
+    if(is_unknown && t->n_unknown == 0) {
+        // tutti i gruppi aperti contengono l'incognita: da qui le due somme divergono
+        for(int j = 0; j <= frame; j++)
+            s->frames[j].off = s->frames[j].full;
+        s->path = frame + 1;
+    }
+    // su file enormi i conteggi si fermano a INT_MAX invece di traboccare
+    if(is_unknown && t->n_unknown < INT_MAX)
+        t->n_unknown++;
+    if(elem != ELEM_R && t->n_reactive < INT_MAX)
+        t->n_reactive++;
+    fold_add(&s->frames[frame].full, value);
+    if(frame < s->path)
+        fold_add(&s->frames[frame].off, value);
+}
+
+static void fold_close(Topology *t, int frame) {
+    StreamFold *s = t->fold;
+    FoldFrame *f = &s->frames[frame];
+    double v = fold_total(&f->full);
+    if(f->kind == TOPO_PAR)
+        v = recip_pos(v);
+    int on_path = frame < s->path;
+    if(on_path) {
+        double C = fold_total(&f->off);
+        if(f->kind == TOPO_SERIES) {
+            s->m.a += C * s->m.c;
+            s->m.b += C * s->m.d;
+        } else {
+            s->m.c += C * s->m.a;
+            s->m.d += C * s->m.b;
+        }
+        mobius_normalize(&s->m);
+        s->path = frame;
+    }
+    if(frame == 0) {
+        s->req = v;
+        return;
+    }
+    FoldFrame *p = &s->frames[frame - 1];
+    double c = p->kind == TOPO_PAR ? recip_pos(v) : v;
+    fold_add(&p->full, c);
+    if(frame - 1 < s->path)
+        fold_add(&p->off, on_path ? 0.0 : c);
+}
+
+// Stato di un record letto a pezzi
+typedef struct {
+    long line;
+    ParseCursor pc;
+    size_t len;                    // byte del circuito
+    char head, last, last_text;    // primo e ultimo byte; ultimo prima dei '\r' finali
+    size_t trail_cr;               // '\r' in fondo al circuito
+    char fields[STREAM_FIELDS + 1];
+    size_t fields_len;
+} StreamRecord;
+
+static void stream_feed(CircuitContext *ctx, StreamRecord *rec, const char *p, size_t n) {
+    if(n == 0)
+        return;
+    parse_chunk(ctx, &rec->pc, p, n);
+    if(rec->len == 0)
+        rec->head = p[0];
+    rec->len += n;
+    rec->last = p[n - 1];
+    size_t cr = 0;
+    while(cr < n && p[n - 1 - cr] == '\r')
+        cr++;
+    if(cr < n) {
+        rec->last_text = p[n - 1 - cr];
+        rec->trail_cr = cr;
+    } else {
+        rec->trail_cr += n;
+    }
+}
+
+// Chiude il record come evaluate_record. Senza campi dopo il circuito i '\r' finali
+// vengono tolti come in split_record; una riga di soli '\r' non è un record (0).
+static int stream_finish(CircuitContext *ctx, StreamRecord *rec, BatchResult *r) {
+    topo_end(&ctx->topo);
+    const Topology *t = &ctx->topo;
+    int fields = rec->fields_len > 0;
+    if(!fields && rec->len == rec->trail_cr)
+        return 0;
+    r->line = rec->line;
+    r->status = "ok";
+    r->unknowns = 0;
+    r->req_known = 0;
+    r->req = r->rx = r->I = r->V = -1;
+    size_t len = fields ? rec->len : rec->len - rec->trail_cr;
+    char last = fields ? rec->last : rec->last_text;
+    if(len < 2 || rec->head != '+' || last != '-') {
+        r->status = "bad_format";
+        return 1;
+    }
+    if(t->n_reactive) {
+        r->status = "reactive";
+        return 1;
+    }
+    while(rec->fields_len > 0 && rec->fields[rec->fields_len - 1] == '\r')
+        rec->fields_len--;
+    rec->fields[rec->fields_len] = '\0';
+    char *rest = rec->fields;
+    double Req = next_field(&rest);
+    double I = next_field(&rest);
+    double V = next_field(&rest);
+    RxFlowchart f;
+    if(t->n_unknown == 1)
+        rx_from_mobius(&f, &t->fold->m, t->fold->req);
+    finish_record(r, t->fold->req, t->n_unknown, &f, Req, I, V);
+    return 1;
+}
+
+// Chiude il record in corso e ne scrive il risultato
+static void stream_record_end(CircuitContext *ctx, StreamRecord *rec, int json, long *records, long *errors) {
+    BatchResult r;
+    if(!stream_finish(ctx, rec, &r))
+        return;
+    write_result(stdout, &r, json);
+    *errors += strcmp(r.status, "ok") != 0;
+    (*records)++;
+}
+
+// Ultimo punto del pezzo [from, to) in cui si può tagliare senza spezzare un token
+static size_t stream_cut(const char *buf, size_t from, size_t to) {
+    for(size_t k = to; k > from; k--) {
+        char c = buf[k - 1];
+        if(c == '+' || c == '_' || c == '-' || c == '*' || c == '=')
+            return k;
+    }
+    return from;
+}
+
+int run_stream(const Options *opt) {
+    FILE *in = open_input(opt->input);
+    if(!in)
+        return 1;
+    setlocale(LC_NUMERIC, "C");
+    static char out_buf[1 << 16];
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+    if(!opt->json)
+        fputs("line,status,unknowns,req_known,req,rx,i,v\n", stdout);
+
+    CircuitContext *ctx = context_create(opt->stats);
+    ctx->topology_only = 1;
+    StreamFold fold = {0};
+    ctx->topo.fold = &fold;
+    size_t cap = STREAM_CHUNK, have = 0;
+    char *buf = xrealloc(NULL, cap);
+    enum { AT_LINE, IN_COMMENT, IN_CIRCUIT, IN_FIELDS } state = AT_LINE;
+    StreamRecord rec;
+    long line_no = 1, records = 0, errors = 0;
+    double bytes = 0;
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for(;;) {
+        size_t got = fread(buf + have, 1, cap - have, in);
+        int eof = got < cap - have;
+        size_t end = have + got, i = 0;
+        bytes += got;
+        while(i < end) {
+            if(state == AT_LINE) {
+                char c = buf[i];
+                if(is_field_sep(c)) {
+                    i++;
+                } else if(c == '\n') {
+                    line_no++;
+                    i++;
+                } else if(c == '#') {
+                    state = IN_COMMENT;
+                } else {
+                    reset_circuit(ctx);
+                    parse_begin(ctx, &rec.pc);
+                    rec.line = line_no;
+                    rec.len = rec.trail_cr = rec.fields_len = 0;
+                    rec.head = rec.last = rec.last_text = 0;
+                    state = IN_CIRCUIT;
+                }
+            } else if(state == IN_COMMENT) {
+                const char *nl = memchr(buf + i, '\n', end - i);
+                if(!nl) {
+                    i = end;
+                    break;
+                }
+                i = nl - buf + 1;
+                line_no++;
+                state = AT_LINE;
+            } else if(state == IN_CIRCUIT) {
+                size_t j = i;
+                while(j < end && buf[j] != '\n' && !is_field_sep(buf[j]))
+                    j++;
+                if(j == end) {
+                    // il circuito continua nel prossimo blocco: si passa solo fino all'ultimo
+                    // token sicuramente completo, il resto resta nel buffer
+                    size_t cut = eof ? end : stream_cut(buf, i, end);
+                    stream_feed(ctx, &rec, buf + i, cut - i);
+                    i = cut;
+                    break;
+                }
+                stream_feed(ctx, &rec, buf + i, j - i);
+                i = j;
+                state = IN_FIELDS;
+            } else {
+                const char *nl = memchr(buf + i, '\n', end - i);
+                size_t j = nl ? (size_t)(nl - buf) : end;
+                size_t n = j - i;
+                if(n > STREAM_FIELDS - rec.fields_len)
+                    n = STREAM_FIELDS - rec.fields_len;
+                memcpy(rec.fields + rec.fields_len, buf + i, n);
+                rec.fields_len += n;
+                i = j;
+                if(!nl)
+                    break;
+                stream_record_end(ctx, &rec, opt->json, &records, &errors);
+                i++;
+                line_no++;
+                state = AT_LINE;
+            }
+        }
+        if(eof)
+            break;
+        // I byte non consumati (un token a cavallo dei blocchi) passano in testa al buffer
+        have = end - i;
+        memmove(buf, buf + i, have);
+        if(have == cap) {
+            cap *= 2;
+            buf = xrealloc(buf, cap);
+        }
+    }
+    if(state == IN_CIRCUIT || state == IN_FIELDS)
+        stream_record_end(ctx, &rec, opt->json, &records, &errors);
+
+    fflush(stdout);
+    double secs = elapsed_since(&t0);
+    fprintf(stderr, "Streaming completato: %ld circuiti, %ld con errori, %.1f MB in %.3g s (%.0f MB/s), "
+            "annidamento massimo %d gruppi.\n", records, errors, bytes / 1e6, secs,
+            secs > 0 ? bytes / 1e6 / secs : 0.0, fold.max_depth);
+    ctx->topo.fold = NULL;
+    free(fold.frames);
+    free(buf);
+    context_destroy(ctx);
+    if(in != stdin)
+        fclose(in);
+    return 0;
+}
+
+/* --- CIRCUITI PRECOMPILATI --- */
+// --compile analizza una volta i record del batch e scrive la loro topologia in un file
+// binario; --run-compiled lo mappa in memoria con mmap e valuta i circuiti sul posto,
+// senza parsing né copie: per ogni circuito una Topology punta direttamente nel file.
+// Il file non contiene puntatori, solo offset dall'inizio, quindi è indipendente dalla
+// posizione in cui viene mappato. Struttura (ogni sezione allineata a 8 byte):
+//   CompiledHeader
+//   CompiledCircuit[n_circuits]   directory: nodi, incognite, misure del record
+//   double   value[n_nodes]       tabella dei valori (0 per incognite e gruppi)
+//   uint64_t unknown[n_words]     indice delle incognite: una bitmask per circuito
+//   int32_t  start[n_nodes]       primo nodo del sottoalbero, relativo al circuito
+//   int32_t  nchild[n_nodes]
+//   uint8_t  kind[n_nodes]        TopoKind
+// Il file usa l'ordine dei byte della macchina che lo ha scritto; byte_order permette
+// di rifiutare un file prodotto su un'architettura diversa.
+#define COMPILED_MAGIC "CRCTBIN"
+#define COMPILED_VERSION 1
+#define COMPILED_BYTE_ORDER 0x01020304u
+#define COMPILED_BAD_FORMAT 1u          // il record non era un circuito valido
+#define COMPILED_REACTIVE 2u            // il circuito contiene condensatori o induttori
+
+_Static_assert(sizeof(int) == 4, "la topologia compilata usa int a 32 bit");
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t n_circuits, n_nodes, n_words;
+    uint64_t off_circuits, off_value, off_unknown, off_start, off_nchild, off_kind;
+    uint64_t file_size;
+} CompiledHeader;
+
+typedef struct {
+    uint64_t first_node;        // primo nodo nelle tabelle
+    uint64_t first_word;        // prima parola della bitmask delle incognite
+    uint32_t n_nodes;
+    uint32_t n_unknown;
+    uint32_t max_stack;
+    uint32_t flags;
+    int64_t line;               // riga del record nel file sorgente
+    double req, I, V;           // misure del record (-1 se assenti)
+} CompiledCircuit;
+
+// Tabelle in costruzione durante --compile
+typedef struct {
+    CompiledCircuit *circuits;
+    size_t n_circuits, circuits_cap;
+    double *value;
+    int32_t *start, *nchild;
+    uint8_t *kind;
+    size_t n_nodes, nodes_cap;
+    uint64_t *unknown;
+    size_t n_words, words_cap;
+} CompiledBuilder;
+
+static void compiled_add(CompiledBuilder *b, const Topology *t, const CompiledCircuit *hdr) {
+    if(b->n_circuits == b->circuits_cap) {
+        b->circuits_cap = b->circuits_cap ? b->circuits_cap * 2 : 1024;
+        b->circuits = xrealloc(b->circuits, b->circuits_cap * sizeof(CompiledCircuit));
+    }
+    CompiledCircuit *c = &b->circuits[b->n_circuits++];
+    *c = *hdr;
+    c->first_node = b->n_nodes;
+    c->first_word = b->n_words;
+    if(!t)
+        return;
+    size_t n = t->n, words = (n + 63) / 64;
+    if(b->n_nodes + n > b->nodes_cap) {
+        while(b->n_nodes + n > b->nodes_cap)
+            b->nodes_cap = b->nodes_cap ? b->nodes_cap * 2 : 65536;
+        b->value = xrealloc(b->value, b->nodes_cap * sizeof(double));
+        b->start = xrealloc(b->start, b->nodes_cap * sizeof(int32_t));
+        b->nchild = xrealloc(b->nchild, b->nodes_cap * sizeof(int32_t));
+        b->kind = xrealloc(b->kind, b->nodes_cap);
+    }
+    if(b->n_words + words > b->words_cap) {
+        while(b->n_words + words > b->words_cap)
+            b->words_cap = b->words_cap ? b->words_cap * 2 : 4096;
+        b->unknown = xrealloc(b->unknown, b->words_cap * sizeof(uint64_t));
+    }
+    memcpy(b->value + b->n_nodes, t->value, n * sizeof(double));
+    memcpy(b->start + b->n_nodes, t->start, n * sizeof(int32_t));
+    memcpy(b->nchild + b->n_nodes, t->nchild, n * sizeof(int32_t));
+    memcpy(b->kind + b->n_nodes, t->kind, n);
+    memcpy(b->unknown + b->n_words, t->unknown, words * sizeof(uint64_t));
+    c->n_nodes = n;
+    c->n_unknown = t->n_unknown;
+    c->max_stack = t->max_stack;
+    b->n_nodes += n;
+    b->n_words += words;
+}
+
+static uint64_t align8(uint64_t x) {
+    return (x + 7) & ~(uint64_t)7;
+}
+
+// Scrive una sezione seguita dal riempimento fino al prossimo multiplo di 8
+static int write_section(FILE *out, const void *data, size_t bytes) {
+    static const char zeros[8] = { 0 };
+    if(bytes && fwrite(data, 1, bytes, out) != bytes)
+        return 0;
+    size_t pad = align8(bytes) - bytes;
+    return fwrite(zeros, 1, pad, out) == pad;
+}
+
+int run_compile(const Options *opt) {
+    FILE *in = open_input(opt->input);
+    if(!in)
+        return 1;
+    CircuitContext *ctx = context_create(opt->stats);
+    ctx->topology_only = 1;
+    CompiledBuilder b = { 0 };
+    char *line = NULL;
+    size_t line_cap = 0;
+    long line_no = 0, bad = 0;
+    ssize_t n;
+
+    while((n = getline(&line, &line_cap, in)) != -1) {
+        line_no++;
+        char *circ;
+        size_t circ_len;
+        CompiledCircuit hdr = { 0 };
+        hdr.line = line_no;
+        if(!split_record(line, n, &circ, &circ_len, &hdr.req, &hdr.I, &hdr.V))
+            continue;
+        if(!circuit_framed(circ, circ_len)) {
+            hdr.flags = COMPILED_BAD_FORMAT;
+            compiled_add(&b, NULL, &hdr);
+            bad++;
+            continue;
+        }
+        reset_circuit(ctx);
+        parse_circuit_utf8(ctx, circ, circ_len);
+        if(ctx->topo.n_reactive) {
+            hdr.flags = COMPILED_REACTIVE;
+            compiled_add(&b, NULL, &hdr);
+            bad++;
+            continue;
+        }
+        compiled_add(&b, &ctx->topo, &hdr);
+    }
+
+    CompiledHeader h = { COMPILED_MAGIC, COMPILED_VERSION, COMPILED_BYTE_ORDER,
+                         b.n_circuits, b.n_nodes, b.n_words, 0, 0, 0, 0, 0, 0, 0 };
+    h.off_circuits = align8(sizeof(CompiledHeader));
+    h.off_value = h.off_circuits + align8(b.n_circuits * sizeof(CompiledCircuit));
+    h.off_unknown = h.off_value + align8(b.n_nodes * sizeof(double));
+    h.off_start = h.off_unknown + align8(b.n_words * sizeof(uint64_t));
+    h.off_nchild = h.off_start + align8(b.n_nodes * sizeof(int32_t));
+    h.off_kind = h.off_nchild + align8(b.n_nodes * sizeof(int32_t));
+    h.file_size = h.off_kind + align8(b.n_nodes);
+
+    int status = 0;
+    FILE *out = fopen(opt->compile, "wb");
+    if(!out ||
+       !write_section(out, &h, sizeof(h)) ||
+       !write_section(out, b.circuits, b.n_circuits * sizeof(CompiledCircuit)) ||
+       !write_section(out, b.value, b.n_nodes * sizeof(double)) ||
+       !write_section(out, b.unknown, b.n_words * sizeof(uint64_t)) ||
+       !write_section(out, b.start, b.n_nodes * sizeof(int32_t)) ||
+       !write_section(out, b.nchild, b.n_nodes * sizeof(int32_t)) ||
+       !write_section(out, b.kind, b.n_nodes) ||
+       fclose(out) != 0) {
+        fprintf(stderr, "Errore: impossibile scrivere %s\n", opt->compile);
+        status = 1;
+    } else {
+        fprintf(stderr, "Compilati %zu circuiti (%ld non validi), %zu nodi, %llu byte in %s.\n",
+                b.n_circuits, bad, b.n_nodes, (unsigned long long)h.file_size, opt->compile);
+    }
+
+    free(b.circuits);
+    free(b.value);
+    free(b.start);
+    free(b.nchild);
+    free(b.kind);
+    free(b.unknown);
+    free(line);
+    context_destroy(ctx);
+    if(in != stdin)
+        fclose(in);
+    return status;
+}
+
+// File mappato e tabelle già risolte
+typedef struct {
+    const CompiledHeader *h;
+    const CompiledCircuit *circuits;
+    const double *value;
+    const uint64_t *unknown;
+    const int32_t *start, *nchild;
+    const uint8_t *kind;
+    size_t size;
+} CompiledFile;
+
+// Controlla l'intestazione e che ogni sezione stia nel file; restituisce un messaggio
+// d'errore o NULL
+static const char *compiled_open(const void *base, size_t size, CompiledFile *f) {
+    const CompiledHeader *h = base;
+    if(size < sizeof(CompiledHeader) || memcmp(h->magic, COMPILED_MAGIC, 8) != 0)
+        return "non è un file di circuiti compilati";
+    if(h->byte_order != COMPILED_BYTE_ORDER)
+        return "file compilato su un'architettura con diverso ordine dei byte";
+    if(h->version != COMPILED_VERSION)
+        return "versione del formato non supportata (ricompilare)";
+    if(h->file_size != size)
+        return "file troncato";
+    // n * dimensione non deve traboccare e ogni sezione deve finire prima della successiva
+    if(h->n_circuits > size / sizeof(CompiledCircuit) || h->n_nodes > size || h->n_words > size / 8 ||
+       h->off_circuits + h->n_circuits * sizeof(CompiledCircuit) > h->off_value ||
+       h->off_value + h->n_nodes * sizeof(double) > h->off_unknown ||
+       h->off_unknown + h->n_words * sizeof(uint64_t) > h->off_start ||
+       h->off_start + h->n_nodes * sizeof(int32_t) > h->off_nchild ||
+       h->off_nchild + h->n_nodes * sizeof(int32_t) > h->off_kind ||
+       h->off_kind + h->n_nodes > size ||
+       h->off_circuits < sizeof(CompiledHeader) || h->off_value < h->off_circuits ||
+       ((h->off_circuits | h->off_value | h->off_unknown | h->off_start | h->off_nchild) & 7))
+        return "sezioni non valide";
+    const char *p = base;
+    f->h = h;
+    f->circuits = (const CompiledCircuit *)(p + h->off_circuits);
+    f->value = (const double *)(p + h->off_value);
+    f->unknown = (const uint64_t *)(p + h->off_unknown);
+    f->start = (const int32_t *)(p + h->off_start);
+    f->nchild = (const int32_t *)(p + h->off_nchild);
+    f->kind = (const uint8_t *)(p + h->off_kind);
+    f->size = size;
+    return NULL;
+}
+
+// Prepara una Topology che punta nel file; restituisce 0 se il circuito è corrotto.
+// La verifica simula lo stack di valutazione, così un file danneggiato non può far
+// leggere o scrivere fuori dagli array.
+static int compiled_view(const CompiledFile *f, const CompiledCircuit *c, Topology *t) {
+    if(c->first_node > f->h->n_nodes || c->n_nodes > f->h->n_nodes - c->first_node ||
+       c->first_word > f->h->n_words || (c->n_nodes + 63) / 64 > f->h->n_words - c->first_word)
+        return 0;
+    memset(t, 0, sizeof(*t));
+    t->n = c->n_nodes;
+    t->kind = (unsigned char *)(f->kind + c->first_node);
+    t->value = (double *)(f->value + c->first_node);
+    t->nchild = (int *)(f->nchild + c->first_node);
+    t->start = (int *)(f->start + c->first_node);
+    t->unknown = (uint64_t *)(f->unknown + c->first_word);
+    t->n_unknown = c->n_unknown;
+    t->max_stack = c->max_stack;
+    long sp = 0;
+    int unknowns = 0;
+    for(int i = 0; i < t->n; i++) {
+        int k = t->nchild[i];
+        if(t->kind[i] > TOPO_PAR || t->start[i] < 0 || t->start[i] > i || k < 0 || k > sp ||
+           (t->kind[i] == TOPO_RES && k != 0))
+            return 0;
+        if(t->kind[i] == TOPO_RES)
+            unknowns += TOPO_IS_UNKNOWN(t, i);
+        sp += 1 - k;
+        if(sp > (long)c->max_stack)
+            return 0;
+    }
+    return (t->n == 0 || sp == 1) && unknowns == (int)c->n_unknown;
+}
+
+typedef struct {
+    const CompiledFile *file;
+    BatchResult *result;
+    double **stack;             // stack di valutazione per worker
+    int *stack_cap;
+    Stats **stats;
+} CompiledJob;
+
+static void compiled_task(void *arg, int worker, long i) {
+    CompiledJob *job = arg;
+    const CompiledCircuit *c = &job->file->circuits[i];
+    BatchResult *r = &job->result[i];
+    r->line = c->line;
+    r->status = "ok";
+    r->unknowns = 0;
+    r->req_known = 0;
+    r->req = r->rx = r->I = r->V = -1;
+    if(c->flags & COMPILED_BAD_FORMAT) {
+        r->status = "bad_format";
+        return;
+    }
+    if(c->flags & COMPILED_REACTIVE) {
+        r->status = "reactive";
+        return;
+    }
+    Topology t;
+    if(!compiled_view(job->file, c, &t)) {
+        r->status = "bad_file";
+        return;
+    }
+    if((int)c->max_stack + 1 > job->stack_cap[worker]) {
+        job->stack_cap[worker] = c->max_stack + 1;
+        job->stack[worker] = xrealloc(job->stack[worker], job->stack_cap[worker] * sizeof(double));
+    }
+    double *stack = job->stack[worker];
+    Stats *st = job->stats[worker];
+    struct timespec t0;
+    stats_start(st, &t0);
+    double Req_known = evaluate_topology(&t, stack);
+    stats_stop(st, PHASE_EVALUATE, &t0);
+    RxFlowchart f;
+    if(t.n_unknown == 1) {
+        Mobius m;
+        stats_start(st, &t0);
+        topo_mobius(&t, NULL, 0, stack, &m);
+        rx_from_mobius(&f, &m, Req_known);
+        stats_stop(st, PHASE_SOLVE, &t0);
+    }
+    finish_record(r, Req_known, t.n_unknown, &f, c->req, c->I, c->V);
+}
+
+#define COMPILED_CHUNK 65536
+
+int run_compiled(const Options *opt) {
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int fd = open(opt->run_compiled, O_RDONLY);
+    struct stat sb;
+    if(fd < 0 || fstat(fd, &sb) != 0) {
+        fprintf(stderr, "Errore: impossibile aprire %s\n", opt->run_compiled);
+        if(fd >= 0)
+            close(fd);
+        return 1;
+    }
+    size_t size = sb.st_size;
+    void *base = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    CompiledFile file;
+    const char *err = base == MAP_FAILED ? "impossibile mappare il file" : compiled_open(base, size, &file);
+    if(err) {
+        fprintf(stderr, "Errore: %s: %s.\n", opt->run_compiled, err);
+        if(base != MAP_FAILED)
+            munmap(base, size);
+        return 1;
+    }
+    double open_time = elapsed_since(&t0);
+
+    setlocale(LC_NUMERIC, "C");
+    static char out_buf[1 << 16];
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+    if(!opt->json)
+        fputs("line,status,unknowns,req_known,req,rx,i,v\n", stdout);
+
+    WorkPool pool;
+    pool_init(&pool, opt->threads > 0 ? opt->threads : online_cpus());
+    BatchResult *result = malloc(COMPILED_CHUNK * sizeof(BatchResult));
+    double **stacks = calloc(pool.nthreads, sizeof(double *));
+    int *stack_cap = calloc(pool.nthreads, sizeof(int));
+    Stats **stats = calloc(pool.nthreads, sizeof(Stats *));
+    if(!result || !stacks || !stack_cap || !stats) {
+        fprintf(stderr, "Errore di allocazione!\n");
+        exit(1);
+    }
+    for(int w = 0; w < pool.nthreads; w++)
+        stats[w] = opt->stats ? stats_create(opt->stats) : NULL;
+
+    long errors = 0;
+    uint64_t n = file.h->n_circuits;
+    for(uint64_t first = 0; first < n; first += COMPILED_CHUNK) {
+        long count = n - first < COMPILED_CHUNK ? (long)(n - first) : COMPILED_CHUNK;
+        CompiledFile part = file;
+        part.circuits = file.circuits + first;
+        CompiledJob job = { &part, result, stacks, stack_cap, stats };
+        pool_run(&pool, count, compiled_task, &job);
+        for(long k = 0; k < count; k++) {
+            write_result(stdout, &result[k], opt->json);
+            if(strcmp(result[k].status, "ok") != 0)
+                errors++;
+        }
+    }
+    fflush(stdout);
+    fprintf(stderr, "Compilato: %llu circuiti, %ld con errori, %d thread, apertura %.3g s, totale %.3g s.\n",
+            (unsigned long long)n, errors, pool.nthreads, open_time, elapsed_since(&t0));
+
+    for(int w = 0; w < pool.nthreads; w++) {
+        free(stacks[w]);
+        stats_release(stats[w]);
+    }
+    pool_destroy(&pool);
+    free(stacks);
+    free(stack_cap);
+    free(stats);
+    free(result);
+    munmap(base, size);
+    return 0;
+}
+
+/* --- SERVER SU SOCKET UNIX --- */
+// --serve PATH resta in ascolto su un socket Unix e risponde a richieste in pipeline, senza
+// pagare a ogni chiamata l'avvio del processo e il protocollo interattivo. Ogni riga di
+// richiesta è un record come nel batch (circuito [Req [I [V]]]); le righe vuote e i
+// commenti non hanno risposta. Ogni risposta è una riga nello stesso ordine delle richieste:
+//   stato incognite Req_known Req Rx I V
+// con "-" al posto dei valori non disponibili. Un solo thread serve tutti i client con
+// epoll; --client PATH [FILE] invia i record di un file e stampa le risposte.
+#define SERVE_MAX_CLIENTS 1024
+#define SERVE_MAX_LINE (16 << 20)       // una richiesta più lunga chiude la connessione
+#define SERVE_OUT_HIGH (1 << 20)        // oltre questa coda di uscita si smette di leggere
+#define SERVE_READ 65536
+
+typedef struct {
+    int fd;
+    char *in;                   // byte ricevuti non ancora elaborati
+    size_t in_len, in_cap;
+    char *out;                  // risposte non ancora inviate
+    size_t out_len, out_off, out_cap;
+    int eof;                    // il client ha chiuso il suo lato in scrittura
+} ServeClient;
+
+static void put_field(char **p, double v, int available) {
+    if(available)
+        *p += sprintf(*p, " %.10g", v);
+    else
+        *p += sprintf(*p, " -");
+}
+
+// Accoda la risposta a un record; la riga più lunga possibile sta in 256 byte
+static void serve_reply(ServeClient *c, const BatchResult *r) {
+    if(c->out_len + 256 > c->out_cap) {
+        c->out_cap = (c->out_len + 256) * 2;
+        c->out = xrealloc(c->out, c->out_cap);
+    }
+    char *p = c->out + c->out_len;
+    p += sprintf(p, "%s %d", r->status, r->unknowns);
+    put_field(&p, r->req_known, 1);
+    put_field(&p, r->req, r->req > 0);
+    put_field(&p, r->rx, r->rx > 0);
+    put_field(&p, r->I, r->I > 0);
+    put_field(&p, r->V, r->V > 0);
+    *p++ = '\n';
+    c->out_len = p - c->out;
+}
+
+// Elabora le righe complete del buffer d'ingresso (anche l'ultima incompleta dopo EOF)
+static void serve_process(CircuitContext *ctx, ServeClient *c, long *requests) {
+    size_t pos = 0;
+    while(pos < c->in_len) {
+        char *line = c->in + pos;
+        char *nl = memchr(line, '\n', c->in_len - pos);
+        if(!nl && !c->eof)
+            break;
+        size_t n = nl ? (size_t)(nl - line) + 1 : c->in_len - pos;
+        pos += n;
+        // la riga finisce con '\n' oppure, all'EOF, alla fine del buffer (c'è sempre un
+        // byte libero per il terminatore)
+        line[n - (nl != NULL)] = '\0';
+        char *circ;
+        size_t circ_len;
+        BatchResult r;
+        if(!split_record(line, n - (nl != NULL), &circ, &circ_len, &r.req, &r.I, &r.V))
+            continue;
+        double Req = r.req, I = r.I, V = r.V;
+        evaluate_record(ctx, circ, circ_len, Req, I, V, &r);
+        serve_reply(c, &r);
+        (*requests)++;
+    }
+    memmove(c->in, c->in + pos, c->in_len - pos);
+    c->in_len -= pos;
+}
+
+// Invia quanto possibile della coda di uscita; -1 se la connessione è caduta
+static int serve_flush(ServeClient *c) {
+    while(c->out_off < c->out_len) {
+        ssize_t w = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+        if(w < 0)
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        c->out_off += w;
+    }
+    c->out_off = c->out_len = 0;
+    return 0;
+}
+
+// Legge tutto ciò che è disponibile; -1 se la connessione è caduta o la riga è troppo lunga
+static int serve_read(ServeClient *c) {
+    for(;;) {
+        if(c->in_len + SERVE_READ + 1 > c->in_cap) {
+            if(c->in_len > SERVE_MAX_LINE)
+                return -1;
+            c->in_cap = (c->in_len + SERVE_READ + 1) * 2;
+            c->in = xrealloc(c->in, c->in_cap);
+        }
+        ssize_t r = recv(c->fd, c->in + c->in_len, c->in_cap - c->in_len - 1, 0);
+        if(r > 0) {
+            c->in_len += r;
+            // con una coda di uscita lunga si lascia che sia il client ad aspettare
+            if(c->in_len >= SERVE_READ)
+                return 0;
+            continue;
+        }
+        if(r == 0) {
+            c->eof = 1;
+            return 0;
+        }
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+}
+
+static int unix_address(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "Errore: percorso del socket troppo lungo: %s\n", path);
+        return 0;
+    }
+    strcpy(addr->sun_path, path);
+    return 1;
+}
+
+#ifdef __linux__
+#include <sys/epoll.h>
+
+static volatile sig_atomic_t serve_stop;
+
+static void serve_signal(int sig) {
+    (void)sig;
+    serve_stop = 1;
+}
+
+static void serve_close(int ep, ServeClient *c) {
+    epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c->in);
+    free(c->out);
+    free(c);
+}
+
+int run_serve(const Options *opt) {
+    struct sockaddr_un addr;
+    if(!unix_address(opt->serve, &addr))
+        return 1;
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    unlink(opt->serve); // un socket rimasto da un server precedente
+    if(lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(lfd, 128) != 0) {
+        fprintf(stderr, "Errore: impossibile ascoltare su %s: %s\n", opt->serve, strerror(errno));
+        if(lfd >= 0)
+            close(lfd);
+        return 1;
+    }
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(ep, EPOLL_CTL_ADD, lfd, &ev);
+
+    // SIGINT e SIGTERM interrompono epoll_wait e chiudono il server in modo ordinato
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = serve_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    setlocale(LC_NUMERIC, "C");
+    CircuitContext *ctx = context_create(opt->stats);
+    ctx->topology_only = 1;
+    SubCache *cache = opt->cache_entries ? cache_create(opt->cache_entries) : NULL;
+    ctx->cache = cache;
+    long requests = 0, connections = 0;
+    int clients = 0;
+    fprintf(stderr, "In ascolto su %s (Ctrl+C per terminare).\n", opt->serve);
+
+    struct epoll_event events[64];
+    while(!serve_stop) {
+        int ne = epoll_wait(ep, events, 64, -1);
+        if(ne < 0) {
+            if(errno == EINTR)
+                continue;
+            fprintf(stderr, "Errore: epoll_wait: %s\n", strerror(errno));
+            break;
+        }
+        for(int k = 0; k < ne; k++) {
+            ServeClient *c = events[k].data.ptr;
+            if(!c) {
+                int fd;
+                while((fd = accept(lfd, NULL, NULL)) >= 0) {
+                    if(clients >= SERVE_MAX_CLIENTS) {
+                        close(fd);
+                        continue;
+                    }
+                    fcntl(fd, F_SETFL, O_NONBLOCK);
+                    fcntl(fd, F_SETFD, FD_CLOEXEC);
+                    c = calloc(1, sizeof(ServeClient));
+                    if(!c) {
+                        fprintf(stderr, "Errore di allocazione!\n");
+                        exit(1);
+                    }
+                    c->fd = fd;
+                    struct epoll_event cev = { .events = EPOLLIN, .data.ptr = c };
+                    epoll_ctl(ep, EPOLL_CTL_ADD, fd, &cev);
+                    clients++;
+                    connections++;
+                }
+                continue;
+            }
+
+            int fail = 0;
+            if((events[k].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !c->eof && c->out_len < SERVE_OUT_HIGH) {
+                fail = serve_read(c) < 0;
+                if(!fail)
+                    serve_process(ctx, c, &requests);
+            }
+            if(!fail)
+                fail = serve_flush(c) < 0;
+            // chiusura dopo aver risposto a tutto ciò che il client ha inviato
+            if(fail || (c->eof && c->out_len == 0)) {
+                serve_close(ep, c);
+                clients--;
+                continue;
+            }
+            // con risposte in coda si attende EPOLLOUT; con la coda piena si smette di leggere
+            struct epoll_event cev = { .events = 0, .data.ptr = c };
+            if(c->out_len)
+                cev.events |= EPOLLOUT;
+            if(!c->eof && c->out_len < SERVE_OUT_HIGH)
+                cev.events |= EPOLLIN;
+            epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &cev);
+        }
+    }
+
+    // i client ancora connessi sono abbandonati: il processo sta per terminare
+    fprintf(stderr, "\nServer terminato: %ld connessioni, %ld richieste.\n", connections, requests);
+    close(ep);
+    close(lfd);
+    unlink(opt->serve);
+    context_destroy(ctx);
+    if(cache)
+        cache_destroy(cache);
+    return 0;
+}
+#else
+int run_serve(const Options *opt) {
+    (void)opt;
+    fprintf(stderr, "Errore: --serve richiede Linux (epoll).\n");
+    return 1;
+}
+#endif
+
+// Invia i record di un file al server e stampa le risposte. Invio e ricezione procedono
+// insieme con poll, così le richieste restano in pipeline senza che nessuno dei due lati
+// si blocchi con i buffer del socket pieni.
+int run_client(const Options *opt) {
+    FILE *in = open_input(opt->input);
+    if(!in)
+        return 1;
+    struct sockaddr_un addr;
+    if(!unix_address(opt->client, &addr))
+        return 1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Errore: impossibile connettersi a %s: %s\n", opt->client, strerror(errno));
+        if(fd >= 0)
+            close(fd);
+        return 1;
+    }
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    static char send_buf[SERVE_READ], recv_buf[SERVE_READ];
+    size_t send_len = 0, send_off = 0;
+    int in_eof = 0, status = 0;
+    long replies = 0;
+
+    for(;;) {
+        if(send_off == send_len && !in_eof) {
+            send_off = 0;
+            send_len = fread(send_buf, 1, sizeof(send_buf), in);
+            if(send_len == 0) {
+                in_eof = 1;
+                shutdown(fd, SHUT_WR); // il server risponde al resto e poi chiude
+            }
+        }
+        struct pollfd p = { fd, POLLIN, 0 };
+        if(send_off < send_len)
+            p.events |= POLLOUT;
+        if(poll(&p, 1, -1) < 0) {
+            if(errno == EINTR)
+                continue;
+            status = 1;
+            break;
+        }
+        if(p.revents & POLLOUT) {
+            ssize_t w = send(fd, send_buf + send_off, send_len - send_off, MSG_NOSIGNAL);
+            if(w < 0) {
+                fprintf(stderr, "Errore: invio al server: %s\n", strerror(errno));
+                status = 1;
+                break;
+            }
+            send_off += w;
+        }
+        if(p.revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t r = recv(fd, recv_buf, sizeof(recv_buf), 0);
+            if(r <= 0) {
+                if(r < 0 || !in_eof) {
+                    fprintf(stderr, "Errore: connessione chiusa dal server.\n");
+                    status = 1;
+                }
+                break;
+            }
+            for(ssize_t k = 0; k < r; k++)
+                replies += recv_buf[k] == '\n';
+            fwrite(recv_buf, 1, r, stdout);
+        }
+    }
+    fflush(stdout);
+    fprintf(stderr, "Client: %ld risposte in %.3g s.\n", replies, elapsed_since(&t0));
+    close(fd);
+    if(in != stdin)
+        fclose(in);
+    return status;
+}
+
+/* --- VETTORI SIMD --- */
+// Operazioni su più campioni contemporaneamente (una corsia per campione).
+// Con AVX si lavora a 4 double per istruzione, con SSE2 a 2, altrimenti uno alla volta.
+#if defined(__AVX__)
+#include <immintrin.h>
+#define VLANES 4
+typedef __m256d vdouble;
+#define v_load(p)      _mm256_loadu_pd(p)
+#define v_store(p, x)  _mm256_storeu_pd(p, x)
+#define v_set1(x)      _mm256_set1_pd(x)
+#define v_add(a, b)    _mm256_add_pd(a, b)
+#define v_sub(a, b)    _mm256_sub_pd(a, b)
+#define v_mul(a, b)    _mm256_mul_pd(a, b)
+#define v_div(a, b)    _mm256_div_pd(a, b)
+#define v_and(a, b)    _mm256_and_pd(a, b)
+#define v_gt(a, b)     _mm256_cmp_pd(a, b, _CMP_GT_OQ)
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define VLANES 2
+typedef __m128d vdouble;
+#define v_load(p)      _mm_loadu_pd(p)
+#define v_store(p, x)  _mm_storeu_pd(p, x)
+#define v_set1(x)      _mm_set1_pd(x)
+#define v_add(a, b)    _mm_add_pd(a, b)
+#define v_sub(a, b)    _mm_sub_pd(a, b)
+#define v_mul(a, b)    _mm_mul_pd(a, b)
+#define v_div(a, b)    _mm_div_pd(a, b)
+#define v_and(a, b)    _mm_and_pd(a, b)
+#define v_gt(a, b)     _mm_cmpgt_pd(a, b)
+#else
+#define VLANES 1
+typedef double vdouble;
+#define v_load(p)      (*(p))
+#define v_store(p, x)  (*(p) = (x))
+#define v_set1(x)      (x)
+#define v_add(a, b)    ((a) + (b))
+#define v_sub(a, b)    ((a) - (b))
+#define v_mul(a, b)    ((a) * (b))
+#define v_div(a, b)    ((a) / (b))
+#endif
+
+// 1/x sulle corsie con x > 0, 0 altrove (rami ignorati come in evaluate_topology)
+static inline vdouble v_recip_pos(vdouble x) {
+#if VLANES > 1
+    vdouble zero = v_set1(0.0);
+    return v_and(v_gt(x, zero), v_div(v_set1(1.0), x));
+#else
+    return x > 0 ? 1.0 / x : 0.0;
+#endif
+}
+
+// 1/(re + j im) sulle corsie con modulo non nullo, 0 altrove (come v_recip_pos)
+static inline void v_crecip(vdouble *re, vdouble *im) {
+    vdouble inv = v_recip_pos(v_add(v_mul(*re, *re), v_mul(*im, *im)));
+    *re = v_mul(*re, inv);
+    *im = v_sub(v_set1(0.0), v_mul(*im, inv));
+}
+
+/* --- ANALISI MONTE CARLO DELLE TOLLERANZE --- */
+// Il circuito viene analizzato una sola volta; la topologia è poi valutata su N vettori di
+// valori estratti a caso entro la tolleranza. I campioni sono elaborati a blocchi di
+// MC_BLOCK: ogni slot dello stack di valutazione contiene un valore per campione del
+// blocco e le serie/paralleli sono calcolati sulle corsie SIMD.
+#define MC_BLOCK 256
+#define TWO_PI 6.283185307179586
+
+// Generatore xoshiro256+ (veloce, sufficiente per il campionamento)
+typedef struct {
+    uint64_t s[4];
+} Rng;
+
+static inline uint64_t rotl64(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t rng_next(Rng *r) {
+    uint64_t *s = r->s;
+    uint64_t result = s[0] + s[3];
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl64(s[3], 45);
+    return result;
+}
+
+// Numero uniforme in [0, 1)
+static inline double rng_uniform(Rng *r) {
+    return (rng_next(r) >> 11) * 0x1.0p-53;
+}
+
+void rng_seed(Rng *r, uint64_t seed) {
+    for(int i = 0; i < 4; i++) {
+        // splitmix64
+        uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        r->s[i] = z ^ (z >> 31);
+    }
+}
+
+// Riempie "out" con n valori della resistenza nominale v entro la tolleranza
+static void mc_sample(double *out, int n, double v, const Options *opt, Rng *rng) {
+    double tol = opt->tolerance;
+    if(!opt->gaussian) {
+        for(int l = 0; l < n; l++)
+            out[l] = v * (1.0 + tol * (2.0 * rng_uniform(rng) - 1.0));
+        return;
+    }
+    // Box-Muller, sigma = tol/3 e troncamento a +-tol
+    for(int l = 0; l < n; l += 2) {
+        double u1 = 1.0 - rng_uniform(rng);
+        double u2 = rng_uniform(rng);
+        double rad = sqrt(-2.0 * log(u1));
+        double z[2] = { rad * cos(TWO_PI * u2), rad * sin(TWO_PI * u2) };
+        for(int j = 0; j < 2 && l + j < n; j++) {
+            double d = tol / 3.0 * z[j];
+            if(d > tol) d = tol;
+            if(d < -tol) d = -tol;
+            out[l + j] = v * (1.0 + d);
+        }
+    }
+}
+
+// Valuta MC_BLOCK campioni; stack deve contenere max_stack * MC_BLOCK double
+static void mc_eval_block(const Topology *t, double *stack, const Options *opt, Rng *rng, double *out) {
+    int sp = 0;
+    for(int i = 0; i < t->n; i++) {
+        int k = t->nchild[i];
+        double *dst;
+        switch(t->kind[i]) {
+            case TOPO_RES:
+                dst = stack + (size_t)sp * MC_BLOCK;
+                if(t->value[i] > 0 && opt->tolerance > 0)
+                    mc_sample(dst, MC_BLOCK, t->value[i], opt, rng);
+                else
+                    for(int l = 0; l < MC_BLOCK; l++)
+                        dst[l] = t->value[i];
+                sp++;
+                break;
+            case TOPO_SERIES:
+                if(k == 0) {
+                    dst = stack + (size_t)sp * MC_BLOCK;
+                    for(int l = 0; l < MC_BLOCK; l++)
+                        dst[l] = 0.0;
+                    sp++;
+                    break;
+                }
+                dst = stack + (size_t)(sp - k) * MC_BLOCK;
+                for(int j = 1; j < k; j++) {
+                    const double *src = dst + (size_t)j * MC_BLOCK;
+                    for(int l = 0; l < MC_BLOCK; l += VLANES)
+                        v_store(dst + l, v_add(v_load(dst + l), v_load(src + l)));
+                }
+                sp -= k - 1;
+                break;
+            case TOPO_PAR:
+                dst = stack + (size_t)(sp - k) * MC_BLOCK;
+                for(int l = 0; l < MC_BLOCK; l += VLANES)
+                    v_store(dst + l, v_recip_pos(v_load(dst + l)));
+                for(int j = 1; j < k; j++) {
+                    const double *src = dst + (size_t)j * MC_BLOCK;
+                    for(int l = 0; l < MC_BLOCK; l += VLANES)
+                        v_store(dst + l, v_add(v_load(dst + l), v_recip_pos(v_load(src + l))));
+                }
+                for(int l = 0; l < MC_BLOCK; l += VLANES)
+                    v_store(dst + l, v_recip_pos(v_load(dst + l)));
+                sp -= k - 1;
+                break;
+        }
+    }
+    memcpy(out, stack, MC_BLOCK * sizeof(double));
+}
+
+// Porta in a[k] il k-esimo valore in ordine crescente (quickselect)
+static void select_kth(double *a, long n, long k) {
+    long lo = 0, hi = n - 1;
+    while(lo < hi) {
+        double pivot = a[lo + (hi - lo) / 2];
+        long i = lo, j = hi;
+        while(i <= j) {
+            while(a[i] < pivot) i++;
+            while(a[j] > pivot) j--;
+            if(i <= j) {
+                double tmp = a[i];
+                a[i] = a[j];
+                a[j] = tmp;
+                i++;
+                j--;
+            }
+        }
+        if(k <= j)
+            hi = j;
+        else if(k >= i)
+            lo = i;
+        else
+            return;
+    }
+}
+
+static const double MC_PERCENTILES[] = { 1, 5, 50, 95, 99 };
+#define MC_NPERC (int)(sizeof(MC_PERCENTILES) / sizeof(MC_PERCENTILES[0]))
+
+typedef struct {
+    double nominal, mean, std, min, max;
+    double perc[MC_NPERC];
+} McStats;
+
+// Esegue l'analisi sulla topologia già costruita nel contesto
+void monte_carlo(CircuitContext *ctx, const Options *opt, Rng *rng, double *samples, double *stack, McStats *st) {
+    const Topology *t = &ctx->topo;
+    long n = opt->montecarlo;
+    st->nominal = calculate_total_resistance_new(ctx);
+
+    double block[MC_BLOCK];
+    for(long done = 0; done < n; done += MC_BLOCK) {
+        mc_eval_block(t, stack, opt, rng, block);
+        long take = (n - done < MC_BLOCK) ? n - done : MC_BLOCK;
+        memcpy(samples + done, block, take * sizeof(double));
+    }
+
+    double sum = 0;
+    st->min = st->max = samples[0];
+    for(long i = 0; i < n; i++) {
+        sum += samples[i];
+        if(samples[i] < st->min) st->min = samples[i];
+        if(samples[i] > st->max) st->max = samples[i];
+    }
+    st->mean = sum / n;
+    double var = 0;
+    for(long i = 0; i < n; i++)
+        var += (samples[i] - st->mean) * (samples[i] - st->mean);
+    st->std = (n > 1) ? sqrt(var / (n - 1)) : 0.0;
+
+    // Percentili nearest-rank: ogni selezione riparte dalla posizione della precedente
+    long from = 0;
+    for(int p = 0; p < MC_NPERC; p++) {
+        long k = (long)ceil(MC_PERCENTILES[p] / 100.0 * n) - 1;
+        if(k < from) k = from;
+        if(k >= n) k = n - 1;
+        select_kth(samples + from, n - from, k - from);
+        st->perc[p] = samples[k];
+        from = k;
+    }
+}
+
+static void write_mc_result(FILE *out, long line, const char *status, long n, const McStats *st, int json) {
+    static const char *names[] = { "nominal", "mean", "std", "min", "p1", "p5", "p50", "p95", "p99", "max" };
+    double vals[10] = { 0 };
+    if(st) {
+        vals[0] = st->nominal;
+        vals[1] = st->mean;
+        vals[2] = st->std;
+        vals[3] = st->min;
+        for(int p = 0; p < MC_NPERC; p++)
+            vals[4 + p] = st->perc[p];
+        vals[9] = st->max;
+    }
+    if(json)
+        fprintf(out, "{\"line\":%ld,\"status\":\"%s\",\"samples\":%ld", line, status, st ? n : 0);
+    else
+        fprintf(out, "%ld,%s,%ld", line, status, st ? n : 0);
+    for(int i = 0; i < 10; i++) {
+        if(json)
+            fprintf(out, ",\"%s\":", names[i]);
+        else
+            fputc(',', out);
+        put_number(out, vals[i], st != NULL, json);
+    }
+    fputs(json ? "}\n" : "\n", out);
+}
+
+int run_montecarlo(const Options *opt) {
+    FILE *in = open_input(opt->input);
+    if(!in)
+        return 1;
+    setlocale(LC_NUMERIC, "C");
+    if(!opt->json)
+        fputs("line,status,samples,nominal,mean,std,min,p1,p5,p50,p95,p99,max\n", stdout);
+
+    CircuitContext *ctx = context_create(opt->stats);
+    ctx->topology_only = 1;
+    Rng rng;
+    rng_seed(&rng, opt->seed);
+    double *samples = malloc(opt->montecarlo * sizeof(double));
+    double *stack = NULL;
+    int stack_slots = 0;
+    if(!samples) {
+        fprintf(stderr, "Errore di allocazione!\n");
+        exit(1);
+    }
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    long line_no = 0, circuits = 0;
+    double total_time = 0;
+    ssize_t n;
+
+    while((n = getline(&line, &line_cap, in)) != -1) {
+        line_no++;
+        char *circ;
+        size_t circ_len;
+        double Req, I, V;
+        if(!split_record(line, n, &circ, &circ_len, &Req, &I, &V))
+            continue;
+        if(!circuit_framed(circ, circ_len)) {
+            write_mc_result(stdout, line_no, "bad_format", 0, NULL, opt->json);
+            continue;
+        }
+        reset_circuit(ctx);
+        parse_circuit_utf8(ctx, circ, circ_len);
+        if(ctx->topo.n_reactive) {
+            write_mc_result(stdout, line_no, "reactive", 0, NULL, opt->json);
+            continue;
+        }
+        if(ctx->topo.max_stack > stack_slots) {
+            stack_slots = ctx->topo.max_stack;
+            stack = realloc(stack, (size_t)stack_slots * MC_BLOCK * sizeof(double));
+            if(!stack) {
+                fprintf(stderr, "Errore di allocazione!\n");
+                exit(1);
+            }
+        }
+        struct timespec t0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        McStats st;
+        monte_carlo(ctx, opt, &rng, samples, stack, &st);
+        total_time += elapsed_since(&t0);
+        circuits++;
+        write_mc_result(stdout, line_no, "ok", opt->montecarlo, &st, opt->json);
+    }
+
+    fflush(stdout);
+    if(circuits > 0 && total_time > 0)
+        fprintf(stderr, "Monte Carlo: %ld circuiti, %.3g campioni/s (%d corsie SIMD).\n",
+                circuits, circuits * (double)opt->montecarlo / total_time, VLANES);
+    free(samples);
+    free(stack);
+    free(line);
+    context_destroy(ctx);
+    if(in != stdin)
+        fclose(in);
+    return 0;
+}
+
+/* --- PROPAGAZIONE DELLA TOLLERANZA A INTERVALLI --- */
+// Invece di campionare, ogni resistenza nota è l'intervallo [v(1-T), v(1+T)] e una sola
+// passata sulla topologia dà limiti garantiti per Req. Serie e parallelo sono monotòni
+// crescenti in ogni ramo, quindi basta combinare gli estremi inferiori fra loro e quelli
+// superiori fra loro. L'arrotondamento è verso l'esterno e corretto: l'errore di ogni
+// somma (TwoSum) e di ogni prodotto o reciproco (fma) è calcolato esattamente, e il
+// risultato è spostato di un ulp solo se cade dal lato sbagliato del valore esatto.
+// Le operazioni esatte non allargano l'intervallo e lo zero resta zero.
+//
+// Con una sola incognita Rx è decrescente nelle resistenze note e crescente in Req
+// misurata (presa esatta). Il candidato per l'estremo inferiore si ottiene dalla forma
+// chiusa con le note al massimo, quello superiore con le note al minimo; ciascuno è poi
+// verificato con la valutazione a intervalli (Req con Rx = x_lo non supera la misura per
+// nessuna combinazione di valori, Req con Rx = x_hi non le sta sotto) e allontanato
+// finché la verifica riesce.
+#define IV_MAX_STEPS 64
+
+typedef struct {
+    double lo, hi;
+} Interval;
+
+// Errore della somma a + b (TwoSum di Knuth): il valore esatto è s + err
+static inline double sum_error(double a, double b, double s) {
+    double bb = s - a;
+    return (a - (s - bb)) + (b - bb);
+}
+
+static inline double add_down(double a, double b) {
+    double s = a + b;
+    return sum_error(a, b, s) < 0 ? nextafter(s, -INFINITY) : s;
+}
+
+static inline double add_up(double a, double b) {
+    double s = a + b;
+    return sum_error(a, b, s) > 0 ? nextafter(s, INFINITY) : s;
+}
+
+static inline double mul_down(double a, double b) {
+    double p = a * b;
+    return fma(a, b, -p) < 0 ? nextafter(p, -INFINITY) : p;
+}
+
+static inline double mul_up(double a, double b) {
+    double p = a * b;
+    return fma(a, b, -p) > 0 ? nextafter(p, INFINITY) : p;
+}
+
+// 1/x per x > 0: il segno di r*x - 1 dice da che parte è caduto r
+static inline double recip_down(double x) {
+    double r = 1.0 / x;
+    return fma(r, x, -1.0) > 0 ? nextafter(r, -INFINITY) : r;
+}
+
+static inline double recip_up(double x) {
+    double r = 1.0 / x;
+    return fma(r, x, -1.0) < 0 ? nextafter(r, INFINITY) : r;
+}
+
+// Reciproco di un intervallo di resistenze o conduttanze; lo zero resta zero (ramo o
+// gruppo ignorato come in recip_pos)
+static inline Interval iv_recip(Interval x) {
+    Interval g;
+    g.lo = x.hi > 0 ? (isinf(x.hi) ? 0.0 : recip_down(x.hi)) : 0.0;
+    g.hi = x.lo > 0 ? recip_up(x.lo) : (x.hi > 0 ? INFINITY : 0.0);
+    return g;
+}
+
+// Req a intervalli; le foglie incognite valgono esattamente x (0 = ignorate come in
+// evaluate_topology). lo/hi sono gli estremi dei valori noti.
+static Interval evaluate_interval(const Topology *t, const double *lo, const double *hi, double x, Interval *stack) {
+    int sp = 0;
+    for(int i = 0; i < t->n; i++) {
+        int k = t->nchild[i];
+        Interval *a = stack + sp - k;
+        switch(t->kind[i]) {
+            case TOPO_RES:
+                stack[sp++] = TOPO_IS_UNKNOWN(t, i) ? (Interval){ x, x } : (Interval){ lo[i], hi[i] };
+                break;
+            case TOPO_SERIES: {
+                Interval s = { 0, 0 };
+                for(int j = 0; j < k; j++) {
+                    s.lo = add_down(s.lo, a[j].lo);
+                    s.hi = add_up(s.hi, a[j].hi);
+                }
+                sp -= k;
+                stack[sp++] = s;
+                break;
+            }
+            case TOPO_PAR: {
+                Interval G = { 0, 0 };
+                for(int j = 0; j < k; j++) {
+                    Interval g = iv_recip(a[j]);
+                    G.lo = add_down(G.lo, g.lo);
+                    G.hi = add_up(G.hi, g.hi);
+                }
+                sp -= k;
+                stack[sp++] = iv_recip(G);
+                break;
+            }
+        }
+    }
+    return sp ? stack[0] : (Interval){ 0, 0 };
+}
+
+typedef struct {
+    const char *status;
+    int unknowns;
+    Interval req;               // Req delle resistenze note
+    double req_nominal;
+    Interval rx;                // hi = INFINITY se non limitata
+    double rx_nominal;          // -1 se non disponibile
+} IntervalResult;
+
+// Estremi di tolleranza delle resistenze note (arrotondati verso l'esterno)
+static void interval_bounds(const Topology *t, double tol, double *lo, double *hi) {
+    double f_lo = add_down(1.0, -tol), f_hi = add_up(1.0, tol);
+    for(int i = 0; i < t->n; i++) {
+        double v = t->value[i];
+        lo[i] = v > 0 ? mul_down(v, f_lo) : v;
+        hi[i] = v > 0 ? mul_up(v, f_hi) : v;
+    }
+}
+
+// Certifica l'estremo di Rx partendo dal candidato x: dir = -1 cerca x con Req(x) <= misura
+// per ogni valore delle note, dir = +1 x con Req(x) >= misura. Restituisce 0 o INFINITY
+// se non si trova un limite finito positivo.
+static double certify_rx(const Topology *t, const double *lo, const double *hi, double x, double Req,
+                         int dir, Interval *stack) {
+    double step = fabs(x) * 0x1p-40;
+    for(int s = 0; s < IV_MAX_STEPS; s++) {
+        if(dir < 0 && x <= 0)
+            return 0.0;
+        if(dir > 0 && isinf(x))
+            return INFINITY;
+        Interval r = evaluate_interval(t, lo, hi, x, stack);
+        if(dir < 0 ? r.hi <= Req : r.lo >= Req)
+            return x;
+        x += dir * step;
+        step *= 2;
+    }
+    return dir < 0 ? 0.0 : INFINITY;
+}
+
+void interval_record(CircuitContext *ctx, double tol, double Req_measured, double *lo, double *hi,
+                     Interval *stack, IntervalResult *r) {
+    const Topology *t = &ctx->topo;
+    r->status = "ok";
+    r->unknowns = t->n_unknown;
+    r->rx = (Interval){ -1, -1 };
+    r->rx_nominal = -1;
+    interval_bounds(t, tol, lo, hi);
+    r->req = evaluate_interval(t, lo, hi, 0.0, stack);
+    r->req_nominal = calculate_total_resistance_new(ctx);
+    if(r->unknowns > 1) {
+        r->status = "multi_unknown";
+        return;
+    }
+    if(r->unknowns == 0)
+        return;
+    if(Req_measured <= 0) {
+        r->status = "no_req";
+        return;
+    }
+
+    // Forme chiuse con le note al nominale, al massimo e al minimo
+    Topology view = *t;
+    RxFlowchart f;
+    Mobius m;
+    double x_nom, x_lo, x_hi;
+    prepare_rx(ctx, &f, r->req_nominal);
+    if(solve_rx(&f, Req_measured, &x_nom) == RX_OK)
+        r->rx_nominal = x_nom;
+
+    view.value = hi;
+    topo_mobius(&view, NULL, 0, (double *)stack, &m);
+    rx_from_mobius(&f, &m, 0);
+    RxStatus s_lo = solve_rx(&f, Req_measured, &x_lo);
+    view.value = lo;
+    topo_mobius(&view, NULL, 0, (double *)stack, &m);
+    rx_from_mobius(&f, &m, 0);
+    RxStatus s_hi = solve_rx(&f, Req_measured, &x_hi);
+
+    // Con le note al massimo la misura è irraggiungibile: lo è per ogni valore ammesso
+    if(s_lo == RX_BAD_DATA) {
+        r->status = "bad_data";
+        return;
+    }
+    // Con le note al minimo Rx dovrebbe già essere <= 0
+    if(s_hi == RX_NON_POSITIVE) {
+        r->status = "rx_nonpositive";
+        return;
+    }
+    r->rx.lo = s_lo == RX_OK ? certify_rx(t, lo, hi, x_lo, Req_measured, -1, stack) : 0.0;
+    r->rx.hi = s_hi == RX_OK ? certify_rx(t, lo, hi, x_hi, Req_measured, 1, stack) : INFINITY;
+    if(isinf(r->rx.hi))
+        r->status = "rx_unbounded";
+}
+
+// r = NULL per i record senza valori (stato "status")
+static void write_interval_result(FILE *out, long line, const char *status, const IntervalResult *r, int json) {
+    static const char *names[] = { "req_lo", "req", "req_hi", "rx_lo", "rx", "rx_hi" };
+    double vals[6] = { 0 };
+    int avail[6] = { 0 };
+    if(r) {
+        vals[0] = r->req.lo;
+        vals[1] = r->req_nominal;
+        vals[2] = r->req.hi;
+        vals[3] = r->rx.lo;
+        vals[4] = r->rx_nominal;
+        vals[5] = r->rx.hi;
+        avail[0] = avail[1] = avail[2] = 1;
+        avail[3] = r->rx.lo >= 0;
+        avail[4] = r->rx_nominal > 0;
+        avail[5] = r->rx.hi >= 0 && !isinf(r->rx.hi);
+    }
+    if(json)
+        fprintf(out, "{\"line\":%ld,\"status\":\"%s\",\"unknowns\":%d", line, status, r ? r->unknowns : 0);
+    else
+        fprintf(out, "%ld,%s,%d", line, status, r ? r->unknowns : 0);
+    for(int i = 0; i < 6; i++) {
+        if(json)
+            fprintf(out, ",\"%s\":", names[i]);
+        else
+            fputc(',', out);
+        // 17 cifre: il valore stampato, riletto, è lo stesso double del limite certificato
+        if(avail[i])
+            fprintf(out, "%.17g", vals[i]);
+        else if(json)
+            fputs("null", out);
+    }
+    fputs(json ? "}\n" : "\n", out);
+}
+
+int run_interval(const Options *opt) {
+    FILE *in = open_input(opt->input);
+    if(!in)
+        return 1;
+    setlocale(LC_NUMERIC, "C");
+    if(!opt->json)
+        fputs("line,status,unknowns,req_lo,req,req_hi,rx_lo,rx,rx_hi\n", stdout);
+
+    CircuitContext *ctx = context_create(opt->stats);
+    ctx->topology_only = 1;
+    double *lo = NULL, *hi = NULL;
+    Interval *stack = NULL;
+    int cap = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+    long line_no = 0;
+    ssize_t n;
+
+    while((n = getline(&line, &line_cap, in)) != -1) {
+        line_no++;
+        char *circ;
+        size_t circ_len;
+        double Req, I, V;
+        if(!split_record(line, n, &circ, &circ_len, &Req, &I, &V))
+            continue;
+        if(!circuit_framed(circ, circ_len)) {
+            write_interval_result(stdout, line_no, "bad_format", NULL, opt->json);
+            continue;
+        }
+        reset_circuit(ctx);
+        parse_circuit_utf8(ctx, circ, circ_len);
+        if(ctx->topo.n_reactive) {
+            write_interval_result(stdout, line_no, "reactive", NULL, opt->json);
+            continue;
+        }
+        // lo/hi per nodo; lo stack a intervalli fa anche da stack di double per topo_mobius
+        if(ctx->topo.n + 1 > cap) {
+            cap = 2 * (ctx->topo.n + 1);
+            lo = xrealloc(lo, cap * sizeof(double));
+            hi = xrealloc(hi, cap * sizeof(double));
+            stack = xrealloc(stack, cap * sizeof(Interval));
+        }
+        IntervalResult r;
+        interval_record(ctx, opt->tolerance, Req, lo, hi, stack, &r);
+        write_interval_result(stdout, line_no, r.status, &r, opt->json);
+    }
+
+    fflush(stdout);
+    free(lo);
+    free(hi);
+    free(stack);
+    free(line);
+    context_destroy(ctx);
+    if(in != stdin)
+        fclose(in);
+    return 0;
+}
+
+/* --- SENSIBILITÀ DI REQ (METODO AGGIUNTO) --- */
+// Derivate dReq/dRi rispetto a tutte le resistenze con una passata in avanti e una
+// all'indietro, invece di n valutazioni complete alle differenze finite. La passata in
+// avanti salva il valore di ogni nodo; quella all'indietro parte da 1 alla radice e scende
+// verso le foglie: in una serie la derivata passa invariata ai figli, in un parallelo di
+// valore V il figlio di valore c la riceve moltiplicata per (V/c)^2. Un figlio a 0 in un
+// parallelo non conduce nella valutazione (recip_pos), quindi la sua derivata è 0.
+// Con un'incognita risolta dalla misura si valuta nel punto Rx e si riporta anche
+// dRx/dRi = -(dReq/dRi) / (dReq/dRx): come l'errore di ogni nota si propaga sull'incognita.
+// La sensibilità normalizzata (Ri/Req) dReq/dRi è adimensionale e, poiché Req è omogenea
+// di grado 1 nelle resistenze, la sua somma su tutti gli elementi vale 1.
+
+// Come evaluate_topology, salvando anche il valore di ogni nodo
+double evaluate_nodes(const Topology *t, double *node, double *stack) {
+    int sp = 0;
+    for(int i = 0; i < t->n; i++) {
+        int k = t->nchild[i];
+        switch(t->kind[i]) {
+            case TOPO_RES:
+                stack[sp++] = t->value[i];
+                break;
+            case TOPO_SERIES: {
+                double total = pairwise_sum(stack + sp - k, k);
+                sp -= k;
+                stack[sp++] = total;
+                break;
+            }
+            case TOPO_PAR: {
+                for(int j = sp - k; j < sp; j++)
+                    stack[j] = recip_pos(stack[j]);
+                double invSum = pairwise_sum(stack + sp - k, k);
+                sp -= k;
+                stack[sp++] = recip_pos(invSum);
+                break;
+            }
+        }
+        node[i] = stack[sp - 1];
+    }
+    return sp ? stack[0] : 0.0;
+}
+
+// grad[i] = dReq/d(valore del nodo i). In ordine postfisso il padre viene dopo i figli,
+// quindi scorrendo all'indietro la derivata di un nodo è pronta prima dei suoi figli.
+// L'ultimo figlio di un gruppo è il nodo precedente; ogni figlio è preceduto dal
+// sottoalbero del fratello, che inizia in start[].
+void adjoint_sweep(const Topology *t, const double *node, double *grad) {
+    if(t->n == 0)
+        return;
+    grad[t->n - 1] = 1.0;
+    for(int i = t->n - 1; i >= 0; i--) {
+        if(t->kind[i] == TOPO_RES)
+            continue;
+        double g = grad[i], v = node[i];
+        for(int k = 0, c = i - 1; k < t->nchild[i]; k++, c = t->start[c] - 1) {
+            if(t->kind[i] == TOPO_SERIES)
+                grad[c] = g;
+            else
+                grad[c] = (node[c] > 0 && v > 0) ? g * (v / node[c]) * (v / node[c]) : 0.0;
+        }
+    }
+}
+
+// Riga per elemento: "line,status,element" seguiti da count colonne numeriche. Un record
+// senza elementi (errore) ha element = 0 e colonne vuote.
+static void write_element_row(FILE *out, long line, const char *status, int element,
+                              const char *const *names, const double *vals, const int *avail,
+                              int count, int json) {
+    if(json)
+        fprintf(out, "{\"line\":%ld,\"status\":\"%s\",\"element\":", line, status);
+    else
+        fprintf(out, "%ld,%s,", line, status);
+    if(element > 0)
+        fprintf(out, "%d", element);
+    else if(json)
+        fputs("null", out);
+    for(int i = 0; i < count; i++) {
+        if(json)
+            fprintf(out, ",\"%s\":", names[i]);
+        else
+            fputc(',', out);
+        put_number(out, vals[i], element > 0 && avail[i], json);
+    }
+    fputs(json ? "}\n" : "\n", out);
+}
+
+// Analizza il record come il batch (stesso stato, stessa Rx) e, se è valido, sostituisce
+// Rx nell'incognita. Restituisce il nodo dell'incognita (-1 se non c'è).
+static int element_record(CircuitContext *ctx, const char *circuit, size_t len, double Req_measured,
+                          double I, double V, BatchResult *r) {
+    r->status = "ok";
+    r->unknowns = 0;
+    r->req_known = 0;
+    r->req = r->rx = r->I = r->V = -1;
+    if(!circuit_framed(circuit, len)) {
+        r->status = "bad_format";
+        return -1;
+    }
+    reset_circuit(ctx);
+    parse_circuit_utf8(ctx, circuit, len);
+    if(ctx->topo.n_reactive) {
+        r->status = "reactive";
+        return -1;
+    }
+    RxFlowchart f;
+    double Req_known = calculate_total_resistance_new(ctx);
+    int unknowns = count_unknowns(ctx);
+    if(unknowns == 1)
+        prepare_rx(ctx, &f, Req_known);
+    finish_record(r, Req_known, unknowns, &f, Req_measured, I, V);
+    if(unknowns != 1 || strcmp(r->status, "ok") != 0)
+        return -1;
+    Topology *t = &ctx->topo;
+    for(int i = 0; i < t->n; i++)
+        if(t->unknown[i >> 6] >> (i & 63) & 1) {
+            t->value[i] = r->rx;
+            return i;
+        }
+    return -1;
+}
+
+/* --- CORRENTI, TENSIONI E POTENZE DEI SINGOLI ELEMENTI --- */
+// Dalla corrente totale del record alla distribuzione su ogni resistenza in due passate
+// lineari: quella in avanti (evaluate_nodes) dà la resistenza di ogni sottocircuito,
+// quella all'indietro scende dalla radice dividendo la corrente. In una serie ogni figlio
+// porta la corrente del gruppo; in un parallelo di valore V attraversato da I la tensione
+// è I*V e il figlio di valore c porta I*V/c. Come nella valutazione, un ramo a 0 in un
+// parallelo non conduce.
+
+// cur[i] = corrente nel nodo i quando nella radice scorre I
+void current_sweep(const Topology *t, const double *node, double I, double *cur) {
+    if(t->n == 0)
+        return;
+    cur[t->n - 1] = I;
+    for(int i = t->n - 1; i >= 0; i--) {
+        if(t->kind[i] == TOPO_RES)
+            continue;
+        double g = cur[i], v = g * node[i];
+        for(int k = 0, c = i - 1; k < t->nchild[i]; k++, c = t->start[c] - 1) {
+            if(t->kind[i] == TOPO_SERIES)
+                cur[c] = g;
+            else
+                cur[c] = node[c] > 0 ? v / node[c] : 0.0;
+        }
+    }
+}
+
+// Una riga per elemento di ogni record valido: derivate di Req (--sensitivity) oppure
+// corrente, tensione e potenza (--elements). Gli stati sono quelli del batch.
+static int run_element_table(const Options *opt, int currents) {
+    static const char *const sens_names[] = { "value", "dreq", "sens", "drx" };
+    static const char *const elem_names[] = { "value", "i", "v", "p" };
+    const char *const *names = currents ? elem_names : sens_names;
+    FILE *in = open_input(opt->input);
+    if(!in)
+        return 1;
+    setlocale(LC_NUMERIC, "C");
+    static char out_buf[1 << 16];
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+    if(!opt->json)
+        fputs(currents ? "line,status,element,value,i,v,p\n" : "line,status,element,value,dreq,sens,drx\n",
+              stdout);
+
+    CircuitContext *ctx = context_create(opt->stats);
+    ctx->topology_only = 1;
+    double *node = NULL, *work = NULL;
+    int cap = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+    long line_no = 0;
+    ssize_t n;
+
+    while((n = getline(&line, &line_cap, in)) != -1) {
+        line_no++;
+        char *circ;
+        size_t circ_len;
+        double Req, I, V;
+        if(!split_record(line, n, &circ, &circ_len, &Req, &I, &V))
+            continue;
+        BatchResult r;
+        int rx_node = element_record(ctx, circ, circ_len, Req, I, V, &r);
+        if(strcmp(r.status, "ok") != 0) {
+            write_element_row(stdout, line_no, r.status, 0, names, NULL, NULL, 4, opt->json);
+            continue;
+        }
+        const Topology *t = &ctx->topo;
+        if(t->n > cap) {
+            cap = 2 * t->n;
+            node = xrealloc(node, cap * sizeof(double));
+            work = xrealloc(work, cap * sizeof(double));
+        }
+        double Req_model = evaluate_nodes(t, node, t->stack);
+        if(currents)
+            current_sweep(t, node, r.I, work);
+        else
+            adjoint_sweep(t, node, work);
+        double g_rx = !currents && rx_node >= 0 ? work[rx_node] : 0;
+        for(int i = 0, element = 0; i < t->n; i++) {
+            if(t->kind[i] != TOPO_RES)
+                continue;
+            double x = t->value[i], w = work[i];
+            double vals[4];
+            int avail[4];
+            if(currents) {
+                // Senza I né V nel record la corrente non è nota: resta solo il valore
+                int known = r.I > 0;
+                double c[4] = { x, w, w * x, w * w * x };
+                int a[4] = { 1, known, known, known };
+                memcpy(vals, c, sizeof(c));
+                memcpy(avail, a, sizeof(a));
+            } else {
+                double c[4] = { x, w, Req_model > 0 ? x * w / Req_model : 0, g_rx != 0 ? -w / g_rx : 0 };
+                int a[4] = { 1, 1, Req_model > 0, g_rx != 0 && i != rx_node };
+                memcpy(vals, c, sizeof(c));
+                memcpy(avail, a, sizeof(a));
+            }
+            write_element_row(stdout, line_no, "ok", ++element, names, vals, avail, 4, opt->json);
+        }
+    }
+
+    fflush(stdout);
+    free(node);
+    free(work);
+    free(line);
+    context_destroy(ctx);
+    if(in != stdin)
+        fclose(in);
+    return 0;
+}
+
+int run_sensitivity(const Options *opt) {
+    return run_element_table(opt, 0);
+}
+
+int run_elements(const Options *opt) {
+    return run_element_table(opt, 1);
+}
+
+/* --- IMPEDENZA IN ALTERNATA (SWEEP IN FREQUENZA) --- */
+// Condensatori (token 'C', in F) e induttori ('L', in H) hanno impedenza -j/(wC) e jwL;
+// serie e paralleli si combinano come in evaluate_topology, sommando impedenze o
+// ammettenze complesse, e un ramo di impedenza nulla in un parallelo è ignorato come in
+// continua. La topologia viene analizzata una sola volta e valutata su blocchi di
+// frequenze: ogni slot dello stack contiene le parti reali e poi quelle immaginarie di
+// tutte le frequenze del blocco, e serie e paralleli lavorano sulle corsie SIMD, una
+// frequenza per corsia, come nel Monte Carlo.
+#define AC_BLOCK 256                 // frequenze per blocco
+#define AC_STACK_BYTES (64 << 20)    // oltre questa memoria i blocchi si riducono
+
+// Impedenza alle b pulsazioni w[] (b multiplo di VLANES); lo slot s dello stack occupa
+// 2*b double a partire da s*2*b. Il risultato resta nello slot 0.
+static void ac_eval_block(const Topology *t, const double *w, int b, double *stack) {
+    size_t slot = 2 * (size_t)b;
+    int sp = 0;
+    for(int i = 0; i < t->n; i++) {
+        int k = t->nchild[i];
+        double *re, *im;
+        switch(t->kind[i]) {
+            case TOPO_RES: {
+                re = stack + (size_t)sp * slot;
+                im = re + b;
+                double v = t->value[i];
+                switch(t->elem[i]) {
+                    case ELEM_R:
+                        for(int l = 0; l < b; l++) {
+                            re[l] = v;
+                            im[l] = 0.0;
+                        }
+                        break;
+                    case ELEM_L:
+                        for(int l = 0; l < b; l++) {
+                            re[l] = 0.0;
+                            im[l] = w[l] * v;
+                        }
+                        break;
+                    case ELEM_C:
+                        for(int l = 0; l < b; l++) {
+                            re[l] = 0.0;
+                            im[l] = -1.0 / (w[l] * v);
+                        }
+                        break;
+                }
+                sp++;
+                break;
+            }
+            case TOPO_SERIES:
+                if(k == 0) {
+                    re = stack + (size_t)sp * slot;
+                    memset(re, 0, slot * sizeof(double));
+                    sp++;
+                    break;
+                }
+                // parti reali e immaginarie sono contigue: una sola somma su 2*b corsie
+                re = stack + (size_t)(sp - k) * slot;
+                for(int j = 1; j < k; j++) {
+                    const double *src = re + j * slot;
+                    for(size_t l = 0; l < slot; l += VLANES)
+                        v_store(re + l, v_add(v_load(re + l), v_load(src + l)));
+                }
+                sp -= k - 1;
+                break;
+            case TOPO_PAR:
+                re = stack + (size_t)(sp - k) * slot;
+                im = re + b;
+                for(int l = 0; l < b; l += VLANES) {
+                    vdouble yr = v_load(re + l), yi = v_load(im + l);
+                    v_crecip(&yr, &yi);
+                    for(int j = 1; j < k; j++) {
+                        vdouble zr = v_load(re + j * slot + l), zi = v_load(im + j * slot + l);
+                        v_crecip(&zr, &zi);
+                        yr = v_add(yr, zr);
+                        yi = v_add(yi, zi);
+                    }
+                    v_crecip(&yr, &yi);
+                    v_store(re + l, yr);
+                    v_store(im + l, yi);
+                }
+                sp -= k - 1;
+                break;
+        }
+    }
+}
+
+static void write_sweep_row(FILE *out, double f, double re, double im, int json) {
+    static const char *const names[] = { "freq", "re", "im", "mag", "phase" };
+    double vals[5] = { f, re, im, hypot(re, im), atan2(im, re) * (360.0 / TWO_PI) };
+    for(int i = 0; i < 5; i++) {
+        if(json)
+            fprintf(out, "%s\"%s\":", i ? "," : "{", names[i]);
+        else if(i)
+            fputc(',', out);
+        put_number(out, vals[i], 1, json);
+    }
+    fputs(json ? "}\n" : "\n", out);
+}
+
+int run_sweep(const Options *opt) {
+    size_t len = strlen(opt->sweep);
+    if(!circuit_framed(opt->sweep, len)) {
+        fprintf(stderr, "Errore: il circuito deve iniziare con '+' e terminare con '-'.\n");
+        return 1;
+    }
+    if(opt->fmax < opt->fmin) {
+        fprintf(stderr, "Errore: --fmax non può essere minore di --fmin.\n");
+        return 1;
+    }
+    CircuitContext *ctx = context_create(opt->stats);
+    ctx->topology_only = 1;
+    parse_circuit_utf8(ctx, opt->sweep, len);
+    const Topology *t = &ctx->topo;
+    int elements = 0, bad_cap = 0;
+    for(int i = 0; i < t->n; i++) {
+        elements += t->kind[i] == TOPO_RES;
+        bad_cap |= t->elem[i] == ELEM_C && !(t->value[i] > 0);
+    }
+    if(t->n_unknown || bad_cap) {
+        fprintf(stderr, t->n_unknown ? "Errore: la sweep richiede un circuito senza incognite.\n"
+                                     : "Errore: ogni condensatore deve avere una capacità positiva.\n");
+        context_destroy(ctx);
+        return 1;
+    }
+
+    // Circuiti con stack molto profondo (lunghe serie) usano blocchi più piccoli
+    int b = AC_BLOCK;
+    size_t slots = t->max_stack > 0 ? (size_t)t->max_stack : 1;
+    while(b > VLANES && slots * 2 * b * sizeof(double) > AC_STACK_BYTES)
+        b /= 2;
+    double *stack = xrealloc(NULL, slots * 2 * b * sizeof(double));
+    double *f = xrealloc(NULL, b * sizeof(double));
+    double *w = xrealloc(NULL, b * sizeof(double));
+
+    setlocale(LC_NUMERIC, "C");
+    static char out_buf[1 << 16];
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+    if(!opt->json)
+        fputs("freq,re,im,mag,phase\n", stdout);
+
+    // Frequenze equispaziate in scala logaritmica, estremi esatti
+    double lf = log(opt->fmin);
+    double step = opt->points > 1 ? (log(opt->fmax) - lf) / (opt->points - 1) : 0;
+    double eval_time = 0;
+    for(long k0 = 0; k0 < opt->points; k0 += b) {
+        int m = opt->points - k0 < b ? (int)(opt->points - k0) : b;
+        for(int l = 0; l < b; l++) {
+            long k = k0 + (l < m ? l : m - 1); // corsie in eccesso: ripete l'ultima frequenza
+            f[l] = k == 0 ? opt->fmin : k == opt->points - 1 ? opt->fmax : exp(lf + k * step);
+            w[l] = TWO_PI * f[l];
+        }
+        struct timespec t0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        ac_eval_block(t, w, b, stack);
+        eval_time += elapsed_since(&t0);
+        for(int l = 0; l < m; l++)
+            write_sweep_row(stdout, f[l], stack[l], stack[b + l], opt->json);
+    }
+    fflush(stdout);
+    fprintf(stderr, "Sweep: %ld frequenze, %d elementi, %.3g frequenze/s (%d corsie SIMD, blocchi da %d).\n",
+            opt->points, elements, eval_time > 0 ? opt->points / eval_time : 0.0, VLANES, b);
+
+    free(stack);
+    free(f);
+    free(w);
+    context_destroy(ctx);
+    return 0;
+}
+
+/* --- VALUTAZIONE INCREMENTALE --- */
+// Per i cicli di taratura che cambiano una resistenza alla volta. Ogni gruppo (serie o
+// parallelo) conserva i contributi dei figli (valori per la serie, conduttanze per il
+// parallelo) e un segment tree sulle somme dei blocchi di REDUCE_BLOCK contributi.
+// Cambiare un elemento aggiorna solo i gruppi antenati, e in ciascuno un blocco più il
+// cammino fino alla radice del segment tree: O(profondità * log(figli)) invece di O(n).
+// La forma è quella di pairwise_sum, quindi il risultato coincide bit per bit con
+// evaluate_topology.
+typedef struct {
+    int n;                  // nodi della topologia
+    int n_leaves;           // elementi (resistenze) numerati in ordine di testo
+    unsigned char *kind;    // TopoKind di ogni nodo
+    int *parent;            // padre di ogni nodo (-1 per la radice)
+    int *child_pos;         // posizione del nodo fra i figli del padre
+    int *nchild;            // figli diretti di ogni nodo
+    int *contrib_off;       // gruppi: inizio dei contributi dei figli in "contrib"
+    int *tree_off;          // gruppi: inizio del segment tree in "tree"
+    int *tree_size;         // gruppi: numero di foglie del segment tree (potenza di 2)
+    int *leaf_node;         // nodo della i-esima resistenza
+    double *value;          // valore corrente di ogni nodo
+    double *contrib;        // contributi dei figli, gruppo per gruppo
+    double *tree;           // tutti i segment tree, indicizzati da 1 come un heap
+} IncCircuit;
+
+// Aggiorna il contributo del figlio in posizione pos del gruppo g: ricalcola il suo
+// blocco e il cammino del segment tree
+static void inc_update_group(IncCircuit *ic, int g, int pos, double contribution) {
+    double *contrib = ic->contrib + ic->contrib_off[g];
+    double *tree = ic->tree + ic->tree_off[g];
+    int k = ic->nchild[g];
+    contrib[pos] = contribution;
+    int b = pos / REDUCE_BLOCK;
+    int first = b * REDUCE_BLOCK;
+    int node = ic->tree_size[g] + b;
+    tree[node] = block_sum(contrib + first, (k - first < REDUCE_BLOCK) ? k - first : REDUCE_BLOCK);
+    for(node >>= 1; node >= 1; node >>= 1)
+        tree[node] = tree[2 * node] + tree[2 * node + 1];
+    ic->value[g] = (ic->kind[g] == TOPO_PAR) ? recip_pos(tree[1]) : tree[1];
+}
+
+// Costruisce le strutture incrementali dalla topologia (valutazione completa, O(n))
+void inc_build(IncCircuit *ic, const Topology *t) {
+    int n = t->n;
+    ic->n = n;
+    ic->kind = xrealloc(ic->kind, n * sizeof(*ic->kind));
+    ic->parent = xrealloc(ic->parent, n * sizeof(int));
+    ic->child_pos = xrealloc(ic->child_pos, n * sizeof(int));
+    ic->nchild = xrealloc(ic->nchild, n * sizeof(int));
+    ic->contrib_off = xrealloc(ic->contrib_off, n * sizeof(int));
+    ic->tree_off = xrealloc(ic->tree_off, n * sizeof(int));
+    ic->tree_size = xrealloc(ic->tree_size, n * sizeof(int));
+    ic->leaf_node = xrealloc(ic->leaf_node, n * sizeof(int));
+    ic->value = xrealloc(ic->value, n * sizeof(double));
+    memcpy(ic->kind, t->kind, n * sizeof(*ic->kind));
+    memcpy(ic->nchild, t->nchild, n * sizeof(int));
+
+    // Padri e posizioni: i figli di un gruppo sono gli ultimi nchild nodi sullo stack
+    int *stack = ic->tree_off; // usato temporaneamente come stack di indici
+    int sp = 0;
+    size_t tree_total = 0, contrib_total = 0;
+    ic->n_leaves = 0;
+    for(int i = 0; i < n; i++) {
+        int k = t->nchild[i];
+        if(t->kind[i] == TOPO_RES) {
+            ic->leaf_node[ic->n_leaves++] = i;
+        } else {
+            for(int j = 0; j < k; j++) {
+                ic->parent[stack[sp - k + j]] = i;
+                ic->child_pos[stack[sp - k + j]] = j;
+            }
+            sp -= k;
+            int blocks = (k + REDUCE_BLOCK - 1) / REDUCE_BLOCK;
+            int size = 1;
+            while(size < blocks)
+                size *= 2;
+            ic->tree_size[i] = size;
+            tree_total += 2 * (size_t)size;
+            contrib_total += k;
+        }
+        stack[sp++] = i;
+    }
+    ic->parent[n - 1] = -1;
+    ic->child_pos[n - 1] = 0;
+
+    ic->tree = xrealloc(ic->tree, tree_total * sizeof(double));
+    ic->contrib = xrealloc(ic->contrib, contrib_total * sizeof(double));
+    size_t off = 0, coff = 0;
+    for(int i = 0; i < n; i++) {
+        if(t->kind[i] == TOPO_RES) {
+            ic->value[i] = t->value[i];
+            ic->tree_off[i] = ic->contrib_off[i] = 0;
+            continue;
+        }
+        int k = t->nchild[i];
+        int size = ic->tree_size[i];
+        double *tree = ic->tree + off;
+        double *contrib = ic->contrib + coff;
+        ic->tree_off[i] = (int)off;
+        ic->contrib_off[i] = (int)coff;
+        off += 2 * (size_t)size;
+        coff += k;
+        // I figli sono già stati valutati: sono gli ultimi nchild nodi prima di i
+        for(int c = i - 1, j = k - 1; j >= 0; c = t->start[c] - 1, j--)
+            contrib[j] = (t->kind[i] == TOPO_PAR) ? recip_pos(ic->value[c]) : ic->value[c];
+        for(int j = 0; j < 2 * size; j++)
+            tree[j] = 0.0;
+        for(int first = 0, b = 0; first < k; first += REDUCE_BLOCK, b++)
+            tree[size + b] = block_sum(contrib + first, (k - first < REDUCE_BLOCK) ? k - first : REDUCE_BLOCK);
+        for(int node = size - 1; node >= 1; node--)
+            tree[node] = tree[2 * node] + tree[2 * node + 1];
+        if(k == 0)
+            tree[1] = 0.0;
+        ic->value[i] = (t->kind[i] == TOPO_PAR) ? recip_pos(tree[1]) : tree[1];
+    }
+}
+
+// Resistenza equivalente corrente
+double inc_value(const IncCircuit *ic) {
+    return ic->n ? ic->value[ic->n - 1] : 0.0;
+}
+
+// Cambia il valore della resistenza "elem" (0-based) e restituisce la nuova Req
+double inc_set(IncCircuit *ic, int elem, double value) {
+    int node = ic->leaf_node[elem];
+    ic->value[node] = value;
+    while(ic->parent[node] >= 0) {
+        int g = ic->parent[node];
+        double v = ic->value[node];
+        inc_update_group(ic, g, ic->child_pos[node], ic->kind[g] == TOPO_PAR ? recip_pos(v) : v);
+        node = g;
+    }
+    return inc_value(ic);
+}
+
+void inc_free(IncCircuit *ic) {
+    free(ic->kind);
+    free(ic->parent);
+    free(ic->child_pos);
+    free(ic->nchild);
+    free(ic->contrib_off);
+    free(ic->contrib);
+    free(ic->tree_off);
+    free(ic->tree_size);
+    free(ic->leaf_node);
+    free(ic->value);
+    free(ic->tree);
+    memset(ic, 0, sizeof(*ic));
+}
+
+// Modalità di taratura: il circuito è dato una volta, poi ogni riga di stdin
+// "ELEMENTO VALORE" (elementi numerati da 1 in ordine di testo) produce la nuova Req
+int run_tune(const Options *opt) {
+    setlocale(LC_NUMERIC, "C");
+    size_t len = strlen(opt->tune);
+    if(!circuit_framed(opt->tune, len)) {
+        fprintf(stderr, "Errore: il circuito deve iniziare con '+' e terminare con '-'.\n");
+        return 1;
+    }
+    CircuitContext *ctx = context_create(opt->stats);
+    ctx->topology_only = 1;
+    parse_circuit_utf8(ctx, opt->tune, len);
+    if(ctx->topo.n_reactive) {
+        fprintf(stderr, "Errore: condensatori e induttori sono supportati solo da --sweep.\n");
+        context_destroy(ctx);
+        return 1;
+    }
+    IncCircuit ic = {0};
+    inc_build(&ic, &ctx->topo);
+    printf("%.17g\n", inc_value(&ic));
+    fflush(stdout);
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    int errors = 0;
+    while(getline(&line, &line_cap, stdin) != -1) {
+        char *p = line;
+        while(*p == ' ' || *p == '\t')
+            p++;
+        if(*p == '\n' || *p == '\0' || *p == '#')
+            continue;
+        // entrambi i campi devono esserci e dopo il valore sono ammessi solo spazi
+        char *after_elem, *end;
+        long elem = strtol(p, &after_elem, 10);
+        double value = strtod(after_elem, &end);
+        int ok = after_elem != p && end != after_elem;
+        while(ok && (*end == ' ' || *end == '\t' || *end == '\r' || *end == '\n'))
+            end++;
+        if(!ok || *end != '\0' || elem < 1 || elem > ic.n_leaves || !isfinite(value) || value < 0) {
+            printf("errore: atteso \"ELEMENTO VALORE\" con ELEMENTO fra 1 e %d\n", ic.n_leaves);
+            errors++;
+        } else {
+            printf("%.17g\n", inc_set(&ic, (int)elem - 1, value));
+        }
+        fflush(stdout);
+    }
+    free(line);
+    inc_free(&ic);
+    context_destroy(ctx);
+    return errors ? 1 : 0;
+}
+
+/* --- STIMA DI PIÙ INCOGNITE (MINIMI QUADRATI) --- */
+// Con k incognite una sola misura non basta: si usano più punti di lavoro, cioè più
+// record (circuiti con le stesse incognite, in genere cambiando le resistenze note)
+// ciascuno con la sua Req misurata. Le incognite sono condivise per posizione: la
+// i-esima 'x' di ogni circuito è la stessa resistenza. I record di un problema sono
+// consecutivi; una riga vuota chiude il problema.
+// Levenberg-Marquardt sui residui relativi (Req(x) - Req_mis) / Req_mis, con parametri
+// ln(x) per restare sulle resistenze positive. Ogni colonna dello jacobiano costa una
+// passata topo_mobius per punto (derivata esatta della funzione lineare fratta).
+#define FIT_MAX_UNKNOWNS 16     // incognite per problema
+#define FIT_MAX_ITER 200        // iterazioni di Levenberg-Marquardt
+#define FIT_CHUNK 4096          // record per blocco (un blocco si chiude fra due problemi)
+
+typedef struct {
+    long line;                  // prima riga del problema
+    const char *status;
+    int unknowns, points, iterations;
+    double rms;                 // residuo relativo quadratico medio
+    double x[FIT_MAX_UNKNOWNS];
+} FitResult;
+
+// Copia gli array di una topologia (per tenere in memoria tutti i punti di un problema)
+static void topo_copy(Topology *dst, const Topology *src) {
+    topo_reserve(dst, src->n);
+    dst->n = src->n;
+    if(src->n) {
+        memcpy(dst->kind, src->kind, src->n * sizeof(*src->kind));
+        memcpy(dst->value, src->value, src->n * sizeof(*src->value));
+        memcpy(dst->elem, src->elem, src->n * sizeof(*src->elem));
+        memcpy(dst->nchild, src->nchild, src->n * sizeof(*src->nchild));
+        memcpy(dst->start, src->start, src->n * sizeof(*src->start));
+        memcpy(dst->unknown, src->unknown, ((src->n + 63) / 64) * sizeof(*src->unknown));
+    }
+    dst->n_unknown = src->n_unknown;
+    dst->n_reactive = src->n_reactive;
+    dst->n_groups = src->n_groups;
+    dst->max_stack = src->max_stack;
+    dst->malformed = src->malformed;
+}
+
+// Residui relativi e, se J non è NULL, jacobiano rispetto a ln(x); restituisce la somma dei quadrati
+static double fit_residuals(Topology *pts, const double *req, int np, int k, const double *x, double *res, double *J) {
+    double cost = 0;
+    for(int i = 0; i < np; i++) {
+        Topology *t = &pts[i];
+        Mobius m;
+        topo_mobius(t, x, 0, t->stack, &m);
+        res[i] = (mobius_eval(&m, x[0]) - req[i]) / req[i];
+        cost += res[i] * res[i];
+        if(!J)
+            continue;
+        for(int j = 0; j < k; j++) {
+            if(j > 0)
+                topo_mobius(t, x, j, t->stack, &m);
+            J[i * k + j] = mobius_slope(&m, x[j]) * x[j] / req[i];
+        }
+    }
+    return cost;
+}
+
+// Fattorizza in posto A = L*L^T (A simmetrica definita positiva k x k, L nel triangolo
+// inferiore); 0 se A non è definita positiva
+static int cholesky_factor(double *A, int k) {
+    for(int j = 0; j < k; j++) {
+        double s = A[j * k + j];
+        for(int p = 0; p < j; p++)
+            s -= A[j * k + p] * A[j * k + p];
+        if(!(s > 0))
+            return 0;
+        A[j * k + j] = sqrt(s);
+        for(int i = j + 1; i < k; i++) {
+            double v = A[i * k + j];
+            for(int p = 0; p < j; p++)
+                v -= A[i * k + p] * A[j * k + p];
+            A[i * k + j] = v / A[j * k + j];
+        }
+    }
+    return 1;
+}
+
+// Risolve L*L^T z = b con il fattore di cholesky_factor; z sovrascrive b
+static void cholesky_subst(const double *L, double *b, int k) {
+    for(int i = 0; i < k; i++) {
+        for(int p = 0; p < i; p++)
+            b[i] -= L[i * k + p] * b[p];
+        b[i] /= L[i * k + i];
+    }
+    for(int i = k - 1; i >= 0; i--) {
+        for(int p = i + 1; p < k; p++)
+            b[i] -= L[p * k + i] * b[p];
+        b[i] /= L[i * k + i];
+    }
+}
+
+// Stima le k incognite dai np punti; work deve avere np * (k + 2) double
+static void fit_unknowns(Topology *pts, const double *req, int np, int k, double *work, FitResult *r) {
+    double *res = work, *res_try = work + np, *J = work + 2 * np;
+    double A[FIT_MAX_UNKNOWNS * FIT_MAX_UNKNOWNS], M[FIT_MAX_UNKNOWNS * FIT_MAX_UNKNOWNS];
+    double g[FIT_MAX_UNKNOWNS], step[FIT_MAX_UNKNOWNS], x_try[FIT_MAX_UNKNOWNS];
+
+    // Punto di partenza: media geometrica delle misure per tutte le incognite
+    double log_mean = 0;
+    for(int i = 0; i < np; i++)
+        log_mean += log(req[i]);
+    for(int j = 0; j < k; j++)
+        r->x[j] = exp(log_mean / np);
+
+    double cost = fit_residuals(pts, req, np, k, r->x, res, J);
+    double lambda = 1e-3;
+    int converged = 0, iter;
+    for(iter = 0; iter < FIT_MAX_ITER && !converged; iter++) {
+        for(int a = 0; a < k; a++) {
+            g[a] = 0;
+            for(int i = 0; i < np; i++)
+                g[a] += J[i * k + a] * res[i];
+            for(int b = 0; b <= a; b++) {
+                double s = 0;
+                for(int i = 0; i < np; i++)
+                    s += J[i * k + a] * J[i * k + b];
+                A[a * k + b] = A[b * k + a] = s;
+            }
+        }
+        int accepted = 0;
+        while(!accepted && lambda < 1e12) {
+            memcpy(M, A, k * k * sizeof(double));
+            for(int a = 0; a < k; a++) {
+                M[a * k + a] += lambda * A[a * k + a] + 1e-30;
+                step[a] = -g[a];
+            }
+            if(cholesky_factor(M, k)) {
+                cholesky_subst(M, step, k);
+                double max_step = 0;
+                for(int a = 0; a < k; a++) {
+                    step[a] = fmax(-10.0, fmin(10.0, step[a]));
+                    x_try[a] = r->x[a] * exp(step[a]);
+                    max_step = fmax(max_step, fabs(step[a]));
+                }
+                double cost_try = fit_residuals(pts, req, np, k, x_try, res_try, NULL);
+                if(cost_try < cost) {
+                    converged = max_step < 1e-12 || cost - cost_try <= 1e-15 * cost;
+                    memcpy(r->x, x_try, k * sizeof(double));
+                    cost = fit_residuals(pts, req, np, k, r->x, res, J);
+                    lambda = fmax(lambda / 10, 1e-12);
+                    accepted = 1;
+                    continue;
+                }
+            }
+            lambda *= 10;
+        }
+        // Nessun passo riduce i residui: siamo in un punto stazionario
+        if(!accepted || cost < 1e-30)
+            converged = 1;
+    }
+    r->iterations = iter;
+    r->rms = sqrt(cost / np);
+    r->status = converged ? "ok" : "not_converged";
+}
+
+// Un blocco di problemi letti dall'input
+typedef struct {
+    char *text;              // circuiti terminati da '\0'
+    size_t text_len, text_cap;
+    size_t *offset;
+    double *req;
+    long *line;
+    int count, cap;          // record
+    int *first;              // primo record di ogni problema (first[problems] = count)
+    FitResult *result;
+    int problems, problems_cap;
+} FitChunk;
+
+// Stato privato di ogni worker: un contesto per il parsing e una topologia per punto
+typedef struct {
+    CircuitContext *ctx;
+    Topology *pts;
+    int pts_cap;
+    double *work;
+    size_t work_cap;
+} FitWorker;
+
+typedef struct {
+    FitChunk *chunk;
+    FitWorker *workers;
+} FitJob;
+
+static void fit_task(void *arg, int worker, long p) {
+    FitJob *job = arg;
+    FitChunk *ch = job->chunk;
+    FitWorker *w = &job->workers[worker];
+    FitResult *r = &ch->result[p];
+    int first = ch->first[p], np = ch->first[p + 1] - first;
+    r->line = ch->line[first];
+    r->status = "ok";
+    r->unknowns = 0;
+    r->points = np;
+    r->iterations = 0;
+    r->rms = 0;
+
+    if(np > w->pts_cap) {
+        w->pts = xrealloc(w->pts, np * sizeof(Topology));
+        memset(w->pts + w->pts_cap, 0, (np - w->pts_cap) * sizeof(Topology));
+        w->pts_cap = np;
+    }
+    for(int i = 0; i < np; i++) {
+        const char *circ = ch->text + ch->offset[first + i];
+        size_t len = strlen(circ);
+        if(!circuit_framed(circ, len)) {
+            r->line = ch->line[first + i];
+            r->status = "bad_format";
+            return;
+        }
+        if(ch->req[first + i] <= 0) {
+            r->line = ch->line[first + i];
+            r->status = "no_req";
+            return;
+        }
+        reset_circuit(w->ctx);
+        parse_circuit_utf8(w->ctx, circ, len);
+        if(w->ctx->topo.n_reactive) {
+            r->line = ch->line[first + i];
+            r->status = "reactive";
+            return;
+        }
+        topo_copy(&w->pts[i], &w->ctx->topo);
+        if(w->pts[i].n_unknown > r->unknowns)
+            r->unknowns = w->pts[i].n_unknown;
+    }
+    int k = r->unknowns;
+    if(k == 0) {
+        r->status = "no_unknowns";
+        return;
+    }
+    if(k > FIT_MAX_UNKNOWNS) {
+        r->status = "too_many_unknowns";
+        return;
+    }
+    if(np < k) {
+        r->status = "underdetermined";
+        return;
+    }
+    size_t need = (size_t)np * (k + 2);
+    if(need > w->work_cap) {
+        w->work = xrealloc(w->work, need * sizeof(double));
+        w->work_cap = need;
+    }
+    struct timespec t0;
+    stats_start(w->ctx->stats, &t0);
+    fit_unknowns(w->pts, ch->req + first, np, k, w->work, r);
+    stats_stop(w->ctx->stats, PHASE_FIT, &t0);
+    STATS_COUNT(w->ctx->stats, solver_iterations, r->iterations);
+}
+
+static void fit_append(FitChunk *ch, const char *circ, size_t len, double req, long line_no) {
+    if(ch->count == ch->cap) {
+        ch->cap = ch->cap ? ch->cap * 2 : 1024;
+        ch->offset = xrealloc(ch->offset, ch->cap * sizeof(size_t));
+        ch->req = xrealloc(ch->req, ch->cap * sizeof(double));
+        ch->line = xrealloc(ch->line, ch->cap * sizeof(long));
+    }
+    if(ch->text_len + len + 1 > ch->text_cap) {
+        size_t cap = ch->text_cap ? ch->text_cap : 1 << 16;
+        while(cap < ch->text_len + len + 1)
+            cap *= 2;
+        ch->text = xrealloc(ch->text, cap);
+        ch->text_cap = cap;
+    }
+    ch->offset[ch->count] = ch->text_len;
+    memcpy(ch->text + ch->text_len, circ, len);
+    ch->text[ch->text_len + len] = '\0';
+    ch->text_len += len + 1;
+    ch->req[ch->count] = req;
+    ch->line[ch->count] = line_no;
+    ch->count++;
+}
+
+// Chiude il problema in corso (se ha almeno un record)
+static void fit_close_problem(FitChunk *ch) {
+    if(ch->count == ch->first[ch->problems])
+        return;
+    if(ch->problems + 2 > ch->problems_cap) {
+        ch->problems_cap = ch->problems_cap ? ch->problems_cap * 2 : 256;
+        ch->first = xrealloc(ch->first, ch->problems_cap * sizeof(int));
+        ch->result = xrealloc(ch->result, ch->problems_cap * sizeof(FitResult));
+    }
+    ch->first[++ch->problems] = ch->count;
+}
+
+static void write_fit_result(FILE *out, const FitResult *r, int json) {
+    int have = strcmp(r->status, "ok") == 0 || strcmp(r->status, "not_converged") == 0;
+    if(json) {
+        fprintf(out, "{\"line\":%ld,\"status\":\"%s\",\"unknowns\":%d,\"points\":%d,\"iterations\":%d,\"rms\":",
+                r->line, r->status, r->unknowns, r->points, r->iterations);
+        put_number(out, r->rms, have, 1);
+        fputs(",\"rx\":", out);
+        if(have) {
+            fputc('[', out);
+            for(int j = 0; j < r->unknowns; j++) {
+                if(j)
+                    fputc(',', out);
+                put_number(out, r->x[j], 1, 1);
+            }
+            fputc(']', out);
+        } else {
+            fputs("null", out);
+        }
+        fputs("}\n", out);
+    } else {
+        fprintf(out, "%ld,%s,%d,%d,%d,", r->line, r->status, r->unknowns, r->points, r->iterations);
+        put_number(out, r->rms, have, 0);
+        fputc(',', out);
+        for(int j = 0; have && j < r->unknowns; j++) {
+            if(j)
+                fputc(';', out);
+            put_number(out, r->x[j], 1, 0);
+        }
+        fputc('\n', out);
+    }
+}
+
+// Modalità di stima: record "circuito Req" raggruppati in problemi da righe vuote.
+// I problemi di un blocco sono risolti in parallelo dal pool, come nel batch.
+int run_fit(const Options *opt) {
+    FILE *in = open_input(opt->input);
+    if(!in)
+        return 1;
+    setlocale(LC_NUMERIC, "C");
+    static char out_buf[1 << 16];
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+    if(!opt->json)
+        fputs("line,status,unknowns,points,iterations,rms,rx\n", stdout);
+
+    WorkPool pool;
+    pool_init(&pool, opt->threads > 0 ? opt->threads : online_cpus());
+    FitWorker *workers = calloc(pool.nthreads, sizeof(FitWorker));
+    FitChunk *chunk = calloc(1, sizeof(FitChunk));
+    if(!workers || !chunk) {
+        fprintf(stderr, "Errore di allocazione!\n");
+        exit(1);
+    }
+    for(int w = 0; w < pool.nthreads; w++) {
+        workers[w].ctx = context_create(opt->stats);
+        workers[w].ctx->topology_only = 1;
+    }
+    FitJob job = { chunk, workers };
+    chunk->problems_cap = 256;
+    chunk->first = xrealloc(NULL, chunk->problems_cap * sizeof(int));
+    chunk->result = xrealloc(NULL, chunk->problems_cap * sizeof(FitResult));
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    long line_no = 0, problems = 0, errors = 0;
+    ssize_t n;
+    int eof = 0;
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    while(!eof) {
+        chunk->count = 0;
+        chunk->text_len = 0;
+        chunk->problems = 0;
+        chunk->first[0] = 0;
+        // Il blocco si chiude solo fra due problemi, dopo FIT_CHUNK record
+        while(chunk->count < FIT_CHUNK || chunk->count != chunk->first[chunk->problems]) {
+            if((n = getline(&line, &line_cap, in)) == -1) {
+                eof = 1;
+                break;
+            }
+            line_no++;
+            char *circ;
+            size_t circ_len;
+            double Req, I, V;
+            if(!split_record(line, n, &circ, &circ_len, &Req, &I, &V)) {
+                if(line[strspn(line, " \t;")] == '\0')
+                    fit_close_problem(chunk);
+                continue;
+            }
+            fit_append(chunk, circ, circ_len, Req, line_no);
+        }
+        fit_close_problem(chunk);
+        if(chunk->problems == 0)
+            continue;
+
+        pool_run(&pool, chunk->problems, fit_task, &job);
+
+        for(int p = 0; p < chunk->problems; p++) {
+            write_fit_result(stdout, &chunk->result[p], opt->json);
+            if(strcmp(chunk->result[p].status, "ok") != 0)
+                errors++;
+        }
+        problems += chunk->problems;
+    }
+
+    fflush(stdout);
+    fprintf(stderr, "Stima completata: %ld problemi, %ld con errori, %d thread, %.3g s.\n",
+            problems, errors, pool.nthreads, elapsed_since(&t0));
+    for(int w = 0; w < pool.nthreads; w++) {
+        context_destroy(workers[w].ctx);
+        for(int i = 0; i < workers[w].pts_cap; i++)
+            topo_free(&workers[w].pts[i]);
+        free(workers[w].pts);
+        free(workers[w].work);
+    }
+    pool_destroy(&pool);
+    free(workers);
+    free(chunk->text);
+    free(chunk->offset);
+    free(chunk->req);
+    free(chunk->line);
+    free(chunk->first);
+    free(chunk->result);
+    free(chunk);
+    free(line);
+    if(in != stdin)
+        fclose(in);
+    return 0;
+}
+
+/* --- SINTESI DI RETI CON VALORI NORMALIZZATI --- */
+// Problema inverso: quale combinazione serie/parallelo di al più k resistenze di una serie
+// normalizzata (E12, E24, E96, da 1 Ω a 10 MΩ) dà una Req entro la tolleranza?
+// Ogni rete serie-parallelo con n parti è la serie o il parallelo di due reti più piccole,
+// quindi basta comporre a coppie. Le reti parziali sono memorizzate in tabelle ordinate per
+// valore: tutte le coppie (esatta) e, per k = 5, una terna per ogni bucket di valore
+// (risoluzione relativa 2^-16). Per ogni numero di parti si fissa la parte esterna della
+// rete (una resistenza o una coppia, con la sua operazione) e nella tabella si cerca solo la
+// finestra di valori che porta la Req entro il limite corrente (branch and bound). Il
+// limite si stringe man mano che si trovano candidati ed esclude le reti che non battono
+// quelle con meno parti. Le parti esterne sono divise fra i worker del pool. Ogni candidato
+// è riscritto in forma canonica e rivalutato con il parser e la valutazione di sempre, così
+// Req e ordinamento coincidono con le altre modalità e non dipendono dai thread.
+#define SYNTH_MAX_PARTS 5
+#define SYNTH_MAX_TOP 100
+#define SYNTH_DECADES 7          // da 1 Ω a 10 MΩ (escluso)
+#define SYNTH_BUCKET_BITS 16     // bit di mantissa nella chiave dei bucket
+#define SYNTH_CHUNK 2048         // coppie per task
+#define SYNTH_TEXT 160           // lunghezza massima di un circuito sintetizzato
+#define SYNTH_SERIES (-1)        // token delle operazioni nelle reti in forma postfissa
+#define SYNTH_PAR (-2)
+#define SYNTH_EMPTY UINT32_MAX
+#define SYNTH_EPS 1e-12          // scarto relativo dovuto solo agli arrotondamenti
+
+static const short E12_VALUES[] = { 10, 12, 15, 18, 22, 27, 33, 39, 47, 56, 68, 82 };
+static const short E24_VALUES[] = { 10, 11, 12, 13, 15, 16, 18, 20, 22, 24, 27, 30,
+                                    33, 36, 39, 43, 47, 51, 56, 62, 68, 75, 82, 91 };
+static const short E96_VALUES[] = {
+    100, 102, 105, 107, 110, 113, 115, 118, 121, 124, 127, 130, 133, 137, 140, 143,
+    147, 150, 154, 158, 162, 165, 169, 174, 178, 182, 187, 191, 196, 200, 205, 210,
+    215, 221, 226, 232, 237, 243, 249, 255, 261, 267, 274, 280, 287, 294, 301, 309,
+    316, 324, 332, 340, 348, 357, 365, 374, 383, 392, 402, 412, 422, 432, 442, 453,
+    464, 475, 487, 499, 511, 523, 536, 549, 562, 576, 590, 604, 619, 634, 649, 665,
+    681, 698, 715, 732, 750, 768, 787, 806, 825, 845, 866, 887, 909, 931, 953, 976 };
+
+typedef struct {
+    const char *name;
+    const short *mantissa;
+    int count;
+    int digits;                 // cifre significative
+} ESeries;
+
+static const ESeries E_SERIES[] = {
+    { "E12", E12_VALUES, 12, 2 },
+    { "E24", E24_VALUES, 24, 2 },
+    { "E96", E96_VALUES, 96, 3 },
+};
+
+// Rete in forma postfissa: indici delle resistenze e token delle operazioni
+typedef struct {
+    short tok[2 * SYNTH_MAX_PARTS - 1];
+    int n;
+} SynthNet;
+
+typedef struct {
+    double value;
+    uint32_t code;              // i | j << 10 | op << 20 con i <= j (op: 0 serie, 1 parallelo)
+} SynthPair;
+
+typedef struct {
+    double err;                 // |Req - obiettivo|
+    double req;
+    int parts;
+    char text[SYNTH_TEXT];
+} SynthCand;
+
+typedef struct {
+    CircuitContext *ctx;
+    SynthCand *cand;            // migliori candidati del worker, in ordine
+    int n_cand;
+} SynthWorker;
+
+// Parte esterna fissata: la rete è op[0](value[0], op[1](value[1], ... X)), con i token
+// delle sottoreti fisse in "pre" a partire dalla più esterna
+typedef struct {
+    SynthNet pre;
+    int n;
+    int op[2];
+    double value[2];
+} SynthFrame;
+
+typedef struct {
+    double target, limit;       // obiettivo e scarto massimo ammesso dalla tolleranza
+    double best;                // scarto migliore ottenuto con meno parti
+    int parts, top;
+    double *leaf;
+    int n_leaf;
+    SynthPair *pair;
+    long n_pair;
+    uint64_t key_base;
+    long n_buckets;
+    uint32_t *pair_start;       // per bucket: prima coppia con chiave non inferiore
+    uint32_t *triple;           // per bucket: x | coppia << 10 | op << 29 (SYNTH_EMPTY = vuoto)
+    SynthWorker *workers;
+} Synth;
+
+static inline double synth_op(int op, double a, double b) {
+    return op == SYNTH_SERIES ? a + b : a * b / (a + b);
+}
+
+// Bucket di un valore: esponente e primi bit della mantissa, quindi monotono nel valore
+static inline long synth_bucket(const Synth *s, double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    uint64_t key = bits >> (52 - SYNTH_BUCKET_BITS);
+    if(v <= 0 || key < s->key_base)
+        return 0;
+    if(key - s->key_base >= (uint64_t)s->n_buckets)
+        return s->n_buckets - 1;
+    return (long)(key - s->key_base);
+}
+
+static inline int synth_code_op(uint32_t bit) {
+    return bit ? SYNTH_PAR : SYNTH_SERIES;
+}
+
+static inline double triple_value(const Synth *s, uint32_t code) {
+    return synth_op(synth_code_op(code >> 29), s->leaf[code & 1023],
+                    s->pair[(code >> 10) & 0x7FFFF].value);
+}
+
+static inline void net_push(SynthNet *n, int tok) {
+    n->tok[n->n++] = (short)tok;
+}
+
+static void net_pair(SynthNet *n, uint32_t code) {
+    net_push(n, code & 1023);
+    net_push(n, (code >> 10) & 1023);
+    net_push(n, synth_code_op(code >> 20));
+}
+
+static void net_triple(const Synth *s, SynthNet *n, uint32_t code) {
+    net_push(n, code & 1023);
+    net_pair(n, s->pair[(code >> 10) & 0x7FFFF].code);
+    net_push(n, synth_code_op(code >> 29));
+}
+
+// Scarto massimo che un nuovo candidato del worker deve rispettare: con più parti bisogna
+// migliorare le reti più piccole di più degli arrotondamenti
+static double synth_bound(const Synth *s, const SynthWorker *w) {
+    double b = s->best - s->target * SYNTH_EPS;
+    if(s->limit < b)
+        b = s->limit;
+    if(w->n_cand == s->top && w->cand[s->top - 1].err < b)
+        b = w->cand[s->top - 1].err;
+    return b;
+}
+
+/* Forma canonica: le catene di serie e di parallelo sono appiattite e i loro termini
+   ordinati per valore decrescente (a parità, per testo), così le varianti della stessa
+   rete trovate per strade diverse danno lo stesso circuito. */
+typedef struct {
+    int op;                     // 0 per una resistenza
+    double value;
+    int a, b;
+} SynthNode;
+
+static int synth_terms(const SynthNode *nd, int i, int op, int *out, int n) {
+    if(nd[i].op == op) {
+        n = synth_terms(nd, nd[i].a, op, out, n);
+        return synth_terms(nd, nd[i].b, op, out, n);
+    }
+    out[n] = i;
+    return n + 1;
+}
+
+static int synth_write(const SynthNode *nd, int i, char *out);
+
+// Scrive i termini di una catena (serie: "a_b", parallelo: "*a||b=||c=*") in ordine canonico
+static int synth_write_chain(const SynthNode *nd, int i, int op, char *out) {
+    int term[SYNTH_MAX_PARTS], len[SYNTH_MAX_PARTS];
+    char text[SYNTH_MAX_PARTS][SYNTH_TEXT];
+    int n = synth_terms(nd, i, op, term, 0);
+    for(int k = 0; k < n; k++)
+        len[k] = synth_write(nd, term[k], text[k]);
+    // ordinamento per inserzione (al più SYNTH_MAX_PARTS termini)
+    int order[SYNTH_MAX_PARTS];
+    for(int k = 0; k < n; k++) {
+        int j = k;
+        while(j > 0) {
+            const SynthNode *p = &nd[term[order[j - 1]]], *q = &nd[term[k]];
+            if(p->value > q->value || (p->value == q->value && strcmp(text[order[j - 1]], text[k]) <= 0))
+                break;
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = k;
+    }
+    int pos = 0;
+    if(op == SYNTH_PAR)
+        out[pos++] = '*';
+    for(int k = 0; k < n; k++) {
+        if(k > 0) {
+            memcpy(out + pos, op == SYNTH_SERIES ? "_" : "||", op == SYNTH_SERIES ? 1 : 2);
+            pos += op == SYNTH_SERIES ? 1 : 2;
+        }
+        memcpy(out + pos, text[order[k]], len[order[k]]);
+        pos += len[order[k]];
+        if(op == SYNTH_PAR && k > 0)
+            out[pos++] = '=';
+    }
+    if(op == SYNTH_PAR)
+        out[pos++] = '*';
+    return pos;
+}
+
+// Scrive il nodo i come termine di una catena: una resistenza o una catena dell'altro tipo
+static int synth_write(const SynthNode *nd, int i, char *out) {
+    if(nd[i].op == 0)
+        return snprintf(out, SYNTH_TEXT, "%.15g", nd[i].value);
+    return synth_write_chain(nd, i, nd[i].op, out);
+}
+
+// Testo canonico "+...-" della rete
+static int synth_text(const Synth *s, const SynthNet *net, char *out) {
+    SynthNode nd[2 * SYNTH_MAX_PARTS - 1];
+    int stack[SYNTH_MAX_PARTS], sp = 0;
+    for(int k = 0; k < net->n; k++) {
+        int t = net->tok[k];
+        if(t >= 0) {
+            nd[k] = (SynthNode){ 0, s->leaf[t], -1, -1 };
+        } else {
+            int b = stack[--sp], a = stack[--sp];
+            nd[k] = (SynthNode){ t, synth_op(t, nd[a].value, nd[b].value), a, b };
+        }
+        stack[sp++] = k;
+    }
+    out[0] = '+';
+    int len = 1 + synth_write_chain(nd, net->n - 1, SYNTH_SERIES, out + 1);
+    out[len++] = '-';
+    out[len] = '\0';
+    return len;
+}
+
+static int synth_cmp(const SynthCand *a, const SynthCand *b) {
+    if(a->err != b->err)
+        return a->err < b->err ? -1 : 1;
+    return strcmp(a->text, b->text);
+}
+
+static int synth_qsort_cmp(const void *a, const void *b) {
+    return synth_cmp(a, b);
+}
+
+// Inserisce c nella lista ordinata di al più "top" voci, scartando i duplicati
+static void synth_insert(SynthCand *list, int *n, int top, const SynthCand *c) {
+    int pos = 0;
+    while(pos < *n) {
+        int r = synth_cmp(c, &list[pos]);
+        if(r == 0)
+            return;
+        if(r < 0)
+            break;
+        pos++;
+    }
+    if(pos >= top)
+        return;
+    int moved = (*n < top ? *n : top - 1) - pos;
+    memmove(&list[pos + 1], &list[pos], moved * sizeof(SynthCand));
+    list[pos] = *c;
+    if(*n < top)
+        (*n)++;
+}
+
+// Valuta un candidato trovato dalla ricerca: se resta entro il limite (a meno degli
+// arrotondamenti della ricerca), lo riscrive in forma canonica e lo rivaluta
+static void synth_offer(Synth *s, SynthWorker *w, const SynthNet *net, double value) {
+    if(fabs(value - s->target) > synth_bound(s, w) + s->target * 1e-14)
+        return;
+    SynthCand c;
+    int len = synth_text(s, net, c.text);
+    parse_circuit_utf8(w->ctx, c.text, len);
+    c.req = evaluate_topology(&w->ctx->topo, w->ctx->topo.stack);
+    c.err = fabs(c.req - s->target);
+    c.parts = s->parts;
+    if(c.err > s->limit || c.err >= s->best - s->target * SYNTH_EPS)
+        return;
+    synth_insert(w->cand, &w->n_cand, s->top, &c);
+}
+
+// Finestra dei valori di X che portano la rete della cornice entro lo scarto b
+static int synth_window(const Synth *s, const SynthFrame *f, double b, double *lo, double *hi) {
+    if(b < 0)
+        return 0;
+    double l = s->target - b, h = s->target + b;
+    for(int k = 0; k < f->n; k++) {
+        double a = f->value[k];
+        if(f->op[k] == SYNTH_SERIES) {
+            l -= a;
+            h -= a;
+            if(h <= 0)
+                return 0;
+        } else {
+            // parallelo: Req < a, e X = 1 / (1/Req - 1/a) cresce con Req
+            if(a <= l)
+                return 0;
+            double g = 1.0 / h - 1.0 / a;
+            l = 1.0 / (1.0 / l - 1.0 / a);
+            h = g > 0 ? 1.0 / g : INFINITY;
+        }
+    }
+    // margine per gli arrotondamenti: synth_offer ricontrolla ogni candidato
+    *lo = l * (1 - 1e-9);
+    *hi = h * (1 + 1e-9);
+    return 1;
+}
+
+// Chiude la rete con la parte interna X (token già in net) e la propone
+static void synth_close(Synth *s, SynthWorker *w, const SynthFrame *f, SynthNet *net, double x) {
+    for(int k = f->n - 1; k >= 0; k--) {
+        x = synth_op(f->op[k], f->value[k], x);
+        net_push(net, f->op[k]);
+    }
+    synth_offer(s, w, net, x);
+}
+
+// Cerca la parte interna con "parts" resistenze nella tabella corrispondente
+static void synth_query(Synth *s, SynthWorker *w, const SynthFrame *f, int parts) {
+    double lo, hi;
+    if(!synth_window(s, f, synth_bound(s, w), &lo, &hi))
+        return;
+    SynthNet net;
+    if(parts == 1) {
+        int a = 0, b = s->n_leaf;
+        while(a < b) {
+            int m = (a + b) / 2;
+            if(s->leaf[m] < lo)
+                a = m + 1;
+            else
+                b = m;
+        }
+        for(int i = a; i < s->n_leaf && s->leaf[i] <= hi; i++) {
+            net = f->pre;
+            net_push(&net, i);
+            synth_close(s, w, f, &net, s->leaf[i]);
+        }
+    } else if(parts == 2) {
+        long i = s->pair_start[synth_bucket(s, lo)];
+        while(i < s->n_pair && s->pair[i].value < lo)
+            i++;
+        for(; i < s->n_pair && s->pair[i].value <= hi; i++) {
+            net = f->pre;
+            net_pair(&net, s->pair[i].code);
+            synth_close(s, w, f, &net, s->pair[i].value);
+        }
+    } else {
+        for(long k = synth_bucket(s, lo), end = synth_bucket(s, hi); k <= end; k++) {
+            uint32_t code = s->triple[k];
+            if(code == SYNTH_EMPTY)
+                continue;
+            double v = triple_value(s, code);
+            if(v < lo || v > hi)
+                continue;
+            net = f->pre;
+            net_triple(s, &net, code);
+            synth_close(s, w, f, &net, v);
+        }
+    }
+}
+
+static void frame_add(SynthFrame *f, int op, double value) {
+    f->op[f->n] = op;
+    f->value[f->n] = value;
+    f->n++;
+}
+
+// Coppie A (in ordine di valore) da combinare con op con un'altra coppia B nella finestra
+// [lo, hi]: basta la maggiore in serie (A >= lo/2) e la minore in parallelo (A <= 2 hi)
+static void pair_range(const Synth *s, int op, double lo, double hi, long *first, long *last) {
+    double a = op == SYNTH_SERIES ? lo / 2 : lo;
+    double b = op == SYNTH_SERIES ? hi : 2 * hi;
+    long i = s->pair_start[synth_bucket(s, a)];
+    while(i < s->n_pair && s->pair[i].value < a)
+        i++;
+    long j = i;
+    while(j < s->n_pair && s->pair[j].value <= b)
+        j++;
+    *first = i;
+    *last = j;
+}
+
+// Reti con la resistenza x come termine esterno
+static void synth_from_leaf(Synth *s, SynthWorker *w, int x) {
+    static const int ops[2] = { SYNTH_SERIES, SYNTH_PAR };
+    for(int o = 0; o < 2; o++) {
+        SynthFrame f = { .n = 0 };
+        net_push(&f.pre, x);
+        frame_add(&f, ops[o], s->leaf[x]);
+        if(s->parts == 3) {
+            synth_query(s, w, &f, 2);
+            continue;
+        }
+        // x op (y op' R) e x op (A op' B) con op' diversa da op: con la stessa operazione
+        // la rete è già (x op y) op R o (x op A) op B, trovata dalle coppie esterne
+        int op2 = ops[1 - o];
+        for(int y = 0; y < s->n_leaf; y++) {
+            SynthFrame g = f;
+            net_push(&g.pre, y);
+            frame_add(&g, op2, s->leaf[y]);
+            synth_query(s, w, &g, s->parts - 2);
+        }
+        if(s->parts == 5) {
+            double lo, hi;
+            long first, last;
+            if(!synth_window(s, &f, synth_bound(s, w), &lo, &hi))
+                continue;
+            pair_range(s, op2, lo, hi, &first, &last);
+            for(long a = first; a < last; a++) {
+                SynthFrame g = f;
+                net_pair(&g.pre, s->pair[a].code);
+                frame_add(&g, op2, s->pair[a].value);
+                synth_query(s, w, &g, 2);
+            }
+        }
+    }
+}
+
+// Reti con una coppia esterna A presa dal blocco di coppie [first, first + SYNTH_CHUNK)
+static void synth_from_pairs(Synth *s, SynthWorker *w, long first) {
+    static const int ops[2] = { SYNTH_SERIES, SYNTH_PAR };
+    long end = first + SYNTH_CHUNK < s->n_pair ? first + SYNTH_CHUNK : s->n_pair;
+    for(int o = 0; o < 2; o++) {
+        double b = synth_bound(s, w), lo = s->target - b, hi = s->target + b;
+        long a0 = 0, a1 = s->n_pair;
+        if(s->parts == 4) {
+            pair_range(s, ops[o], lo, hi, &a0, &a1);
+        } else if(ops[o] == SYNTH_SERIES) {
+            a1 = s->pair_start[synth_bucket(s, hi) + 1];   // A < Req
+        } else {
+            a0 = s->pair_start[synth_bucket(s, lo)];       // A > Req
+        }
+        for(long a = first > a0 ? first : a0; a < end && a < a1; a++) {
+            SynthFrame f = { .n = 0 };
+            net_pair(&f.pre, s->pair[a].code);
+            frame_add(&f, ops[o], s->pair[a].value);
+            synth_query(s, w, &f, s->parts - 2);
+        }
+    }
+}
+
+static void synth_task(void *arg, int worker, long index) {
+    Synth *s = arg;
+    SynthWorker *w = &s->workers[worker];
+    if(s->parts <= 2) {
+        SynthFrame f = { .n = 0 };
+        synth_query(s, w, &f, s->parts);
+    } else if(index < s->n_leaf) {
+        synth_from_leaf(s, w, (int)index);
+    } else {
+        synth_from_pairs(s, w, (index - s->n_leaf) * SYNTH_CHUNK);
+    }
+}
+
+// Terne x op (coppia) della resistenza x: ogni bucket tiene la terna con il codice minore,
+// quindi il risultato non dipende dall'ordine dei worker
+static void synth_triple_task(void *arg, int worker, long x) {
+    Synth *s = arg;
+    (void)worker;
+    for(uint32_t op = 0; op < 2; op++) {
+        for(long p = 0; p < s->n_pair; p++) {
+            uint32_t pc = s->pair[p].code;
+            // x op (y op z) con la stessa operazione: basta la x di indice massimo
+            if((pc >> 20) == op && x < (long)((pc >> 10) & 1023))
+                continue;
+            long k = synth_bucket(s, synth_op(synth_code_op(op), s->leaf[x], s->pair[p].value));
+            uint32_t code = (uint32_t)x | (uint32_t)p << 10 | op << 29;
+            uint32_t cur = __atomic_load_n(&s->triple[k], __ATOMIC_RELAXED);
+            while(code < cur && !__atomic_compare_exchange_n(&s->triple[k], &cur, code, 1,
+                                                             __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                ;
+        }
+    }
+}
+
+static int synth_pair_cmp(const void *a, const void *b) {
+    const SynthPair *p = a, *q = b;
+    if(p->value != q->value)
+        return p->value < q->value ? -1 : 1;
+    return p->code < q->code ? -1 : p->code > q->code;
+}
+
+static uint64_t synth_key(double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return bits >> (52 - SYNTH_BUCKET_BITS);
+}
+
+// Resistenze della serie, tabella delle coppie e, per 5 parti, delle terne
+static void synth_tables(Synth *s, const ESeries *es, int max_parts, WorkPool *pool) {
+    s->n_leaf = SYNTH_DECADES * es->count;
+    s->leaf = xrealloc(NULL, s->n_leaf * sizeof(double));
+    for(int d = 0, n = 0; d < SYNTH_DECADES; d++)
+        for(int m = 0; m < es->count; m++) {
+            int e = d - (es->digits - 1);
+            s->leaf[n++] = e >= 0 ? es->mantissa[m] * POW10[e] : es->mantissa[m] / POW10[-e];
+        }
+
+    s->n_pair = (long)s->n_leaf * (s->n_leaf + 1);
+    s->pair = xrealloc(NULL, s->n_pair * sizeof(SynthPair));
+    long n = 0;
+    for(uint32_t i = 0; i < (uint32_t)s->n_leaf; i++)
+        for(uint32_t j = i; j < (uint32_t)s->n_leaf; j++)
+            for(uint32_t op = 0; op < 2; op++)
+                s->pair[n++] = (SynthPair){ synth_op(synth_code_op(op), s->leaf[i], s->leaf[j]),
+                                            i | j << 10 | op << 20 };
+    qsort(s->pair, s->n_pair, sizeof(SynthPair), synth_pair_cmp);
+
+    // Ogni rete sta fra leaf[0] / k e k * leaf[max]: il margine copre gli arrotondamenti
+    s->key_base = synth_key(s->leaf[0] / (2 * SYNTH_MAX_PARTS));
+    s->n_buckets = (long)(synth_key(s->leaf[s->n_leaf - 1] * 2 * SYNTH_MAX_PARTS) - s->key_base) + 1;
+    s->pair_start = xrealloc(NULL, (s->n_buckets + 1) * sizeof(uint32_t));
+    long i = 0;
+    for(long k = 0; k < s->n_buckets; k++) {
+        while(i < s->n_pair && synth_bucket(s, s->pair[i].value) < k)
+            i++;
+        s->pair_start[k] = (uint32_t)i;
+    }
+    s->pair_start[s->n_buckets] = (uint32_t)s->n_pair;
+
+    if(max_parts >= 5) {
+        s->triple = xrealloc(NULL, s->n_buckets * sizeof(uint32_t));
+        memset(s->triple, 0xFF, s->n_buckets * sizeof(uint32_t));
+        pool_run(pool, s->n_leaf, synth_triple_task, s);
+    }
+}
+
+// Modalità di sintesi: per ogni numero di parti fino a --parts stampa i migliori candidati
+// entro la tolleranza che battono tutti quelli con meno parti
+int run_synth(const Options *opt) {
+    setlocale(LC_NUMERIC, "C");
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    const ESeries *es = &E_SERIES[opt->synth_series];
+
+    Synth s = {0};
+    s.target = opt->synth;
+    s.limit = opt->tolerance * opt->synth;
+    s.best = INFINITY;
+    s.top = opt->synth_top;
+    WorkPool pool;
+    pool_init(&pool, opt->threads > 0 ? opt->threads : online_cpus());
+    synth_tables(&s, es, opt->synth_parts, &pool);
+    s.workers = calloc(pool.nthreads, sizeof(SynthWorker));
+    SynthCand *merged = malloc((size_t)pool.nthreads * s.top * sizeof(SynthCand));
+    if(!s.workers || !merged) {
+        fprintf(stderr, "Errore di allocazione!\n");
+        exit(1);
+    }
+    for(int w = 0; w < pool.nthreads; w++) {
+        s.workers[w].ctx = context_create(opt->stats);
+        s.workers[w].ctx->topology_only = 1;
+        s.workers[w].cand = xrealloc(NULL, s.top * sizeof(SynthCand));
+    }
+
+    static char out_buf[1 << 16];
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+    fputs("parts,req,error,circuit\n", stdout);
+    int found = 0;
+    for(s.parts = 1; s.parts <= opt->synth_parts; s.parts++) {
+        for(int w = 0; w < pool.nthreads; w++)
+            s.workers[w].n_cand = 0;
+        long ntasks = s.parts <= 2 ? 1 : s.n_leaf;
+        if(s.parts >= 4)
+            ntasks += (s.n_pair + SYNTH_CHUNK - 1) / SYNTH_CHUNK;
+        pool_run(&pool, ntasks, synth_task, &s);
+
+        // Unione delle liste dei worker: stesso ordine totale, duplicati adiacenti
+        int n = 0;
+        for(int w = 0; w < pool.nthreads; w++) {
+            memcpy(merged + n, s.workers[w].cand, s.workers[w].n_cand * sizeof(SynthCand));
+            n += s.workers[w].n_cand;
+        }
+        qsort(merged, n, sizeof(SynthCand), synth_qsort_cmp);
+        for(int k = 0, shown = 0; k < n && shown < s.top; k++) {
+            if(k > 0 && synth_cmp(&merged[k], &merged[k - 1]) == 0)
+                continue;
+            printf("%d,%.17g,%.3g,%s\n", merged[k].parts, merged[k].req,
+                   (merged[k].req - s.target) / s.target, merged[k].text);
+            shown++;
+            found++;
+        }
+        if(n > 0)
+            s.best = merged[0].err;
+    }
+    fflush(stdout);
+    if(found == 0)
+        fprintf(stderr, "Nessuna combinazione di al più %d resistenze %s entro la tolleranza.\n",
+                opt->synth_parts, es->name);
+    fprintf(stderr, "Sintesi completata: %d candidati fino a %d parti (serie %s), %d thread, %.3g s.\n",
+            found, opt->synth_parts, es->name, pool.nthreads, elapsed_since(&t0));
+
+    for(int w = 0; w < pool.nthreads; w++) {
+        context_destroy(s.workers[w].ctx);
+        free(s.workers[w].cand);
+    }
+    pool_destroy(&pool);
+    free(s.workers);
+    free(merged);
+    free(s.leaf);
+    free(s.pair);
+    free(s.pair_start);
+    free(s.triple);
+    return found > 0 ? 0 : 1;
+}
+
+/* --- ANALISI NODALE DI RETI GENERICHE (NETLIST) --- */
+// La grammatica a blocchi descrive solo circuiti serie-parallelo. Ponti, maglie e griglie
+// di resistenze si danno come netlist: una riga "NODO_A NODO_B R" per resistenza, con
+// nomi dei nodi liberi e R = 0 per un cortocircuito. Con il terminale B a massa e 1 A
+// iniettato in A, l'analisi nodale dà il sistema G*v = e_A, dove G è il laplaciano delle
+// conduttanze senza la riga e la colonna di B (simmetrico definito positivo), e Req = v_A.
+// G è memorizzato in CSR e risolto con gradiente coniugato flessibile precondizionato da
+// un multigrid algebrico ad aggregazione (schema AGMG di Notay): due passate di
+// accoppiamento sui collegamenti più forti raggruppano i nodi a quattro a quattro e le
+// conduttanze fra gruppi diversi sono sommate, per cui ogni livello è di nuovo un
+// laplaciano (più le perdite verso massa). Il ciclo è un K-cycle: su ogni livello
+// grossolano due passi di gradiente coniugato invece di una sola correzione, così le
+// iterazioni restano quasi costanti al crescere della rete anche per catene e scale.
+#define MNA_MAX_LEVELS 32
+#define MNA_COARSE 512          // nodi sotto cui l'ultimo livello è risolto in forma densa
+#define MNA_MAX_ITER 1000
+#define MNA_TOL 1e-12           // residuo relativo del gradiente coniugato
+#define MNA_SWEEPS 2            // passate di Gauss-Seidel prima e dopo la correzione
+
+typedef struct {
+    char *names;                // nomi dei nodi, terminati da '\0'
+    size_t names_len, names_cap;
+    size_t *name_off;           // inizio del nome di ogni nodo
+    int n_nodes, nodes_cap;
+    int *table;                 // tabella hash (indirizzamento aperto): nodo o -1
+    size_t table_cap;
+    int *ea, *eb;               // estremi di ogni resistenza
+    double *er;                 // valore di ogni resistenza
+    int n_edges, edges_cap;
+} Netlist;
+
+static uint64_t hash_name(const char *s, size_t len) {
+    uint64_t h = 1469598103934665603ULL; // FNV-1a
+    for(size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void netlist_rehash(Netlist *nl) {
+    size_t cap = nl->table_cap ? nl->table_cap * 2 : 1024;
+    int *table = xrealloc(NULL, cap * sizeof(int));
+    memset(table, -1, cap * sizeof(int));
+    for(int i = 0; i < nl->n_nodes; i++) {
+        const char *name = nl->names + nl->name_off[i];
+        size_t h = hash_name(name, strlen(name)) & (cap - 1);
+        while(table[h] >= 0)
+            h = (h + 1) & (cap - 1);
+        table[h] = i;
+    }
+    free(nl->table);
+    nl->table = table;
+    nl->table_cap = cap;
+}
+
+// Indice del nodo con il nome dato; se create è 0 e il nodo non esiste restituisce -1
+static int netlist_node(Netlist *nl, const char *name, size_t len, int create) {
+    if(2 * (size_t)(nl->n_nodes + 1) > nl->table_cap)
+        netlist_rehash(nl);
+    size_t h = hash_name(name, len) & (nl->table_cap - 1);
+    while(nl->table[h] >= 0) {
+        const char *other = nl->names + nl->name_off[nl->table[h]];
+        if(strncmp(other, name, len) == 0 && other[len] == '\0')
+            return nl->table[h];
+        h = (h + 1) & (nl->table_cap - 1);
+    }
+    if(!create)
+        return -1;
+    if(nl->n_nodes == nl->nodes_cap) {
+        nl->nodes_cap = nl->nodes_cap ? nl->nodes_cap * 2 : 1024;
+        nl->name_off = xrealloc(nl->name_off, nl->nodes_cap * sizeof(size_t));
+    }
+    if(nl->names_len + len + 1 > nl->names_cap) {
+        size_t cap = nl->names_cap ? nl->names_cap : 1 << 16;
+        while(cap < nl->names_len + len + 1)
+            cap *= 2;
+        nl->names = xrealloc(nl->names, cap);
+        nl->names_cap = cap;
+    }
+    memcpy(nl->names + nl->names_len, name, len);
+    nl->names[nl->names_len + len] = '\0';
+    nl->name_off[nl->n_nodes] = nl->names_len;
+    nl->names_len += len + 1;
+    nl->table[h] = nl->n_nodes;
+    return nl->n_nodes++;
+}
+
+// Legge la netlist; in caso di errore restituisce la riga colpevole, altrimenti 0
+static long netlist_read(FILE *in, Netlist *nl) {
+    char *line = NULL;
+    size_t line_cap = 0;
+    long line_no = 0, bad = 0;
+    ssize_t n;
+    while(!bad && (n = getline(&line, &line_cap, in)) != -1) {
+        line_no++;
+        while(n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r'))
+            line[--n] = '\0';
+        char *p = line, *tok[2];
+        size_t len[2];
+        while(*p && is_field_sep(*p))
+            p++;
+        if(*p == '\0' || *p == '#')
+            continue;
+        for(int t = 0; t < 2; t++) {
+            while(*p && is_field_sep(*p))
+                p++;
+            tok[t] = p;
+            while(*p && !is_field_sep(*p))
+                p++;
+            len[t] = p - tok[t];
+        }
+        // R deve occupare tutto il suo campo; dopo sono ammessi solo separatori o un commento
+        while(*p && is_field_sep(*p))
+            p++;
+        char *field = p, *end = p;
+        while(*p && !is_field_sep(*p)) {
+            if(*p == ',')
+                *p = '.'; // accetta la virgola come separatore decimale
+            p++;
+        }
+        double r = p > field ? strtod(field, &end) : -1;
+        int whole = p > field && end == p;
+        while(*p && is_field_sep(*p))
+            p++;
+        if(len[1] == 0 || !whole || !isfinite(r) || r < 0 || (*p != '\0' && *p != '#')) {
+            bad = line_no;
+            break;
+        }
+        if(nl->n_edges == nl->edges_cap) {
+            nl->edges_cap = nl->edges_cap ? nl->edges_cap * 2 : 1024;
+            nl->ea = xrealloc(nl->ea, nl->edges_cap * sizeof(int));
+            nl->eb = xrealloc(nl->eb, nl->edges_cap * sizeof(int));
+            nl->er = xrealloc(nl->er, nl->edges_cap * sizeof(double));
+        }
+        nl->ea[nl->n_edges] = netlist_node(nl, tok[0], len[0], 1);
+        nl->eb[nl->n_edges] = netlist_node(nl, tok[1], len[1], 1);
+        nl->er[nl->n_edges] = r;
+        nl->n_edges++;
+    }
+    free(line);
+    return bad;
+}
+
+static void netlist_free(Netlist *nl) {
+    free(nl->names);
+    free(nl->name_off);
+    free(nl->table);
+    free(nl->ea);
+    free(nl->eb);
+    free(nl->er);
+    memset(nl, 0, sizeof(*nl));
+}
+
+// Un livello della gerarchia: G = diag - W, con W (conduttanze fra nodi) in CSR
+typedef struct {
+    int n;
+    int *rowptr, *col;
+    double *w;              // conduttanze fuori diagonale
+    double *leak;           // conduttanza verso massa (terminale B)
+    double *diag;           // leak + somma delle conduttanze della riga
+    int *agg;               // aggregato di ogni nodo nel livello successivo
+    double *x, *b, *r;      // vettori di lavoro del ciclo
+    double *c1, *v1, *c2, *v2, *r2; // passi del K-cycle su questo livello
+    double *dense;          // solo ultimo livello: fattore di Cholesky di G
+} MnaLevel;
+
+static void mna_level_alloc(MnaLevel *L, int n, int nnz) {
+    L->n = n;
+    L->rowptr = xrealloc(NULL, (n + 1) * sizeof(int));
+    L->col = xrealloc(NULL, (nnz ? nnz : 1) * sizeof(int));
+    L->w = xrealloc(NULL, (nnz ? nnz : 1) * sizeof(double));
+    L->leak = calloc(n, sizeof(double));
+    L->diag = xrealloc(NULL, n * sizeof(double));
+    L->x = xrealloc(NULL, n * sizeof(double));
+    L->b = xrealloc(NULL, n * sizeof(double));
+    L->r = xrealloc(NULL, n * sizeof(double));
+    L->c1 = xrealloc(NULL, n * sizeof(double));
+    L->v1 = xrealloc(NULL, n * sizeof(double));
+    L->c2 = xrealloc(NULL, n * sizeof(double));
+    L->v2 = xrealloc(NULL, n * sizeof(double));
+    L->r2 = xrealloc(NULL, n * sizeof(double));
+    if(!L->leak) {
+        fprintf(stderr, "Errore di allocazione!\n");
+        exit(1);
+    }
+}
+
+static void mna_level_free(MnaLevel *L) {
+    free(L->rowptr);
+    free(L->col);
+    free(L->w);
+    free(L->leak);
+    free(L->diag);
+    free(L->agg);
+    free(L->x);
+    free(L->b);
+    free(L->r);
+    free(L->c1);
+    free(L->v1);
+    free(L->c2);
+    free(L->v2);
+    free(L->r2);
+    free(L->dense);
+    memset(L, 0, sizeof(*L));
+}
+
+static void mna_set_diag(MnaLevel *L) {
+    for(int i = 0; i < L->n; i++) {
+        double d = L->leak[i];
+        for(int e = L->rowptr[i]; e < L->rowptr[i + 1]; e++)
+            d += L->w[e];
+        L->diag[i] = d;
+    }
+}
+
+// Collegamento candidato all'accoppiamento, con la sua forza relativa
+typedef struct {
+    double strength;        // w_ij / sqrt(diag_i * diag_j)
+    int i, j;
+} MnaPair;
+
+static int pair_cmp(const void *a, const void *b) {
+    double x = ((const MnaPair *)a)->strength, y = ((const MnaPair *)b)->strength;
+    return (x < y) - (x > y);
+}
+
+// Accoppiamento: i collegamenti sono presi dal più forte (relativamente alle diagonali)
+// e uniscono due nodi ancora liberi; i nodi rimasti restano da soli. Partire dai più
+// forti evita di separare due nodi molto accoppiati quando le resistenze variano di
+// ordini di grandezza. Restituisce il numero di gruppi.
+static int mna_match(const MnaLevel *L, int *agg) {
+    int nc = 0, m = 0;
+    MnaPair *pairs = xrealloc(NULL, (L->rowptr[L->n] / 2 + 1) * sizeof(MnaPair));
+    for(int i = 0; i < L->n; i++) {
+        agg[i] = -1;
+        for(int e = L->rowptr[i]; e < L->rowptr[i + 1]; e++)
+            if(L->col[e] > i) {
+                pairs[m].strength = L->w[e] / sqrt(L->diag[i] * L->diag[L->col[e]]);
+                pairs[m].i = i;
+                pairs[m++].j = L->col[e];
+            }
+    }
+    qsort(pairs, m, sizeof(MnaPair), pair_cmp);
+    for(int k = 0; k < m; k++)
+        if(agg[pairs[k].i] < 0 && agg[pairs[k].j] < 0)
+            agg[pairs[k].i] = agg[pairs[k].j] = nc++;
+    for(int i = 0; i < L->n; i++)
+        if(agg[i] < 0)
+            agg[i] = nc++;
+    free(pairs);
+    return nc;
+}
+
+static void mna_coarsen(const MnaLevel *F, MnaLevel *C, int nc);
+
+// Aggregati di (al più) quattro nodi: accoppiamento sul livello e di nuovo sul grafo
+// delle coppie. Restituisce il numero di aggregati.
+static int mna_aggregate(MnaLevel *L) {
+    L->agg = xrealloc(NULL, L->n * sizeof(int));
+    int pairs = mna_match(L, L->agg);
+    MnaLevel P;
+    memset(&P, 0, sizeof(P));
+    mna_coarsen(L, &P, pairs);
+    int *agg2 = xrealloc(NULL, pairs * sizeof(int));
+    int nc = mna_match(&P, agg2);
+    for(int i = 0; i < L->n; i++)
+        L->agg[i] = agg2[L->agg[i]];
+    free(agg2);
+    mna_level_free(&P);
+    return nc;
+}
+
+// Livello successivo: conduttanze fra aggregati diversi sommate, quelle interne scompaiono
+static void mna_coarsen(const MnaLevel *F, MnaLevel *C, int nc) {
+    int n = F->n;
+    int *count = calloc(nc + 1, sizeof(int));
+    int *members = xrealloc(NULL, n * sizeof(int));
+    int *pos = xrealloc(NULL, nc * sizeof(int));
+    if(!count) {
+        fprintf(stderr, "Errore di allocazione!\n");
+        exit(1);
+    }
+    for(int i = 0; i < n; i++)
+        count[F->agg[i] + 1]++;
+    for(int I = 0; I < nc; I++)
+        count[I + 1] += count[I];
+    for(int i = 0; i < n; i++)
+        members[count[F->agg[i]]++] = i;
+    for(int I = nc; I > 0; I--)
+        count[I] = count[I - 1];
+    count[0] = 0;
+
+    mna_level_alloc(C, nc, F->rowptr[n]);
+    int nnz = 0;
+    for(int I = 0; I < nc; I++)
+        pos[I] = -1;
+    for(int I = 0; I < nc; I++) {
+        C->rowptr[I] = nnz;
+        for(int m = count[I]; m < count[I + 1]; m++) {
+            int i = members[m];
+            C->leak[I] += F->leak[i];
+            for(int e = F->rowptr[i]; e < F->rowptr[i + 1]; e++) {
+                int J = F->agg[F->col[e]];
+                if(J == I)
+                    continue;
+                if(pos[J] < C->rowptr[I]) {
+                    pos[J] = nnz;
+                    C->col[nnz] = J;
+                    C->w[nnz++] = F->w[e];
+                } else {
+                    C->w[pos[J]] += F->w[e];
+                }
+            }
+        }
+    }
+    C->rowptr[nc] = nnz;
+    mna_set_diag(C);
+    free(count);
+    free(members);
+    free(pos);
+}
+
+// Gauss-Seidel simmetrico a metà: in avanti (dir = 1) o all'indietro (dir = -1)
+static void mna_gauss_seidel(const MnaLevel *L, const double *b, double *x, int dir) {
+    int from = dir > 0 ? 0 : L->n - 1, to = dir > 0 ? L->n : -1;
+    for(int i = from; i != to; i += dir) {
+        double s = b[i];
+        for(int e = L->rowptr[i]; e < L->rowptr[i + 1]; e++)
+            s += L->w[e] * x[L->col[e]];
+        x[i] = s / L->diag[i];
+    }
+}
+
+// y = G*x
+static void mna_apply(const MnaLevel *L, const double *x, double *y) {
+    for(int i = 0; i < L->n; i++) {
+        double s = L->diag[i] * x[i];
+        for(int e = L->rowptr[i]; e < L->rowptr[i + 1]; e++)
+            s -= L->w[e] * x[L->col[e]];
+        y[i] = s;
+    }
+}
+
+static double dot(const double *a, const double *b, int n) {
+    double s = 0;
+    for(int i = 0; i < n; i++)
+        s += a[i] * b[i];
+    return s;
+}
+
+// Soluzione sull'ultimo livello: Cholesky denso o, se troppo grande, Gauss-Seidel ripetuto
+static void mna_coarse_solve(const MnaLevel *L, const double *b, double *x) {
+    if(L->dense) {
+        memcpy(x, b, L->n * sizeof(double));
+        cholesky_subst(L->dense, x, L->n);
+    } else {
+        memset(x, 0, L->n * sizeof(double));
+        for(int s = 0; s < 20; s++) {
+            mna_gauss_seidel(L, b, x, 1);
+            mna_gauss_seidel(L, b, x, -1);
+        }
+    }
+}
+
+// K-cycle (precondizionatore del gradiente coniugato): x ~ G^-1 b sul livello l.
+// Pre e post smoothing Gauss-Seidel simmetrici; sul livello successivo fino a due passi di
+// gradiente coniugato precondizionati ricorsivamente (Notay, "AGMG").
+static void mna_kcycle(MnaLevel *lv, int l, int nl, const double *b, double *x) {
+    MnaLevel *L = &lv[l];
+    if(l == nl - 1) {
+        mna_coarse_solve(L, b, x);
+        return;
+    }
+    MnaLevel *C = &lv[l + 1];
+    memset(x, 0, L->n * sizeof(double));
+    for(int s = 0; s < MNA_SWEEPS; s++)
+        mna_gauss_seidel(L, b, x, 1);
+    mna_apply(L, x, L->r);
+    memset(C->b, 0, C->n * sizeof(double));
+    for(int i = 0; i < L->n; i++)
+        C->b[L->agg[i]] += b[i] - L->r[i];
+
+    if(l + 1 == nl - 1) {
+        mna_coarse_solve(C, C->b, C->x);
+    } else {
+        int n = C->n;
+        mna_kcycle(lv, l + 1, nl, C->b, C->c1);
+        mna_apply(C, C->c1, C->v1);
+        double rho1 = dot(C->c1, C->v1, n), alpha1 = dot(C->c1, C->b, n);
+        double t1 = (rho1 > 0) ? alpha1 / rho1 : 0;
+        for(int i = 0; i < n; i++)
+            C->r2[i] = C->b[i] - t1 * C->v1[i];
+        if(dot(C->r2, C->r2, n) <= 0.0625 * dot(C->b, C->b, n)) { // riduzione di 4: basta un passo
+            for(int i = 0; i < n; i++)
+                C->x[i] = t1 * C->c1[i];
+        } else {
+            mna_kcycle(lv, l + 1, nl, C->r2, C->c2);
+            mna_apply(C, C->c2, C->v2);
+            double gamma = dot(C->c2, C->v1, n), beta = dot(C->c2, C->v2, n);
+            double alpha2 = dot(C->c2, C->r2, n);
+            double rho2 = beta - gamma * gamma / rho1;
+            double t2 = (rho2 > 0) ? alpha2 / rho2 : 0;
+            for(int i = 0; i < n; i++)
+                C->x[i] = (t1 - gamma * t2 / rho1) * C->c1[i] + t2 * C->c2[i];
+        }
+    }
+    for(int i = 0; i < L->n; i++)
+        x[i] += C->x[L->agg[i]];
+    for(int s = 0; s < MNA_SWEEPS; s++)
+        mna_gauss_seidel(L, b, x, -1);
+}
+
+// Costruisce i livelli sopra lv[0]; restituisce il numero di livelli
+static int mna_hierarchy(MnaLevel *lv) {
+    int nl = 1;
+    while(nl < MNA_MAX_LEVELS && lv[nl - 1].n > MNA_COARSE) {
+        int nc = mna_aggregate(&lv[nl - 1]);
+        if(nc > 0.8 * lv[nl - 1].n) // l'aggregazione non riduce più: ci si ferma qui
+            break;
+        mna_coarsen(&lv[nl - 1], &lv[nl], nc);
+        nl++;
+    }
+    MnaLevel *C = &lv[nl - 1];
+    if(C->n <= 4 * MNA_COARSE) {
+        C->dense = calloc((size_t)C->n * C->n, sizeof(double));
+        if(!C->dense) {
+            fprintf(stderr, "Errore di allocazione!\n");
+            exit(1);
+        }
+        for(int i = 0; i < C->n; i++) {
+            C->dense[(size_t)i * C->n + i] = C->diag[i];
+            for(int e = C->rowptr[i]; e < C->rowptr[i + 1]; e++)
+                C->dense[(size_t)i * C->n + C->col[e]] -= C->w[e];
+        }
+        if(!cholesky_factor(C->dense, C->n)) {
+            free(C->dense);
+            C->dense = NULL;
+        }
+    }
+    return nl;
+}
+
+// Gradiente coniugato flessibile su lv[0] (il K-cycle non è un operatore lineare fisso,
+// quindi beta è calcolato alla Polak-Ribière): risolve G*x = b
+static int mna_pcg(MnaLevel *lv, int nl, const double *b, double *x, double *residual) {
+    int n = lv[0].n;
+    double *r = xrealloc(NULL, n * sizeof(double));
+    double *r_old = xrealloc(NULL, n * sizeof(double));
+    double *z = xrealloc(NULL, n * sizeof(double));
+    double *p = xrealloc(NULL, n * sizeof(double));
+    double *q = xrealloc(NULL, n * sizeof(double));
+    memset(x, 0, n * sizeof(double));
+    memcpy(r, b, n * sizeof(double));
+    double norm_b = sqrt(dot(b, b, n));
+    mna_kcycle(lv, 0, nl, r, z);
+    memcpy(p, z, n * sizeof(double));
+    double rz = dot(r, z, n);
+    int it = 0;
+    *residual = 0;
+    while(it < MNA_MAX_ITER && norm_b > 0) {
+        it++;
+        mna_apply(&lv[0], p, q);
+        double alpha = rz / dot(p, q, n);
+        memcpy(r_old, r, n * sizeof(double));
+        for(int i = 0; i < n; i++) {
+            x[i] += alpha * p[i];
+            r[i] -= alpha * q[i];
+        }
+        *residual = sqrt(dot(r, r, n)) / norm_b;
+        if(*residual < MNA_TOL)
+            break;
+        mna_kcycle(lv, 0, nl, r, z);
+        double rz_new = dot(r, z, n);
+        double beta = (rz_new - dot(z, r_old, n)) / rz;
+        rz = rz_new;
+        for(int i = 0; i < n; i++)
+            p[i] = z[i] + beta * p[i];
+    }
+    free(r);
+    free(r_old);
+    free(z);
+    free(p);
+    free(q);
+    return it;
+}
+
+// Grafo delle incognite prima del multigrid. Le righe hanno capacità fissa: eliminare un
+// nodo non aumenta mai i collegamenti dei vicini (la serie sostituisce due voci con una
+// per lato), quindi basta riscrivere le voci esistenti.
+typedef struct {
+    int n;
+    int *rowptr;            // inizio della riga
+    int *len;               // voci occupate della riga
+    int *nbr;               // vicino (-1 = voce morta)
+    double *g;              // conduttanza
+    int *rev;               // posizione della voce inversa nella riga del vicino
+    double *leak;           // conduttanza verso massa
+    unsigned char *gone;    // nodo eliminato
+    int *mark;              // ultima posizione vista di ogni vicino (compattazione)
+} MnaGraph;
+
+// Un nodo eliminato: il suo potenziale si ricava da quello dei (al più due) vicini
+typedef struct {
+    int node, nbr[2];
+    double g[2], leak;
+} MnaElim;
+
+#define MNA_ELIM_SCAN 16        // righe più lunghe non vengono esaminate per l'eliminazione
+
+// Toglie dalla riga j le voci morte o verso nodi eliminati e fonde i collegamenti
+// paralleli verso lo stesso vicino (anche nella riga del vicino)
+static void mna_compact(MnaGraph *G, int j) {
+    int w = G->rowptr[j];
+    for(int e = G->rowptr[j]; e < G->rowptr[j] + G->len[j]; e++) {
+        int k = G->nbr[e];
+        if(k < 0 || G->gone[k])
+            continue;
+        int f = G->mark[k];
+        if(f >= G->rowptr[j] && f < w && G->nbr[f] == k) {
+            G->g[f] += G->g[e];
+            G->g[G->rev[f]] += G->g[G->rev[e]];
+            G->nbr[G->rev[e]] = -1;
+            continue;
+        }
+        if(e != w) {
+            G->nbr[w] = k;
+            G->g[w] = G->g[e];
+            G->rev[w] = G->rev[e];
+            G->rev[G->rev[w]] = w;
+        }
+        G->mark[k] = w++;
+    }
+    G->len[j] = w - G->rowptr[j];
+}
+
+// Elimina tutti i nodi (tranne keep) con al più due collegamenti contando la massa:
+// un ramo pendente sparisce, un nodo fra due resistenze in serie diventa un'unica
+// resistenza g1*g2/(g1+g2), un nodo fra una resistenza e la massa diventa una perdita.
+// È l'eliminazione di Gauss dei nodi che non creano riempimento: una rete
+// serie-parallelo si riduce per intero al solo nodo keep. Restituisce i nodi eliminati.
+static int mna_eliminate(MnaGraph *G, int keep, MnaElim *elim) {
+    int *work = xrealloc(NULL, G->n * sizeof(int));
+    unsigned char *queued = calloc(G->n, 1);
+    if(!queued) {
+        fprintf(stderr, "Errore di allocazione!\n");
+        exit(1);
+    }
+    int top = 0, count = 0;
+    for(int i = G->n - 1; i >= 0; i--) {
+        work[top++] = i;
+        queued[i] = 1;
+    }
+    while(top > 0) {
+        int i = work[--top];
+        queued[i] = 0;
+        if(i == keep || G->gone[i] || G->len[i] > MNA_ELIM_SCAN)
+            continue;
+        mna_compact(G, i);
+        int len = G->len[i];
+        if(len + (G->leak[i] > 0) > 2)
+            continue;
+        int e = G->rowptr[i];
+        MnaElim *r = &elim[count++];
+        r->node = i;
+        r->leak = G->leak[i];
+        r->nbr[0] = r->nbr[1] = -1;
+        r->g[0] = r->g[1] = 0;
+        for(int k = 0; k < len; k++) {
+            r->nbr[k] = G->nbr[e + k];
+            r->g[k] = G->g[e + k];
+        }
+        G->gone[i] = 1;
+        if(len == 2) {
+            // serie: le due voci che puntavano a i ora si puntano fra loro
+            int p = G->rev[e], q = G->rev[e + 1];
+            double gs = r->g[0] * r->g[1] / (r->g[0] + r->g[1]);
+            G->nbr[p] = r->nbr[1];
+            G->g[p] = gs;
+            G->rev[p] = q;
+            G->nbr[q] = r->nbr[0];
+            G->g[q] = gs;
+            G->rev[q] = p;
+        } else if(len == 1) {
+            G->nbr[G->rev[e]] = -1;
+            if(r->leak > 0)
+                G->leak[r->nbr[0]] += r->g[0] * r->leak / (r->g[0] + r->leak);
+        }
+        for(int k = 0; k < len; k++)
+            if(!queued[r->nbr[k]]) {
+                work[top++] = r->nbr[k];
+                queued[r->nbr[k]] = 1;
+            }
+    }
+    free(work);
+    free(queued);
+    return count;
+}
+
+static int uf_find(int *parent, int i) {
+    while(parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+typedef struct {
+    double req;             // resistenza equivalente fra i terminali
+    int nodes, unknowns;    // nodi della netlist e incognite rimaste dopo l'eliminazione
+    int levels, iterations;
+    double residual;
+    double *v;              // potenziale di ogni nodo con V(A) = 1, V(B) = 0 (NAN se isolato)
+} MnaResult;
+
+// Resistenza equivalente fra i nodi a e b e potenziali dei nodi; 0 se a e b non sono collegati
+int mna_solve(const Netlist *nl, int a, int b, MnaResult *res) {
+    int n = nl->n_nodes, m = nl->n_edges;
+    memset(res, 0, sizeof(*res));
+    res->nodes = n;
+    res->v = xrealloc(NULL, n * sizeof(double));
+
+    // I cortocircuiti fondono i nodi
+    int *rep = xrealloc(NULL, n * sizeof(int));
+    for(int i = 0; i < n; i++)
+        rep[i] = i;
+    for(int e = 0; e < m; e++)
+        if(nl->er[e] == 0) {
+            int ra = uf_find(rep, nl->ea[e]), rb = uf_find(rep, nl->eb[e]);
+            if(ra != rb)
+                rep[ra] = rb;
+        }
+    for(int i = 0; i < n; i++)
+        rep[i] = uf_find(rep, i);
+    int ra = rep[a], rb = rep[b];
+
+    // Adiacenza fra rappresentanti e visita in ampiezza da A
+    int *start = calloc(n + 1, sizeof(int));
+    int *adj = xrealloc(NULL, (2 * (size_t)m + 1) * sizeof(int));
+    int *idx = xrealloc(NULL, n * sizeof(int));
+    if(!start) {
+        fprintf(stderr, "Errore di allocazione!\n");
+        exit(1);
+    }
+    for(int e = 0; e < m; e++) {
+        int u = rep[nl->ea[e]], w = rep[nl->eb[e]];
+        if(u != w) {
+            start[u + 1]++;
+            start[w + 1]++;
+        }
+    }
+    for(int i = 0; i < n; i++)
+        start[i + 1] += start[i];
+    int *fill = xrealloc(NULL, n * sizeof(int));
+    memcpy(fill, start, n * sizeof(int));
+    for(int e = 0; e < m; e++) {
+        int u = rep[nl->ea[e]], w = rep[nl->eb[e]];
+        if(u != w) {
+            adj[fill[u]++] = w;
+            adj[fill[w]++] = u;
+        }
+    }
+    for(int i = 0; i < n; i++)
+        idx[i] = -1;
+    int *queue = fill, head = 0, tail = 0;
+    queue[tail++] = ra;
+    idx[ra] = 0;
+    while(head < tail) {
+        int u = queue[head++];
+        for(int k = start[u]; k < start[u + 1]; k++)
+            if(idx[adj[k]] < 0) {
+                idx[adj[k]] = 0;
+                queue[tail++] = adj[k];
+            }
+    }
+    int connected = idx[rb] >= 0;
+    int ok = connected;
+    if(connected && ra == rb) {
+        res->req = 0;
+        for(int i = 0; i < n; i++)
+            res->v[i] = (idx[rep[i]] >= 0) ? 1.0 : NAN;
+    } else if(connected) {
+        // Incognite: i nodi della componente di A tranne B, in ordine di visita
+        int u = 0;
+        for(int k = 0; k < tail; k++)
+            idx[queue[k]] = (queue[k] == rb) ? -2 : u++;
+
+        // Grafo delle incognite: i collegamenti verso B diventano perdite verso massa
+        MnaGraph G;
+        memset(&G, 0, sizeof(G));
+        G.n = u;
+        G.rowptr = calloc(u + 1, sizeof(int));
+        G.len = calloc(u, sizeof(int));
+        G.leak = calloc(u, sizeof(double));
+        G.gone = calloc(u, 1);
+        G.mark = xrealloc(NULL, (u ? u : 1) * sizeof(int));
+        if(!G.rowptr || !G.len || !G.leak || !G.gone) {
+            fprintf(stderr, "Errore di allocazione!\n");
+            exit(1);
+        }
+        for(int e = 0; e < m; e++) {
+            int p = idx[rep[nl->ea[e]]], q = idx[rep[nl->eb[e]]];
+            if(p >= 0 && q >= 0 && p != q) {
+                G.rowptr[p + 1]++;
+                G.rowptr[q + 1]++;
+            }
+        }
+        for(int i = 0; i < u; i++)
+            G.rowptr[i + 1] += G.rowptr[i];
+        int nnz = G.rowptr[u];
+        G.nbr = xrealloc(NULL, (nnz ? nnz : 1) * sizeof(int));
+        G.g = xrealloc(NULL, (nnz ? nnz : 1) * sizeof(double));
+        G.rev = xrealloc(NULL, (nnz ? nnz : 1) * sizeof(int));
+        for(int e = 0; e < m; e++) {
+            int p = idx[rep[nl->ea[e]]], q = idx[rep[nl->eb[e]]];
+            if(p == q || nl->er[e] == 0 || p == -1 || q == -1)
+                continue;
+            double g = 1.0 / nl->er[e];
+            if(p == -2) {
+                G.leak[q] += g;
+            } else if(q == -2) {
+                G.leak[p] += g;
+            } else {
+                int ep = G.rowptr[p] + G.len[p]++, eq = G.rowptr[q] + G.len[q]++;
+                G.nbr[ep] = q;
+                G.g[ep] = g;
+                G.rev[ep] = eq;
+                G.nbr[eq] = p;
+                G.g[eq] = g;
+                G.rev[eq] = ep;
+            }
+        }
+        for(int i = 0; i < u; i++)
+            G.mark[i] = -1;
+        MnaElim *elim = xrealloc(NULL, (u ? u : 1) * sizeof(MnaElim));
+        int n_elim = mna_eliminate(&G, idx[ra], elim);
+
+        // Nodi rimasti: primo livello del multigrid
+        int *keep = xrealloc(NULL, (u ? u : 1) * sizeof(int));
+        int left = 0, left_nnz = 0;
+        for(int i = 0; i < u; i++) {
+            keep[i] = -1;
+            if(!G.gone[i]) {
+                mna_compact(&G, i);
+                keep[i] = left++;
+                left_nnz += G.len[i];
+            }
+        }
+        MnaLevel lv[MNA_MAX_LEVELS];
+        memset(lv, 0, sizeof(lv));
+        mna_level_alloc(&lv[0], left, left_nnz);
+        int fill_pos = 0;
+        for(int i = 0; i < u; i++) {
+            if(keep[i] < 0)
+                continue;
+            lv[0].rowptr[keep[i]] = fill_pos;
+            lv[0].leak[keep[i]] = G.leak[i];
+            for(int e = G.rowptr[i]; e < G.rowptr[i] + G.len[i]; e++) {
+                lv[0].col[fill_pos] = keep[G.nbr[e]];
+                lv[0].w[fill_pos++] = G.g[e];
+            }
+        }
+        lv[0].rowptr[left] = fill_pos;
+        mna_set_diag(&lv[0]);
+
+        int nlev = mna_hierarchy(lv);
+        double *rhs = calloc(left, sizeof(double));
+        double *x = xrealloc(NULL, left * sizeof(double));
+        double *volt = xrealloc(NULL, (u ? u : 1) * sizeof(double));
+        if(!rhs) {
+            fprintf(stderr, "Errore di allocazione!\n");
+            exit(1);
+        }
+        rhs[keep[idx[ra]]] = 1.0; // 1 A iniettato in A
+        res->iterations = mna_pcg(lv, nlev, rhs, x, &res->residual);
+        // Potenziali: nodi rimasti dal sistema, nodi eliminati all'indietro dai loro vicini
+        for(int i = 0; i < u; i++)
+            volt[i] = (keep[i] >= 0) ? x[keep[i]] : 0.0;
+        for(int k = n_elim - 1; k >= 0; k--) {
+            const MnaElim *r = &elim[k];
+            double num = 0;
+            for(int j = 0; j < 2; j++)
+                if(r->nbr[j] >= 0)
+                    num += r->g[j] * volt[r->nbr[j]];
+            volt[r->node] = num / (r->g[0] + r->g[1] + r->leak);
+        }
+        res->req = volt[idx[ra]];
+        res->unknowns = left;
+        res->levels = nlev;
+        for(int i = 0; i < n; i++) {
+            int k = idx[rep[i]];
+            res->v[i] = (k >= 0) ? volt[k] / res->req : (k == -2) ? 0.0 : NAN;
+        }
+        free(rhs);
+        free(x);
+        free(volt);
+        free(keep);
+        free(elim);
+        free(G.rowptr);
+        free(G.len);
+        free(G.nbr);
+        free(G.g);
+        free(G.rev);
+        free(G.leak);
+        free(G.gone);
+        free(G.mark);
+        for(int l = 0; l < nlev; l++)
+            mna_level_free(&lv[l]);
+    }
+    free(rep);
+    free(start);
+    free(adj);
+    free(idx);
+    free(fill);
+    return ok;
+}
+
+// Converte la topologia di un circuito a blocchi in netlist: terminali "+" e "-",
+// nodi interni "n1", "n2", ... Ogni nodo della topologia è visitato una volta con i
+// suoi due estremi, con uno stack esplicito. Come in evaluate_topology, un ramo che
+// vale 0 è ignorato dal parallelo e un sottoalbero che vale 0 in serie è un filo.
+int topo_to_netlist(const Topology *t, FILE *out) {
+    if(t->n_unknown > 0 || t->n == 0)
+        return 0;
+    // Valore di ogni sottoalbero (i figli del nodo i si risalgono con start[])
+    double *val = xrealloc(NULL, t->n * sizeof(double));
+    for(int i = 0; i < t->n; i++) {
+        double s = 0;
+        for(int c = i - 1; c >= t->start[i]; c = t->start[c] - 1)
+            s += (t->kind[i] == TOPO_PAR) ? recip_pos(val[c]) : val[c];
+        val[i] = (t->kind[i] == TOPO_RES) ? t->value[i] : (t->kind[i] == TOPO_PAR) ? recip_pos(s) : s;
+    }
+    typedef struct { int node, a, b, in_par; } Item;
+    Item *stack = xrealloc(NULL, t->n * sizeof(Item));
+    int sp = 0, next_id = 2;
+    stack[sp++] = (Item){ t->n - 1, 0, 1, 0 };
+    while(sp > 0) {
+        Item it = stack[--sp];
+        int i = it.node;
+        if(val[i] <= 0 && it.in_par)
+            continue;
+        int kind = (val[i] <= 0) ? TOPO_RES : t->kind[i];
+        switch(kind) {
+            case TOPO_RES: {
+                char na[24], nb[24];
+                if(it.a < 2) strcpy(na, it.a ? "-" : "+"); else sprintf(na, "n%d", it.a - 1);
+                if(it.b < 2) strcpy(nb, it.b ? "-" : "+"); else sprintf(nb, "n%d", it.b - 1);
+                fprintf(out, "%s %s %.17g\n", na, nb, val[i]);
+                break;
+            }
+            case TOPO_SERIES: {
+                // figli dall'ultimo al primo: ognuno va dal nodo precedente della catena a cur_b
+                int cur_b = it.b;
+                for(int c = i - 1; c >= t->start[i]; c = t->start[c] - 1) {
+                    int cur_a = (t->start[c] == t->start[i]) ? it.a : next_id++;
+                    stack[sp++] = (Item){ c, cur_a, cur_b, 0 };
+                    cur_b = cur_a;
+                }
+                break;
+            }
+            case TOPO_PAR:
+                for(int c = i - 1; c >= t->start[i]; c = t->start[c] - 1)
+                    stack[sp++] = (Item){ c, it.a, it.b, 1 };
+                break;
+        }
+    }
+    free(stack);
+    free(val);
+    return 1;
+}
+
+int run_to_netlist(const Options *opt) {
+    setlocale(LC_NUMERIC, "C");
+    size_t len = strlen(opt->to_netlist);
+    int status = 0;
+    if(!circuit_framed(opt->to_netlist, len)) {
+        fprintf(stderr, "Errore: il circuito deve iniziare con '+' e terminare con '-'.\n");
+        status = 1;
+    } else {
+        CircuitContext *ctx = context_create(opt->stats);
+        ctx->topology_only = 1;
+        parse_circuit_utf8(ctx, opt->to_netlist, len);
+        if(ctx->topo.n_reactive) {
+            fprintf(stderr, "Errore: condensatori e induttori sono supportati solo da --sweep.\n");
+            status = 1;
+        } else if(!topo_to_netlist(&ctx->topo, stdout)) {
+            fprintf(stderr, "Errore: la netlist richiede un circuito senza incognite.\n");
+            status = 1;
+        }
+        context_destroy(ctx);
+    }
+    return status;
+}
+
+int run_netlist(const Options *opt) {
+    FILE *in = open_input(opt->netlist);
+    if(!in)
+        return 1;
+    setlocale(LC_NUMERIC, "C");
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    Netlist nl = {0};
+    long bad = netlist_read(in, &nl);
+    if(in != stdin)
+        fclose(in);
+    if(bad) {
+        fprintf(stderr, "Errore: riga %ld della netlist non valida (attesa \"NODO_A NODO_B R\" con R >= 0).\n", bad);
+        netlist_free(&nl);
+        return 1;
+    }
+    int a = netlist_node(&nl, opt->terminal_a, strlen(opt->terminal_a), 0);
+    int b = netlist_node(&nl, opt->terminal_b, strlen(opt->terminal_b), 0);
+    if(a < 0 || b < 0 || a == b) {
+        fprintf(stderr, "Errore: terminali '%s' e '%s' non presenti nella netlist (usa --terminals A B).\n",
+                opt->terminal_a, opt->terminal_b);
+        netlist_free(&nl);
+        return 1;
+    }
+    double read_time = elapsed_since(&t0);
+
+    MnaResult res;
+    struct timespec t_solve;
+    clock_gettime(CLOCK_MONOTONIC, &t_solve);
+    int ok = mna_solve(&nl, a, b, &res);
+    if(ok)
+        stats_record(opt->stats, PHASE_NETLIST, elapsed_since(&t_solve), res.iterations);
+    if(!ok) {
+        fprintf(stderr, "Errore: i terminali '%s' e '%s' non sono collegati.\n", opt->terminal_a, opt->terminal_b);
+    } else {
+        if(opt->json) {
+            printf("{\"req\":%.17g,\"nodes\":%d,\"resistors\":%d,\"reduced\":%d,\"levels\":%d,\"iterations\":%d,\"residual\":%.3g}\n",
+                   res.req, res.nodes, nl.n_edges, res.unknowns, res.levels, res.iterations, res.residual);
+        } else {
+            printf("req,nodes,resistors,reduced,levels,iterations,residual\n");
+            printf("%.17g,%d,%d,%d,%d,%d,%.3g\n", res.req, res.nodes, nl.n_edges, res.unknowns,
+                   res.levels, res.iterations, res.residual);
+        }
+        if(opt->voltages) {
+            FILE *out = fopen(opt->voltages, "w");
+            if(!out) {
+                fprintf(stderr, "Errore: impossibile scrivere '%s'.\n", opt->voltages);
+                ok = 0;
+            } else {
+                fputs("node,v\n", out);
+                for(int i = 0; i < nl.n_nodes; i++) {
+                    fprintf(out, "%s,", nl.names + nl.name_off[i]);
+                    if(!isnan(res.v[i]))
+                        fprintf(out, "%.17g", res.v[i]);
+                    fputc('\n', out);
+                }
+                fclose(out);
+            }
+        }
+        fprintf(stderr, "Analisi nodale: %d nodi, %d resistenze, %d livelli, %d iterazioni, lettura %.3g s, totale %.3g s.\n",
+                res.nodes, nl.n_edges, res.levels, res.iterations, read_time, elapsed_since(&t0));
+    }
+    free(res.v);
+    netlist_free(&nl);
+    return ok ? 0 : 1;
+}
+
+/* --- BENCHMARK --- */
+// Genera circuiti serie-parallelo validi con un seme fisso e misura separatamente le fasi
+// di parsing (con costruzione della topologia), valutazione, calcolo di Rx e disegno
+// (griglia e conversione, senza la scrittura sul terminale). Il CSV prodotto può essere
+// salvato e passato a --baseline in un'esecuzione successiva con gli stessi parametri:
+// una fase più lenta del riferimento oltre la soglia fa terminare con stato 1.
+#define BENCH_MAX_DEPTH 1000
+#define BENCH_GROUP_P 0.3       // probabilità che un elemento sia un gruppo parallelo
+
+typedef enum {
+    BENCH_NONE,     // nessuna incognita
+    BENCH_SERIES,   // nel circuito principale
+    BENCH_BRANCH,   // in un ramo qualsiasi
+    BENCH_DEEP,     // nel gruppo più profondo
+    BENCH_RANDOM    // in una posizione qualsiasi
+} BenchUnknown;
+
+static const char *const BENCH_UNKNOWN_NAMES[] = { "none", "series", "branch", "deep", "random" };
+
+typedef struct {
+    size_t off;             // posizione del valore nel testo
+    int len;
+    int depth;              // livello di annidamento
+} BenchRes;
+
+typedef struct {
+    char *text;
+    size_t len, cap;
+    BenchRes *res;
+    int n_res, res_cap;
+    Rng rng;
+    const Options *opt;
+} BenchGen;
+
+static void gen_put(BenchGen *g, const char *s, size_t n) {
+    if(g->len + n + 1 > g->cap) {
+        g->cap = (g->len + n + 1) * 2;
+        g->text = xrealloc(g->text, g->cap);
+    }
+    memcpy(g->text + g->len, s, n);
+    g->len += n;
+    g->text[g->len] = '\0';
+}
+
+static void gen_resistor(BenchGen *g, int depth) {
+    static const char *const frac[] = { "", ".5", ",25", ".75" };
+    char buf[32];
+    uint64_t r = rng_next(&g->rng);
+    int n = snprintf(buf, sizeof(buf), "%d%s", (int)(r % 1000) + 1, frac[(r >> 32) & 3]);
+    if(g->n_res == g->res_cap) {
+        g->res_cap = g->res_cap ? g->res_cap * 2 : 256;
+        g->res = xrealloc(g->res, g->res_cap * sizeof(BenchRes));
+    }
+    g->res[g->n_res++] = (BenchRes){ g->len, n, depth };
+    gen_put(g, buf, n);
+}
+
+// Serie di n resistenze al livello "depth": ogni elemento è una resistenza o, finché la
+// profondità lo consente, un gruppo di 2..fanout rami che si spartiscono parte del budget
+static void gen_series(BenchGen *g, int n, int depth) {
+    const Options *opt = g->opt;
+    for(int first = 1; n > 0; first = 0) {
+        if(!first)
+            gen_put(g, "_", 1);
+        int k = 2 + (int)(rng_next(&g->rng) % (opt->bench_fanout - 1));
+        if(depth < opt->bench_depth && n >= k && rng_uniform(&g->rng) < BENCH_GROUP_P) {
+            int m = k + (int)(rng_next(&g->rng) % (n - k + 1));
+            n -= m;
+            gen_put(g, "*", 1);
+            for(int b = 0; b < k; b++) {
+                int share = (b == k - 1) ? m : 1 + (int)(rng_next(&g->rng) % (m - (k - 1 - b)));
+                m -= share;
+                if(b > 0)
+                    gen_put(g, "||", 2);
+                gen_series(g, share, depth + 1);
+                if(b > 0)
+                    gen_put(g, "=", 1);
+            }
+            gen_put(g, "*", 1);
+        } else {
+            gen_resistor(g, depth);
+            n--;
+        }
+    }
+}
+
+static int bench_candidate(const BenchRes *r, int where, int max_depth) {
+    switch(where) {
+        case BENCH_SERIES: return r->depth == 0;
+        case BENCH_BRANCH: return r->depth > 0;
+        case BENCH_DEEP:   return r->depth == max_depth;
+        default:           return 1;
+    }
+}
+
+// Genera un circuito in g->text; restituisce l'indice della resistenza resa incognita
+// (-1 se nessuna) e il testo la contiene già come "x"
+static int gen_circuit(BenchGen *g) {
+    g->len = 0;
+    g->n_res = 0;
+    gen_put(g, "+", 1);
+    gen_series(g, g->opt->bench_size, 0);
+    gen_put(g, "-", 1);
+    if(g->opt->bench_unknown == BENCH_NONE)
+        return -1;
+
+    int max_depth = 0;
+    for(int i = 0; i < g->n_res; i++)
+        if(g->res[i].depth > max_depth)
+            max_depth = g->res[i].depth;
+    // Conta le resistenze nella posizione richiesta, poi estrae una di esse; se non ce
+    // ne sono (per esempio nessuna in serie) va bene una resistenza qualsiasi
+    int where = g->opt->bench_unknown, candidates = 0, pick = 0;
+    for(int i = 0; i < g->n_res; i++)
+        candidates += bench_candidate(&g->res[i], where, max_depth);
+    if(candidates == 0) {
+        where = BENCH_RANDOM;
+        candidates = g->n_res;
+    }
+    int target = (int)(rng_next(&g->rng) % candidates);
+    for(int i = 0; i < g->n_res; i++)
+        if(bench_candidate(&g->res[i], where, max_depth) && target-- == 0) {
+            pick = i;
+            break;
+        }
+
+    // Sostituisce il valore con "x" compattando il testo
+    BenchRes *r = &g->res[pick];
+    g->text[r->off] = 'x';
+    memmove(g->text + r->off + 1, g->text + r->off + r->len, g->len - r->off - r->len + 1);
+    g->len -= r->len - 1;
+    return pick;
+}
+
+typedef struct {
+    long circuits;
+    long elements;
+    double seconds;
+} BenchPhase;
+
+static void write_bench_phase(FILE *out, const char *name, const BenchPhase *p, int json) {
+    double cps = p->seconds > 0 ? p->circuits / p->seconds : 0;
+    double eps = p->seconds > 0 ? p->elements / p->seconds : 0;
+    if(json) {
+        fprintf(out, "{\"phase\":\"%s\",\"circuits\":%ld,\"elements\":%ld,\"seconds\":%.6g,"
+                     "\"circuits_per_sec\":%.6g,\"elements_per_sec\":%.6g}\n",
+                name, p->circuits, p->elements, p->seconds, cps, eps);
+    } else {
+        fprintf(out, "%s,%ld,%ld,%.6g,%.6g,%.6g\n", name, p->circuits, p->elements, p->seconds, cps, eps);
+    }
+}
+
+// Confronta gli elementi/s di ogni fase con il CSV di riferimento; restituisce il numero
+// di fasi peggiorate oltre la soglia (-1 se il file non è leggibile)
+static int bench_compare(const char *path, const BenchPhase *ph, double threshold) {
+    FILE *in = fopen(path, "r");
+    if(!in) {
+        fprintf(stderr, "Errore: impossibile aprire il riferimento %s\n", path);
+        return -1;
+    }
+    char *line = NULL;
+    size_t cap = 0;
+    int regressions = 0;
+    while(getline(&line, &cap, in) != -1) {
+        char name[32];
+        long circuits, elements;
+        double seconds, cps, eps;
+        if(sscanf(line, "%31[^,],%ld,%ld,%lf,%lf,%lf", name, &circuits, &elements, &seconds, &cps, &eps) != 6)
+            continue;  // intestazione o righe estranee
+        for(int p = 0; p < PHASE_COUNT; p++) {
+            if(strcmp(name, PHASE_NAMES[p]) != 0 || ph[p].circuits == 0 || ph[p].seconds <= 0 || eps <= 0)
+                continue;
+            double now = ph[p].elements / ph[p].seconds;
+            double change = now / eps - 1;
+            int slower = change < -threshold;
+            regressions += slower;
+            fprintf(stderr, "%-8s %10.4g el/s  riferimento %10.4g el/s  %+6.1f%%%s\n",
+                    name, now, eps, change * 100, slower ? "  REGRESSIONE" : "");
+        }
+    }
+    free(line);
+    fclose(in);
+    return regressions;
+}
+
+int run_bench(const Options *opt) {
+    setlocale(LC_NUMERIC, "C");
+    BenchGen g = { 0 };
+    g.opt = opt;
+    rng_seed(&g.rng, opt->seed);
+    Rng values;
+    rng_seed(&values, opt->seed ^ 0x5bd1e995);
+    CircuitContext *ctx = context_create(opt->stats);
+    BenchPhase ph[PHASE_COUNT] = { { 0 } };
+    char *enc = NULL;
+    size_t enc_cap = 0;
+    long wrong = 0, wrong_bytecode = 0;
+    volatile double sink = 0;   // impedisce di scartare i risultati
+    Program prog = { 0 };
+    double *prog_stack = NULL;
+    int prog_stack_cap = 0;
+
+    for(long c = 0; c < opt->bench_count; c++) {
+        int unknown = gen_circuit(&g);
+        long elements = g.n_res;
+        struct timespec t0;
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        reset_circuit(ctx);
+        parse_circuit_utf8(ctx, g.text, g.len);
+        ph[PHASE_PARSE].seconds += elapsed_since(&t0);
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        double Req_known = calculate_total_resistance_new(ctx);
+        ph[PHASE_EVALUATE].seconds += elapsed_since(&t0);
+        sink += Req_known;
+
+        // Stesso calcolo con il bytecode: compilazione e una valutazione, misurate a parte
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        program_compile(&prog, &ctx->topo);
+        ph[PHASE_COMPILE].seconds += elapsed_since(&t0);
+        if(prog.max_stack > prog_stack_cap) {
+            prog_stack_cap = prog.max_stack;
+            prog_stack = xrealloc(prog_stack, prog_stack_cap * sizeof(double));
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        double Req_bytecode = program_eval(&prog, prog.value, prog_stack);
+        ph[PHASE_BYTECODE].seconds += elapsed_since(&t0);
+        if(Req_bytecode != Req_known)
+            wrong_bytecode++;
+
+        if(unknown >= 0) {
+            // Req "misurata" con un valore vero di Rx scelto a caso, fuori dal tempo
+            RxFlowchart f;
+            double rx_true = 1 + rng_uniform(&values) * 999, Rx;
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            prepare_rx(ctx, &f, Req_known);
+            double t_prepare = elapsed_since(&t0);
+            double Req = mobius_eval(&f.m, rx_true);
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            RxStatus st = solve_rx(&f, Req, &Rx);
+            ph[PHASE_SOLVE].seconds += t_prepare + elapsed_since(&t0);
+            ph[PHASE_SOLVE].circuits++;
+            ph[PHASE_SOLVE].elements += elements;
+            // Verifica all'indietro: se Req dipende poco da Rx, Rx stessa può scostarsi
+            if(st != RX_OK || fabs(mobius_eval(&f.m, Rx) - Req) > 1e-12 * Req)
+                wrong++;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if(init_grid(ctx, grid_columns(ctx))) {
+            render_blocks(ctx);
+            close_circuit(ctx);
+            draw_generator(ctx);
+            size_t n = grid_encode(ctx, &enc, &enc_cap);
+            stats_stop(ctx->stats, PHASE_RENDER, &t0);
+            ph[PHASE_RENDER].seconds += elapsed_since(&t0);
+            ph[PHASE_RENDER].circuits++;
+            ph[PHASE_RENDER].elements += elements;
+            sink += (double)n;
+        }
+
+        for(int p = PHASE_PARSE; p <= PHASE_BYTECODE; p++) {
+            ph[p].circuits++;
+            ph[p].elements += elements;
+        }
+    }
+    (void)sink;
+
+    if(!opt->json)
+        fputs("phase,circuits,elements,seconds,circuits_per_sec,elements_per_sec\n", stdout);
+    for(int p = 0; p < PHASE_COUNT; p++)
+        if(ph[p].circuits > 0)
+            write_bench_phase(stdout, PHASE_NAMES[p], &ph[p], opt->json);
+    fflush(stdout);
+
+    fprintf(stderr, "Benchmark: %ld circuiti da %d resistenze (profondità %d, fino a %d rami, incognita %s), seme %llu.\n",
+            opt->bench_count, opt->bench_size, opt->bench_depth, opt->bench_fanout,
+            BENCH_UNKNOWN_NAMES[opt->bench_unknown], (unsigned long long)opt->seed);
+    if(ph[PHASE_RENDER].circuits < opt->bench_count)
+        fprintf(stderr, "Disegno saltato per %ld circuiti troppo grandi.\n",
+                opt->bench_count - ph[PHASE_RENDER].circuits);
+    if(wrong > 0)
+        fprintf(stderr, "Attenzione: Rx non ritrovata in %ld circuiti.\n", wrong);
+    if(wrong_bytecode > 0)
+        fprintf(stderr, "Attenzione: il bytecode differisce dalla valutazione in %ld circuiti.\n", wrong_bytecode);
+
+    int status = 0;
+    if(opt->baseline) {
+        int regressions = bench_compare(opt->baseline, ph, opt->threshold);
+        if(regressions < 0)
+            status = 1;
+        else if(regressions > 0) {
+            fprintf(stderr, "%d fasi più lente del riferimento oltre il %.0f%%.\n", regressions, opt->threshold * 100);
+            status = 1;
+        }
+    }
+
+    free(g.text);
+    free(g.res);
+    free(enc);
+    free(prog_stack);
+    program_free(&prog);
+    context_destroy(ctx);
+    return status;
+}
+
+/* --- AUTOVERIFICA --- */
+// --self-test confronta valutatori indipendenti sui circuiti generati dal benchmark
+// (--count, --size, --depth, --fanout, --seed) e termina con stato 1 al primo
+// disaccordo, indicando il circuito per riprodurlo:
+//   sensibilità   dReq/dRi di adjoint_sweep coincide con la differenza finita centrale
+//                 (Req(Ri + h) - Req(Ri - h)) / 2h, h = 1e-4 Ri, entro l'errore di
+//                 troncamento (relativo, ~1e-8) più quello di arrotondamento (~eps Req / h)
+//   incrementale  dopo ogni inc_set casuale la Req coincide bit per bit con
+//                 evaluate_topology sugli stessi valori
+#define SELFTEST_DIFFS 16       // elementi controllati alle differenze finite per circuito
+#define SELFTEST_UPDATES 64     // aggiornamenti casuali per circuito
+
+// Valore casuale di un aggiornamento: ogni tanto 0, che esclude un ramo in parallelo
+static double selftest_value(Rng *r) {
+    return rng_uniform(r) < 0.05 ? 0.0 : 1 + 999 * rng_uniform(r);
+}
+
+static int selftest_sensitivity(CircuitContext *ctx, Rng *r, long c, double **buf, int *cap, long *checks) {
+    Topology *t = &ctx->topo;
+    if(t->n > *cap) {
+        *cap = 2 * t->n;
+        *buf = xrealloc(*buf, 2 * (size_t)*cap * sizeof(double));
+    }
+    double *node = *buf, *grad = *buf + *cap;
+    double Req = evaluate_nodes(t, node, t->stack);
+    adjoint_sweep(t, node, grad);
+    for(int d = 0; d < SELFTEST_DIFFS; d++) {
+        // un elemento a caso fra quelli positivi (a 0 il passo h si annulla)
+        int i = (int)(rng_next(r) % t->n), tries = 0;
+        while((t->kind[i] != TOPO_RES || !(t->value[i] > 0)) && ++tries < t->n)
+            i = (i + 1) % t->n;
+        if(tries == t->n)
+            break;
+        double x = t->value[i], h = 1e-4 * x;
+        double up = x + h, down = x - h;
+        t->value[i] = up;
+        double r_up = evaluate_topology(t, t->stack);
+        t->value[i] = down;
+        double r_down = evaluate_topology(t, t->stack);
+        t->value[i] = x;
+        double fd = (r_up - r_down) / (up - down);
+        double tol = 1e-6 * fabs(grad[i]) + 64 * DBL_EPSILON * Req / (up - down);
+        (*checks)++;
+        if(!(fabs(fd - grad[i]) <= tol)) {
+            fprintf(stderr, "Sensibilità: circuito %ld, nodo %d (valore %.17g): dReq/dR %.17g, differenza finita %.17g.\n",
+                    c + 1, i, x, grad[i], fd);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int selftest_incremental(CircuitContext *ctx, Rng *r, long c, long *checks) {
+    Topology *t = &ctx->topo;
+    IncCircuit ic = { 0 };
+    inc_build(&ic, t);
+    int status = 0;
+    for(int u = 0; u < SELFTEST_UPDATES && ic.n_leaves > 0; u++) {
+        int e = (int)(rng_next(r) % ic.n_leaves);
+        double v = selftest_value(r);
+        double got = inc_set(&ic, e, v);
+        t->value[ic.leaf_node[e]] = v;
+        double want = evaluate_topology(t, t->stack);
+        (*checks)++;
+        if(memcmp(&got, &want, sizeof(double)) != 0) {
+            fprintf(stderr, "Incrementale: circuito %ld, aggiornamento %d (elemento %d = %.17g): %.17g invece di %.17g.\n",
+                    c + 1, u + 1, e + 1, v, got, want);
+            status = 1;
+            break;
+        }
+    }
+    inc_free(&ic);
+    return status;
+}
+
+int run_self_test(const Options *opt) {
+    Options gen = *opt;
+    gen.bench_unknown = BENCH_NONE; // tutti i valori sono noti
+    BenchGen g = { 0 };
+    g.opt = &gen;
+    rng_seed(&g.rng, opt->seed);
+    Rng r;
+    rng_seed(&r, opt->seed ^ 0x5bd1e995);
+    CircuitContext *ctx = context_create(opt->stats);
+    ctx->topology_only = 1;
+    double *buf = NULL;
+    int cap = 0;
+    long circuits = 0, diff_checks = 0, inc_checks = 0;
+    int status = 0;
+
+    for(long c = 0; c < opt->bench_count && !status; c++, circuits++) {
+        gen_circuit(&g);
+        reset_circuit(ctx);
+        parse_circuit_utf8(ctx, g.text, g.len);
+        // prima delle differenze finite: gli aggiornamenti possono azzerare elementi,
+        // dove Req non è derivabile
+        status = selftest_sensitivity(ctx, &r, c, &buf, &cap, &diff_checks) ||
+                 selftest_incremental(ctx, &r, c, &inc_checks);
+    }
+
+    fprintf(stderr, "Autoverifica %s: %ld circuiti da %d resistenze (profondità %d, fino a %d rami), seme %llu.\n",
+            status ? "fallita" : "superata", circuits, opt->bench_size, opt->bench_depth, opt->bench_fanout,
+            (unsigned long long)opt->seed);
+    fprintf(stderr, "  sensibilità: %ld derivate confrontate con le differenze finite.\n", diff_checks);
+    fprintf(stderr, "  incrementale: %ld aggiornamenti confrontati bit per bit con la valutazione completa.\n", inc_checks);
+    free(buf);
+    free(g.text);
+    free(g.res);
+    context_destroy(ctx);
+    return status;
+}
+
+/* --- MODALITÀ INTERATTIVA --- */
+// Legge una riga di lunghezza qualsiasi (senza '\n'); 0 se l'input è terminato
+int read_wide_line(wchar_t **buf, size_t *cap) {
+    size_t len = 0;
+    for(;;) {
+        if(*cap - len < 2) {
+            *cap = *cap ? *cap * 2 : 256;
+            *buf = xrealloc(*buf, *cap * sizeof(wchar_t));
+        }
+        if(!fgetws(*buf + len, (int)(*cap - len), stdin))
+            return len > 0;
+        len += wcslen(*buf + len);
+        if(len > 0 && (*buf)[len - 1] == L'\n') {
+            (*buf)[--len] = L'\0';
+            return 1;
+        }
+    }
+}
+
+static int interactive_session(CircuitContext *ctx, const Options *opt) {
+    wchar_t *circuit = NULL;
+    size_t circuit_cap = 0;
+    double I = -1, V = -1;
+
+    wprintf(L"+++ Circuit Resolver con gestione delle incognite (flowchart) +++\n");
+    print_instructions();
+    wprintf(L"Inserisci circuito: ");
+
+    if (!read_wide_line(&circuit, &circuit_cap)) {
+        wprintf(L"Errore di lettura del circuito.\n");
+        return 1;
+    }
+
+    size_t len = wcslen(circuit);
+    if(len < 2 || circuit[0] != L'+' || circuit[len - 1] != L'-') {
+        wprintf(L"Errore: il circuito deve iniziare con '+' e terminare con '-'.\n");
+        return 1;
+    }
+
+    parse_circuit(ctx, circuit);
+    if(ctx->topo.n_reactive) {
+        wprintf(L"Errore: condensatori e induttori sono supportati solo da --sweep.\n");
+        return 1;
+    }
+
+    if(opt->no_draw) {
+        // --no-draw: solo i calcoli
+    } else if(isSimpleCircuit(ctx)) {
+        customDrawSimpleCircuit();
+    } else {
+        struct timespec t0;
+        stats_start(ctx->stats, &t0);
+        int max_col = grid_columns(ctx);
+        wprintf(L"\n=== Disegno del circuito ===\n\n");
+        if(init_grid(ctx, max_col)) {
+            render_blocks(ctx);
+            close_circuit(ctx);
+            draw_generator(ctx);
+            print_grid(ctx);
+            stats_stop(ctx->stats, PHASE_RENDER, &t0);
+        } else {
+            wprintf(L"Disegno omesso: il circuito è troppo grande (%d x %d caratteri). Usa --no-draw per i soli calcoli.\n",
+                    ctx->grid_rows, ctx->grid_width);
+        }
+    }
+
+    double Req_known = calculate_total_resistance_new(ctx);
+    wprintf(L"\n--- Calcoli ---\n");
+    wprintf(L"Somma delle resistenze note (Req_known): %.2f Ohm\n", Req_known);
+
+    int unknown_count = count_unknowns(ctx);
+    double Req_measured = 0; // Per resistenza equivalente misurata o sum note
+
+    if (unknown_count == 1) {
+        RxFlowchart f;
+        prepare_rx(ctx, &f, Req_known);
+        if (f.parallel) {
+            wprintf(L"\nIl circuito contiene una resistenza incognita in un gruppo parallelo.\n");
+        } else {
+            wprintf(L"\nIl circuito contiene una resistenza incognita in serie.\n");
+        }
+
+        int valid = 0;
+        wchar_t buffer[64];
+
+        for (int attempt = 0; attempt < 3 && !valid; attempt++) {
+            wprintf(L"Inserisci il valore complessivo misurato (Req): ");
+            fflush(stdout);
+            if (fgetws(buffer, sizeof(buffer) / sizeof(wchar_t), stdin) != NULL) {
+                buffer[wcscspn(buffer, L"\n")] = L'\0';
+                Req_measured = wcstod(buffer, NULL);
+
+                double Rx;
+                switch (solve_rx(&f, Req_measured, &Rx)) {
+                    case RX_OK:
+                        wprintf(L"Resistenza incognita Rx calcolata: %.2f Ohm\n", Rx);
+                        valid = 1;
+                        break;
+                    case RX_BAD_MEASURE:
+                        wprintf(L"Errore: il valore misurato deve essere positivo.\n");
+                        break;
+                    case RX_BAD_DATA:
+                        wprintf(L"Errore: dati non validi (Req deve essere minore di %.2f Ohm).\n", f.Req_max);
+                        break;
+                    case RX_NON_POSITIVE:
+                        if (f.parallel)
+                            wprintf(L"Errore: il calcolo di Rx risulta zero o negativo (%.2f Ohm).\n", Rx);
+                        else
+                            wprintf(L"Errore: il calcolo di Rx risulta zero o negativo (%.2f Ohm). Controlla i dati!\n", Rx);
+                        break;
+                }
+            }
+        }
+
+        if (!valid) {
+            wprintf(L"\nValore non valido dopo 3 tentativi. Impossibile calcolare Rx.\n");
+            return 1;
+        }
+    } else if (unknown_count > 1) {
+        wprintf(L"\nIl circuito contiene più di una resistenza incognita. Calcolo non supportato.\n");
+        return 1;
+    } else {
+        // Nessuna incognita, usa la somma nota come valore equivalente
+        Req_measured = Req_known;
+    }
+
+    // Variabile per resistenza da usare nel calcolo di corrente e tensione
+    double Req_for_current = Req_measured;
+
+    wchar_t input[50];
+    wprintf(L"\nInserisci corrente I (A), se nota (-1 se non nota): ");
+    if(fgetws(input, sizeof(input) / sizeof(wchar_t), stdin)) {
+        input[wcscspn(input, L"\n")] = L'\0';
+        I = wcstod(input, NULL);
+    }
+    wprintf(L"Inserisci tensione V (V), se nota (-1 se non nota): ");
+    if(fgetws(input, sizeof(input) / sizeof(wchar_t), stdin)) {
+        input[wcscspn(input, L"\n")] = L'\0';
+        V = wcstod(input, NULL);
+    }
+
+    if (Req_for_current <= 0) {
+        wprintf(L"Errore: resistenza per calcolo corrente/tensione non valida (<= 0).\n");
+        return 1;
+    }
+
+    if (I > 0 && V <= 0)
+        V = I * Req_for_current;
+    else if (V > 0 && I <= 0)
+        I = V / Req_for_current;
+
+    wprintf(L"Tensione: %ls%.2f V\n", V > 0 ? L"" : L"(non disponibile) ", V > 0 ? V : 0);
+    wprintf(L"Corrente: %ls%.2f A\n", I > 0 ? L"" : L"(non disponibile) ", I > 0 ? I : 0);
+
+    if (I > 0 && V > 0)
+        wprintf(L"\nCalcoli completati con successo.\n");
+    else
+        wprintf(L"\nNon tutti i dati sono disponibili per completare l'analisi.\n");
+
+    return 0;
+}
+
+int run_interactive(const Options *opt) {
+    CircuitContext *ctx = context_create(opt->stats);
+    // un solo circuito: i worker servono al fork-join se è grande
+    WorkPool pool;
+    int nthreads = opt->threads > 0 ? opt->threads : online_cpus();
+    if(nthreads > 1) {
+        pool_init(&pool, nthreads);
+        ctx->pool = &pool;
+    }
+    int status = interactive_session(ctx, opt);
+    context_destroy(ctx);
+    if(nthreads > 1)
+        pool_destroy(&pool);
+    return status;
+}
+
+/* --- OPZIONI DA RIGA DI COMANDO --- */
+void print_usage(const char *prog) {
+    fprintf(stderr,
+            "Uso: %s                 modalità interattiva\n"
+            "     %s --batch [FILE]  un circuito per riga: \"circuito [Req] [I] [V]\"\n"
+            "     %s --stream [FILE]  come --batch per circuiti enormi, letti a blocchi senza tenerli in memoria\n"
+            "     %s --montecarlo N [FILE]  distribuzione di Req su N campioni per circuito\n"
+            "     %s --interval [FILE]  limiti garantiti di Req e Rx entro la tolleranza\n"
+            "     %s --sensitivity [FILE]  dReq/dRi (e dRx/dRi) per ogni elemento dei record\n"
+            "     %s --elements [FILE]  corrente, tensione e potenza di ogni elemento dei record\n"
+            "     %s --sweep CIRCUITO  impedenza complessa su frequenze logaritmiche (elementi R, C, L)\n"
+            "     %s --tune CIRCUITO  legge \"ELEMENTO VALORE\" da stdin e stampa la nuova Req\n"
+            "     %s --fit [FILE]    stima più incognite da più record \"circuito Req\" (problemi separati da righe vuote)\n"
+            "     %s --netlist FILE  Req fra due nodi di una rete \"NODO_A NODO_B R\" (analisi nodale)\n"
+            "     %s --to-netlist CIRCUITO  converte un circuito a blocchi in netlist\n"
+            "     %s --bench         misura parsing, valutazione, calcolo di Rx e disegno su circuiti generati\n"
+            "     %s --self-test     confronta fra loro i valutatori sui circuiti generati dal benchmark\n"
+            "     %s --compile OUT [FILE]  compila i record del batch in un file binario\n"
+            "     %s --run-compiled FILE  valuta un file compilato (mappato in memoria, senza parsing)\n"
+            "     %s --serve SOCKET  risponde ai record inviati su un socket Unix\n"
+            "     %s --client SOCKET [FILE]  invia i record di FILE al server e stampa le risposte\n"
+            "     %s --synth R       reti di resistenze normalizzate con Req vicina a R\n"
+            "Opzioni:\n"
+            "  --json                output JSON lines invece di CSV (batch)\n"
+            "  --threads N           worker del batch e dei circuiti grandi (predefinito: tutti i core)\n"
+            "  --tolerance T         tolleranza delle resistenze, es. 0.05 o 5%% (Monte Carlo, intervalli, sintesi)\n"
+            "  --gaussian            distribuzione normale con sigma = T/3 invece di uniforme\n"
+            "  --seed S              seme del generatore casuale\n"
+            "  --terminals A B       terminali della netlist (predefiniti: + e -)\n"
+            "  --voltages FILE       scrive i potenziali dei nodi con V(A) = 1, V(B) = 0\n"
+            "  --no-draw             non disegna il circuito (modalità interattiva)\n"
+            "  --count N             circuiti generati (benchmark e autoverifica, predefinito 1000)\n"
+            "  --size N              resistenze per circuito (benchmark e autoverifica, predefinito 1000)\n"
+            "  --depth D             profondità massima dei gruppi paralleli (benchmark e autoverifica, predefinito 3)\n"
+            "  --fanout F            rami massimi per gruppo, almeno 2 (benchmark e autoverifica, predefinito 3)\n"
+            "  --unknown POS         incognita: none, series, branch, deep, random (predefinito branch)\n"
+            "  --baseline FILE       confronta con il CSV di un benchmark precedente\n"
+            "  --threshold T         calo tollerato rispetto al riferimento, es. 0.1 o 10%% (predefinito 10%%)\n"
+            "  --stats [FILE]        tempi per fase e contatori in JSON all'uscita (predefinito: stderr)\n"
+            "  --series E12|E24|E96  serie di valori della sintesi (predefinita E24)\n"
+            "  --parts K             resistenze massime per rete, da 1 a 5 (sintesi, predefinito 3)\n"
+            "  --top N               candidati per numero di parti (sintesi, predefinito 5)\n"
+            "  --fmin F, --fmax F    estremi della sweep in Hz (predefiniti 10 e 1e6)\n"
+            "  --points N            frequenze della sweep (predefinito 1000)\n"
+            "  --cache N             riusa i risultati di circuiti e sottocircuiti ripetuti, fino a N voci (batch)\n"
+            "  -h, --help            mostra questo messaggio\n",
+            prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog,
+            prog);
+}
+
+// Restituisce 0 se gli argomenti non sono validi
+int parse_options(int argc, char *argv[], Options *opt) {
+    memset(opt, 0, sizeof(*opt));
+    opt->tolerance = 0.05;
+    opt->seed = 1;
+    opt->terminal_a = "+";
+    opt->terminal_b = "-";
+    opt->bench_count = 1000;
+    opt->bench_size = 1000;
+    opt->bench_depth = 3;
+    opt->bench_fanout = 3;
+    opt->bench_unknown = BENCH_BRANCH;
+    opt->threshold = 0.10;
+    opt->synth_series = 1;
+    opt->synth_parts = 3;
+    opt->synth_top = 5;
+    opt->fmin = 10;
+    opt->fmax = 1e6;
+    opt->points = 1000;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--batch") == 0) {
+            opt->batch = 1;
+            if(i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0)
+                opt->input = argv[++i];
+        } else if(strcmp(argv[i], "--montecarlo") == 0 && i + 1 < argc) {
+            opt->montecarlo = atol(argv[++i]);
+            if(opt->montecarlo <= 0)
+                return 0;
+            if(i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0)
+                opt->input = argv[++i];
+        } else if(strcmp(argv[i], "--fit") == 0) {
+            opt->fit = 1;
+            if(i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0)
+                opt->input = argv[++i];
+        } else if(strcmp(argv[i], "--netlist") == 0 && i + 1 < argc) {
+            opt->netlist = argv[++i];
+        } else if(strcmp(argv[i], "--terminals") == 0 && i + 2 < argc) {
+            opt->terminal_a = argv[++i];
+            opt->terminal_b = argv[++i];
+        } else if(strcmp(argv[i], "--voltages") == 0 && i + 1 < argc) {
+            opt->voltages = argv[++i];
+        } else if(strcmp(argv[i], "--to-netlist") == 0 && i + 1 < argc) {
+            opt->to_netlist = argv[++i];
+        } else if(strcmp(argv[i], "--interval") == 0) {
+            opt->interval = 1;
+            if(i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0)
+                opt->input = argv[++i];
+        } else if(strcmp(argv[i], "--sensitivity") == 0) {
+            opt->sensitivity = 1;
+            if(i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0)
+                opt->input = argv[++i];
+        } else if(strcmp(argv[i], "--stream") == 0) {
+            opt->stream = 1;
+            if(i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0)
+                opt->input = argv[++i];
+        } else if(strcmp(argv[i], "--elements") == 0) {
+            opt->elements = 1;
+            if(i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0)
+                opt->input = argv[++i];
+        } else if(strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+            char *end;
+            opt->tolerance = strtod(argv[++i], &end);
+            if(*end == '%')
+                opt->tolerance /= 100.0;
+            if(opt->tolerance < 0 || opt->tolerance >= 1)
+                return 0;
+        } else if(strcmp(argv[i], "--gaussian") == 0) {
+            opt->gaussian = 1;
+        } else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            opt->seed = strtoull(argv[++i], NULL, 10);
+        } else if(strcmp(argv[i], "--tune") == 0 && i + 1 < argc) {
+            opt->tune = argv[++i];
+        } else if(strcmp(argv[i], "--bench") == 0) {
+            opt->bench = 1;
+        } else if(strcmp(argv[i], "--self-test") == 0) {
+            opt->self_test = 1;
+        } else if(strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+            opt->bench_count = atol(argv[++i]);
+            if(opt->bench_count <= 0)
+                return 0;
+        } else if(strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            opt->bench_size = atoi(argv[++i]);
+            if(opt->bench_size <= 0)
+                return 0;
+        } else if(strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+            opt->bench_depth = atoi(argv[++i]);
+            if(opt->bench_depth < 0 || opt->bench_depth > BENCH_MAX_DEPTH)
+                return 0;
+        } else if(strcmp(argv[i], "--fanout") == 0 && i + 1 < argc) {
+            opt->bench_fanout = atoi(argv[++i]);
+            if(opt->bench_fanout < 2)
+                return 0;
+        } else if(strcmp(argv[i], "--unknown") == 0 && i + 1 < argc) {
+            const char *pos = argv[++i];
+            opt->bench_unknown = -1;
+            for(int u = BENCH_NONE; u <= BENCH_RANDOM; u++)
+                if(strcmp(pos, BENCH_UNKNOWN_NAMES[u]) == 0)
+                    opt->bench_unknown = u;
+            if(opt->bench_unknown < 0)
+                return 0;
+        } else if(strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            opt->baseline = argv[++i];
+        } else if(strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            char *end;
+            opt->threshold = strtod(argv[++i], &end);
+            if(*end == '%')
+                opt->threshold /= 100.0;
+            if(opt->threshold < 0)
+                return 0;
+        } else if(strcmp(argv[i], "--compile") == 0 && i + 1 < argc) {
+            opt->compile = argv[++i];
+            if(i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0)
+                opt->input = argv[++i];
+        } else if(strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            opt->serve = argv[++i];
+        } else if(strcmp(argv[i], "--client") == 0 && i + 1 < argc) {
+            opt->client = argv[++i];
+            if(i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0)
+                opt->input = argv[++i];
+        } else if(strcmp(argv[i], "--synth") == 0 && i + 1 < argc) {
+            opt->synth = strtod(argv[++i], NULL);
+            if(!(opt->synth > 0) || isinf(opt->synth))
+                return 0;
+        } else if(strcmp(argv[i], "--series") == 0 && i + 1 < argc) {
+            const char *name = argv[++i];
+            opt->synth_series = -1;
+            for(int e = 0; e < (int)(sizeof(E_SERIES) / sizeof(E_SERIES[0])); e++)
+                if(strcmp(name, E_SERIES[e].name) == 0)
+                    opt->synth_series = e;
+            if(opt->synth_series < 0)
+                return 0;
+        } else if(strcmp(argv[i], "--parts") == 0 && i + 1 < argc) {
+            opt->synth_parts = atoi(argv[++i]);
+            if(opt->synth_parts < 1 || opt->synth_parts > SYNTH_MAX_PARTS)
+                return 0;
+        } else if(strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+            opt->synth_top = atoi(argv[++i]);
+            if(opt->synth_top < 1 || opt->synth_top > SYNTH_MAX_TOP)
+                return 0;
+        } else if(strcmp(argv[i], "--sweep") == 0 && i + 1 < argc) {
+            opt->sweep = argv[++i];
+        } else if(strcmp(argv[i], "--fmin") == 0 && i + 1 < argc) {
+            opt->fmin = strtod(argv[++i], NULL);
+            if(!(opt->fmin > 0) || isinf(opt->fmin))
+                return 0;
+        } else if(strcmp(argv[i], "--fmax") == 0 && i + 1 < argc) {
+            opt->fmax = strtod(argv[++i], NULL);
+            if(!(opt->fmax > 0) || isinf(opt->fmax))
+                return 0;
+        } else if(strcmp(argv[i], "--points") == 0 && i + 1 < argc) {
+            opt->points = atol(argv[++i]);
+            if(opt->points <= 0)
+                return 0;
+        } else if(strcmp(argv[i], "--run-compiled") == 0 && i + 1 < argc) {
+            opt->run_compiled = argv[++i];
+        } else if(strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            opt->cache_entries = atol(argv[++i]);
+            if(opt->cache_entries <= 0)
+                return 0;
+        } else if(strcmp(argv[i], "--stats") == 0) {
+            opt->collect_stats = 1;
+            if(i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0)
+                opt->stats_file = argv[++i];
+        } else if(strcmp(argv[i], "--no-draw") == 0) {
+            opt->no_draw = 1;
+        } else if(strcmp(argv[i], "--json") == 0) {
+            opt->json = 1;
+        } else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            opt->threads = atoi(argv[++i]);
+            if(opt->threads < 0)
+                return 0;
+        } else {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int run_mode(const Options *opt) {
+    if(opt->bench)
+        return run_bench(opt);
+    if(opt->self_test)
+        return run_self_test(opt);
+    if(opt->serve)
+        return run_serve(opt);
+    if(opt->client)
+        return run_client(opt);
+    if(opt->compile)
+        return run_compile(opt);
+    if(opt->run_compiled)
+        return run_compiled(opt);
+    if(opt->synth > 0)
+        return run_synth(opt);
+    if(opt->sweep)
+        return run_sweep(opt);
+    if(opt->tune)
+        return run_tune(opt);
+    if(opt->montecarlo)
+        return run_montecarlo(opt);
+    if(opt->interval)
+        return run_interval(opt);
+    if(opt->sensitivity)
+        return run_sensitivity(opt);
+    if(opt->elements)
+        return run_elements(opt);
+    if(opt->fit)
+        return run_fit(opt);
+    if(opt->to_netlist)
+        return run_to_netlist(opt);
+    if(opt->netlist)
+        return run_netlist(opt);
+    if(opt->stream)
+        return run_stream(opt);
+    if(opt->batch)
+        return run_batch(opt);
+    return run_interactive(opt);
+}
+
+int main(int argc, char *argv[]) {
+    setlocale(LC_ALL, "");
+    if(argc > 1 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)) {
+        print_usage(argv[0]);
+        return 0;
+    }
+    Options opt;
+    if(!parse_options(argc, argv, &opt)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if(!opt.collect_stats)
+        return run_mode(&opt);
+
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    opt.stats = stats_create(NULL);
+    int status = run_mode(&opt);
+    double wall = elapsed_since(&t0);
+    FILE *out = opt.stats_file ? fopen(opt.stats_file, "w") : stderr;
+    if(!out) {
+        fprintf(stderr, "Errore: impossibile scrivere le statistiche in %s\n", opt.stats_file);
+        return 1;
+    }
+    setlocale(LC_NUMERIC, "C");
+    write_stats(out, opt.stats, wall);
+    stats_release(opt.stats);
+    if(out != stderr)
+        fclose(out);
+    return status;
+}